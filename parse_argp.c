@@ -22,6 +22,7 @@ struct sa_opts sa_opts = {
 	.output = "sched-analyzer.perfetto-trace",
 	.output_path = NULL,
 	.max_size = 250 * 1024 * 1024, /* 250MiB */
+	.stats_period = 100, /* 100ms */
 	.num_ftrace_event = 0,
 	.num_atrace_cat = 0,
 	.num_function_graph = 0,
@@ -50,13 +51,47 @@ struct sa_opts sa_opts = {
 	.softirq = false,
 	.sched_switch = false,
 	.load_balance = false,
+	.load_balance_stats = false,
 	.ipi = false,
 	.irq = false,
+	.wakeup_latency = false,
+	.runq_wait = false,
+	.cgroup_pelt = false,
+	.placement = false,
+	.schedutil = false,
+	.idle_governor = false,
+	.ipi_latency = false,
+	.stacks = false,
+	.rq_lock = false,
+	.pmu = false,
+	.migrations = false,
+	.cfs_throttle = false,
+	.psi = false,
+	.rt_dl = false,
+	.eevdf = false,
+	.energy = false,
+	.freq_residency = false,
+	.pelt_running = false,
+	.pelt_tgid = false,
+	/* thresholds */
+	.wakeup_latency_threshold = 0,
+	.ipi_latency_threshold = 0,
+	.load_balance_threshold = 0,
+	.softirq_threshold = 0,
+	.rq_lock_threshold = 0,
+	.cfs_throttle_threshold = 0,
+	.placement_sample = 10,
+	.ipi_sample = 0,
+	.energy_sample = 10,
+	.task_min_util = 0,
+	.top_tasks = 0,
 	/* filters */
 	.num_pids = 0,
 	.num_comms = 0,
+	.num_cgroups = 0,
 	.pid = { 0 },
 	.comm = { { 0 } },
+	.cgroup = { 0 },
 };
 
 enum sa_opts_flags {
@@ -70,6 +105,7 @@ enum sa_opts_flags {
 	OPT_OUTPUT,
 	OPT_OUTPUT_PATH,
 	OPT_MAX_SIZE,
+	OPT_STATS_PERIOD,
 	OPT_FTRACE_EVENT,
 	OPT_ATRACE_CAT,
 	OPT_FUNCTION_GRAPH,
@@ -95,12 +131,47 @@ enum sa_opts_flags {
 	OPT_CPU_NR_RUNNING,
 	OPT_CPU_IDLE,
 	OPT_LOAD_BALANCE,
+	OPT_LOAD_BALANCE_STATS,
 	OPT_IPI,
 	OPT_IRQ,
+	OPT_SOFTIRQ,
+	OPT_WAKEUP_LATENCY,
+	OPT_RUNQ_WAIT,
+	OPT_CGROUP_PELT,
+	OPT_PLACEMENT,
+	OPT_SCHEDUTIL,
+	OPT_IDLE_GOVERNOR,
+	OPT_IPI_LATENCY,
+	OPT_STACKS,
+	OPT_RQ_LOCK,
+	OPT_PMU,
+	OPT_MIGRATIONS,
+	OPT_CFS_THROTTLE,
+	OPT_PSI,
+	OPT_RT_DL,
+	OPT_EEVDF,
+	OPT_ENERGY,
+	OPT_FREQ_RESIDENCY,
+	OPT_PELT_RUNNING,
+	OPT_PELT_TGID,
+
+	/* thresholds */
+	OPT_WAKEUP_LATENCY_THRESHOLD,
+	OPT_IPI_LATENCY_THRESHOLD,
+	OPT_LOAD_BALANCE_THRESHOLD,
+	OPT_SOFTIRQ_THRESHOLD,
+	OPT_RQ_LOCK_THRESHOLD,
+	OPT_CFS_THROTTLE_THRESHOLD,
+	OPT_PLACEMENT_SAMPLE,
+	OPT_IPI_SAMPLE,
+	OPT_ENERGY_SAMPLE,
+	OPT_TASK_MIN_UTIL,
+	OPT_TOP_TASKS,
 
 	/* filters */
 	OPT_FILTER_PID,
 	OPT_FILTER_COMM,
+	OPT_FILTER_CGROUP,
 };
 
 static const struct argp_option options[] = {
@@ -111,6 +182,7 @@ static const struct argp_option options[] = {
 	{ "output", OPT_OUTPUT, "FILE", 0, "Filename of the perfetto-trace file to produce." },
 	{ "output_path", OPT_OUTPUT_PATH, "PATH", 0, "Path to store perfetto-trace. PWD by default for perfetto." },
 	{ "max_size", OPT_MAX_SIZE, "SIZE(MiB)", 0, "Maximum size of perfetto file to produce, 250MiB by default." },
+	{ "stats_period", OPT_STATS_PERIOD, "MSEC", 0, "Period to sample in-kernel aggregated stats into perfetto counters, 100ms by default." },
 	{ "ftrace_event", OPT_FTRACE_EVENT, "FTRACE_EVENT", 0, "Add ftrace event to the captured data. Repeat for each event to add." },
 	/* events */
 	{ "atrace_cat", OPT_ATRACE_CAT, "ATRACE_CATEGORY", 0, "Perfetto atrace category to add to perfetto config. Repeat for each category to add." },
@@ -136,11 +208,45 @@ static const struct argp_option options[] = {
 	{ "cpu_nr_running", OPT_CPU_NR_RUNNING, 0, 0, "Collect nr_running tasks for each CPU." },
 	{ "cpu_idle", OPT_CPU_IDLE, 0, 0, "Collect info about cpu idle states for each CPU." },
 	{ "load_balance", OPT_LOAD_BALANCE, 0, 0, "Collect load balance related info." },
-	{ "ipi", OPT_IPI, 0, 0, "Collect ipi related info." },
-	{ "irq", OPT_IRQ, 0, 0, "Enable perfetto irq atrace category." },
+	{ "load_balance_stats", OPT_LOAD_BALANCE_STATS, 0, 0, "Collect load balance attempts, successes, tasks moved and time spent per sched domain level." },
+	{ "ipi", OPT_IPI, 0, 0, "Collect number of ipis sent between each pair of CPUs and per callback." },
+	{ "irq", OPT_IRQ, 0, 0, "Collect hard and soft irq time and duration histograms per CPU. Use --atrace_cat irq to get every irq as a slice." },
+	{ "softirq", OPT_SOFTIRQ, 0, 0, "Collect softirq time and duration histograms per CPU." },
+	{ "wakeup_latency", OPT_WAKEUP_LATENCY, 0, 0, "Collect wakeup latency histograms per CPU and per process." },
+	{ "runq_wait", OPT_RUNQ_WAIT, 0, 0, "Collect time tasks spent runnable waiting on the runqueue per CPU and per task." },
+	{ "cgroup_pelt", OPT_CGROUP_PELT, 0, 0, "Collect load_avg, runnable_avg and util_avg of cgroups selected with --cgroup." },
+	{ "placement", OPT_PLACEMENT, 0, 0, "Collect which path select_task_rq_fair() took and where it placed the task." },
+	{ "schedutil", OPT_SCHEDUTIL, 0, 0, "Collect schedutil frequency requests and how often they were rate limited per policy." },
+	{ "idle_governor", OPT_IDLE_GOVERNOR, 0, 0, "Collect how often teo and menu idle governors picked a too deep or too shallow idle state per CPU. Only misses are emitted as events." },
+	{ "ipi_latency", OPT_IPI_LATENCY, 0, 0, "Collect histograms of ipi delivery latency and callback duration per callback and target CPU." },
+	{ "stacks", OPT_STACKS, 0, 0, "Capture kernel stacks of wakeup latency, load balance, softirq and rq lock events that exceed their threshold." },
+	{ "rq_lock", OPT_RQ_LOCK, 0, 0, "Collect contention on runqueue locks: wait time histograms, number of contentions and contenders per CPU." },
+	{ "pmu", OPT_PMU, 0, 0, "Collect cycles, instructions and IPC of tasks, read at context switch. Separate counters are emitted per CPU capacity on asymmetric systems. Falls back to cpu-clock when there's no PMU." },
+	{ "migrations", OPT_MIGRATIONS, 0, 0, "Collect tasks migrations between CPUs and NUMA balancing moves and swaps. Migrations are classified as within LLC, cross LLC or cross NUMA node." },
+	{ "cfs_throttle", OPT_CFS_THROTTLE, 0, 0, "Collect CFS bandwidth throttling of cgroups per CPU: number of times and time throttled. Honours --cgroup." },
+	{ "psi", OPT_PSI, 0, 0, "Collect cpu, memory and io pressure stall time of the system and of every --cgroup, sampled every --stats_period." },
+	{ "rt_dl", OPT_RT_DL, 0, 0, "Collect RT and DL push/pull, RT runtime throttling and dl_server activity per CPU. Only RT throttled windows are emitted as slices." },
+	{ "eevdf", OPT_EEVDF, 0, 0, "Collect EEVDF lag of tasks going to sleep in a per task histogram. vlag, virtual deadline and slice of filtered tasks are emitted at every context switch. Requires 6.6+." },
+	{ "energy", OPT_ENERGY, 0, 0, "Collect find_energy_efficient_cpu() decisions with the energy delta of every candidate CPU, and estimate energy of every performance domain from the energy model and busy time at each frequency. The energy model is read from debugfs." },
+	{ "freq_residency", OPT_FREQ_RESIDENCY, 0, 0, "Collect in kernel the time every task ran at each frequency. Printed as a table when sched-analyzer exits." },
+	{ "pelt_running", OPT_PELT_RUNNING, 0, 0, "Also emit load_avg, util_avg and util_est of tasks gated by whether they are running, ie: 0 when not running. Applies to the enabled --*_task signals. Task signals are emitted at every context switch, better used with filters." },
+	{ "pelt_tgid", OPT_PELT_TGID, 0, 0, "Collect util_avg, runnable_avg and util_est summed over all threads of every process in kernel. Emitted every stats_period. --pid and --comm match the process." },
+	/* thresholds */
+	{ "wakeup_latency_threshold", OPT_WAKEUP_LATENCY_THRESHOLD, "USEC", 0, "Emit wakeup latency events that exceed USEC into perfetto. Implies --wakeup_latency." },
+	{ "ipi_latency_threshold", OPT_IPI_LATENCY_THRESHOLD, "USEC", 0, "Emit ipi delivery latency or callback duration that exceed USEC into perfetto. Implies --ipi_latency." },
+	{ "load_balance_threshold", OPT_LOAD_BALANCE_THRESHOLD, "USEC", 0, "Only emit balance_fair(), pick_next_task_fair() and newidle_balance() that took longer than USEC or ran load_balance(). Implies --load_balance." },
+	{ "softirq_threshold", OPT_SOFTIRQ_THRESHOLD, "USEC", 0, "Capture kernel stacks of softirqs that took longer than USEC. Implies --softirq and --stacks." },
+	{ "rq_lock_threshold", OPT_RQ_LOCK_THRESHOLD, "USEC", 0, "Capture kernel stacks of rq lock waits that took longer than USEC. Implies --rq_lock and --stacks." },
+	{ "cfs_throttle_threshold", OPT_CFS_THROTTLE_THRESHOLD, "USEC", 0, "Only emit throttled slices that lasted longer than USEC. Implies --cfs_throttle." },
+	{ "placement_sample", OPT_PLACEMENT_SAMPLE, "N", 0, "Emit 1 in N placement decisions of every task into perfetto, 10 by default. Implies --placement." },
+	{ "ipi_sample", OPT_IPI_SAMPLE, "N", 0, "Emit 1 in N ipis sent by every CPU into perfetto. Use 1 to emit all of them. Implies --ipi." },
+	{ "energy_sample", OPT_ENERGY_SAMPLE, "N", 0, "Emit 1 in N find_energy_efficient_cpu() decisions of every task into perfetto, 10 by default. Implies --energy." },
+	{ "task_min_util", OPT_TASK_MIN_UTIL, "UTIL", 0, "Only emit PELT signals of tasks whose util_avg or util_est reached UTIL, until they drop below 3/4 of it, or that have uclamp set." },
+	{ "top_tasks", OPT_TOP_TASKS, "K", 0, "Only emit PELT signals of the K tasks with the highest util_avg or util_est, refreshed every stats_period, or that have uclamp set. Can be combined with --task_min_util." },
 	/* filters */
 	{ "pid", OPT_FILTER_PID, "PID", 0, "Collect data for task match pid only. Can be provided multiple times." },
 	{ "comm", OPT_FILTER_COMM, "COMM", 0, "Collect data for tasks that contain comm only. Can be provided multiple times." },
+	{ "cgroup", OPT_FILTER_CGROUP, "CGROUP", 0, "Collect data for tasks in cgroup and for the cgroup itself. Only tasks directly in CGROUP match, not in its descendants. A task matching any of --pid, --comm or --cgroup is collected. CGROUP is a path, absolute or relative to cgroup root, or a cgroup id. Can be provided multiple times." },
 	{ 0 },
 };
 
@@ -178,6 +284,19 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state)
 			return -EINVAL;
 		}
 		break;
+	case OPT_STATS_PERIOD:
+		errno = 0;
+		sa_opts.stats_period = strtoul(arg, &end_ptr, 0);
+		if (errno != 0) {
+			perror("Unsupported stats_period value\n");
+			return errno;
+		}
+		if (end_ptr == arg || !sa_opts.stats_period) {
+			fprintf(stderr, "stats_period: must be a positive number\n");
+			argp_usage(state);
+			return -EINVAL;
+		}
+		break;
 	case OPT_FTRACE_EVENT:
 		sa_opts.ftrace_event[sa_opts.num_ftrace_event] = arg;
 		sa_opts.num_ftrace_event++;
@@ -260,11 +379,230 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state)
 	case OPT_LOAD_BALANCE:
 		sa_opts.load_balance = true;
 		break;
+	case OPT_LOAD_BALANCE_STATS:
+		sa_opts.load_balance_stats = true;
+		break;
 	case OPT_IPI:
 		sa_opts.ipi = true;
 		break;
 	case OPT_IRQ:
 		sa_opts.irq = true;
+		sa_opts.softirq = true;
+		break;
+	case OPT_SOFTIRQ:
+		sa_opts.softirq = true;
+		break;
+	case OPT_WAKEUP_LATENCY:
+		sa_opts.wakeup_latency = true;
+		break;
+	case OPT_RUNQ_WAIT:
+		sa_opts.runq_wait = true;
+		break;
+	case OPT_CGROUP_PELT:
+		sa_opts.cgroup_pelt = true;
+		break;
+	case OPT_PLACEMENT:
+		sa_opts.placement = true;
+		break;
+	case OPT_SCHEDUTIL:
+		sa_opts.schedutil = true;
+		break;
+	case OPT_IDLE_GOVERNOR:
+		sa_opts.idle_governor = true;
+		break;
+	case OPT_IPI_LATENCY:
+		sa_opts.ipi_latency = true;
+		break;
+	case OPT_STACKS:
+		sa_opts.stacks = true;
+		break;
+	case OPT_RQ_LOCK:
+		sa_opts.rq_lock = true;
+		break;
+	case OPT_PMU:
+		sa_opts.pmu = true;
+		break;
+	case OPT_MIGRATIONS:
+		sa_opts.migrations = true;
+		break;
+	case OPT_CFS_THROTTLE:
+		sa_opts.cfs_throttle = true;
+		break;
+	case OPT_PSI:
+		sa_opts.psi = true;
+		break;
+	case OPT_RT_DL:
+		sa_opts.rt_dl = true;
+		break;
+	case OPT_EEVDF:
+		sa_opts.eevdf = true;
+		break;
+	case OPT_ENERGY:
+		sa_opts.energy = true;
+		break;
+	case OPT_FREQ_RESIDENCY:
+		sa_opts.freq_residency = true;
+		break;
+	case OPT_PELT_RUNNING:
+		sa_opts.pelt_running = true;
+		break;
+	case OPT_PELT_TGID:
+		sa_opts.pelt_tgid = true;
+		break;
+	/* thresholds */
+	case OPT_WAKEUP_LATENCY_THRESHOLD:
+		errno = 0;
+		sa_opts.wakeup_latency_threshold = strtoull(arg, &end_ptr, 0) * 1000;
+		if (errno != 0) {
+			perror("Unsupported wakeup_latency_threshold value\n");
+			return errno;
+		}
+		if (end_ptr == arg) {
+			fprintf(stderr, "wakeup_latency_threshold: no digits were found\n");
+			argp_usage(state);
+			return -EINVAL;
+		}
+		sa_opts.wakeup_latency = true;
+		break;
+	case OPT_IPI_LATENCY_THRESHOLD:
+		errno = 0;
+		sa_opts.ipi_latency_threshold = strtoull(arg, &end_ptr, 0) * 1000;
+		if (errno != 0) {
+			perror("Unsupported ipi_latency_threshold value\n");
+			return errno;
+		}
+		if (end_ptr == arg) {
+			fprintf(stderr, "ipi_latency_threshold: no digits were found\n");
+			argp_usage(state);
+			return -EINVAL;
+		}
+		sa_opts.ipi_latency = true;
+		break;
+	case OPT_LOAD_BALANCE_THRESHOLD:
+		errno = 0;
+		sa_opts.load_balance_threshold = strtoull(arg, &end_ptr, 0) * 1000;
+		if (errno != 0) {
+			perror("Unsupported load_balance_threshold value\n");
+			return errno;
+		}
+		if (end_ptr == arg) {
+			fprintf(stderr, "load_balance_threshold: no digits were found\n");
+			argp_usage(state);
+			return -EINVAL;
+		}
+		sa_opts.load_balance = true;
+		break;
+	case OPT_SOFTIRQ_THRESHOLD:
+		errno = 0;
+		sa_opts.softirq_threshold = strtoull(arg, &end_ptr, 0) * 1000;
+		if (errno != 0) {
+			perror("Unsupported softirq_threshold value\n");
+			return errno;
+		}
+		if (end_ptr == arg) {
+			fprintf(stderr, "softirq_threshold: no digits were found\n");
+			argp_usage(state);
+			return -EINVAL;
+		}
+		sa_opts.softirq = true;
+		sa_opts.stacks = true;
+		break;
+	case OPT_RQ_LOCK_THRESHOLD:
+		errno = 0;
+		sa_opts.rq_lock_threshold = strtoull(arg, &end_ptr, 0) * 1000;
+		if (errno != 0) {
+			perror("Unsupported rq_lock_threshold value\n");
+			return errno;
+		}
+		if (end_ptr == arg) {
+			fprintf(stderr, "rq_lock_threshold: no digits were found\n");
+			argp_usage(state);
+			return -EINVAL;
+		}
+		sa_opts.rq_lock = true;
+		sa_opts.stacks = true;
+		break;
+	case OPT_CFS_THROTTLE_THRESHOLD:
+		errno = 0;
+		sa_opts.cfs_throttle_threshold = strtoull(arg, &end_ptr, 0) * 1000;
+		if (errno != 0) {
+			perror("Unsupported cfs_throttle_threshold value\n");
+			return errno;
+		}
+		if (end_ptr == arg) {
+			fprintf(stderr, "cfs_throttle_threshold: no digits were found\n");
+			argp_usage(state);
+			return -EINVAL;
+		}
+		sa_opts.cfs_throttle = true;
+		break;
+	case OPT_PLACEMENT_SAMPLE:
+		errno = 0;
+		sa_opts.placement_sample = strtoul(arg, &end_ptr, 0);
+		if (errno != 0) {
+			perror("Unsupported placement_sample value\n");
+			return errno;
+		}
+		if (end_ptr == arg || !sa_opts.placement_sample) {
+			fprintf(stderr, "placement_sample: must be a positive number\n");
+			argp_usage(state);
+			return -EINVAL;
+		}
+		sa_opts.placement = true;
+		break;
+	case OPT_IPI_SAMPLE:
+		errno = 0;
+		sa_opts.ipi_sample = strtoul(arg, &end_ptr, 0);
+		if (errno != 0) {
+			perror("Unsupported ipi_sample value\n");
+			return errno;
+		}
+		if (end_ptr == arg || !sa_opts.ipi_sample) {
+			fprintf(stderr, "ipi_sample: must be a positive number\n");
+			argp_usage(state);
+			return -EINVAL;
+		}
+		sa_opts.ipi = true;
+		break;
+	case OPT_ENERGY_SAMPLE:
+		errno = 0;
+		sa_opts.energy_sample = strtoul(arg, &end_ptr, 0);
+		if (errno != 0) {
+			perror("Unsupported energy_sample value\n");
+			return errno;
+		}
+		if (end_ptr == arg || !sa_opts.energy_sample) {
+			fprintf(stderr, "energy_sample: must be a positive number\n");
+			argp_usage(state);
+			return -EINVAL;
+		}
+		sa_opts.energy = true;
+		break;
+	case OPT_TASK_MIN_UTIL:
+		errno = 0;
+		sa_opts.task_min_util = strtoul(arg, &end_ptr, 0);
+		if (errno != 0) {
+			perror("Unsupported task_min_util value\n");
+			return errno;
+		}
+		if (end_ptr == arg || sa_opts.task_min_util > 1024) {
+			fprintf(stderr, "task_min_util: must be between 0 and 1024\n");
+			argp_usage(state);
+			return -EINVAL;
+		}
+		break;
+	case OPT_TOP_TASKS:
+		errno = 0;
+		sa_opts.top_tasks = strtoul(arg, &end_ptr, 0);
+		if (errno != 0) {
+			perror("Unsupported top_tasks value\n");
+			return errno;
+		}
+		if (end_ptr == arg || !sa_opts.top_tasks || sa_opts.top_tasks > MAX_TOP_TASKS) {
+			fprintf(stderr, "top_tasks: must be between 1 and %d\n", MAX_TOP_TASKS);
+			argp_usage(state);
+			return -EINVAL;
+		}
 		break;
 	case OPT_FILTER_PID:
 		if (sa_opts.num_pids >= MAX_FILTERS_NUM) {
@@ -293,6 +631,14 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state)
 		sa_opts.comm[sa_opts.num_comms][TASK_COMM_LEN-1] = 0;
 		sa_opts.num_comms++;
 		break;
+	case OPT_FILTER_CGROUP:
+		if (sa_opts.num_cgroups >= MAX_FILTERS_NUM) {
+			fprintf(stderr, "Can't accept more --cgroup, dropping %s\n", arg);
+			break;
+		}
+		sa_opts.cgroup[sa_opts.num_cgroups] = arg;
+		sa_opts.num_cgroups++;
+		break;
 	case ARGP_KEY_ARG:
 		argp_usage(state);
 		break;
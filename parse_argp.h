@@ -9,6 +9,7 @@
 
 #define TASK_COMM_LEN		16
 #define MAX_FILTERS_NUM		128
+#define MAX_TOP_TASKS		1024
 
 struct sa_opts {
 	/* perfetto opts */
@@ -18,6 +19,7 @@ struct sa_opts {
 	char *output;
 	const char *output_path;
 	long max_size;
+	unsigned int stats_period;
 	unsigned int num_ftrace_event;
 	unsigned int num_atrace_cat;
 	unsigned int num_function_graph;
@@ -45,13 +47,47 @@ struct sa_opts {
 	bool softirq;
 	bool sched_switch;
 	bool load_balance;
+	bool load_balance_stats;
 	bool ipi;
 	bool irq;
+	bool wakeup_latency;
+	bool runq_wait;
+	bool cgroup_pelt;
+	bool placement;
+	bool schedutil;
+	bool idle_governor;
+	bool ipi_latency;
+	bool stacks;
+	bool rq_lock;
+	bool pmu;
+	bool migrations;
+	bool cfs_throttle;
+	bool psi;
+	bool rt_dl;
+	bool eevdf;
+	bool energy;
+	bool freq_residency;
+	bool pelt_running;
+	bool pelt_tgid;
+	/* thresholds */
+	unsigned long long wakeup_latency_threshold;
+	unsigned long long ipi_latency_threshold;
+	unsigned long long load_balance_threshold;
+	unsigned long long softirq_threshold;
+	unsigned long long rq_lock_threshold;
+	unsigned long long cfs_throttle_threshold;
+	unsigned int placement_sample;
+	unsigned int ipi_sample;
+	unsigned int energy_sample;
+	unsigned int task_min_util;
+	unsigned int top_tasks;
 	/* filters */
 	unsigned int num_pids;
 	unsigned int num_comms;
+	unsigned int num_cgroups;
 	pid_t pid[MAX_FILTERS_NUM];
 	char comm[MAX_FILTERS_NUM][TASK_COMM_LEN];
+	char *cgroup[MAX_FILTERS_NUM];
 };
 
 extern struct sa_opts sa_opts;
@@ -0,0 +1,224 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright (C) 2024 Qais Yousef */
+#define _XOPEN_SOURCE 500
+#include <ftw.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MIN_CGROUPS_BUCKETS	1024
+#define CGROUP_PATH_LEN		256
+
+#define CGROUP_V2_ROOT		"/sys/fs/cgroup"
+#define CGROUP_V1_CPU_ROOT	"/sys/fs/cgroup/cpu"
+
+/*
+ * Cache of cgroup id to path. Resolving an id requires walking the cgroup
+ * hierarchy, so only do that once per id. Entries are never freed and don't
+ * move when the table grows, the returned paths stay valid.
+ */
+struct cgroup_path {
+	unsigned long long id;
+	struct cgroup_path *next;
+	char path[CGROUP_PATH_LEN];
+};
+
+static struct cgroup_path **cgroups;
+static unsigned int num_buckets;
+static unsigned int num_cgroups;
+static pthread_mutex_t cgroups_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Used to pass the id we're looking for to nftw() callback */
+static unsigned long long walk_id;
+static char walk_path[CGROUP_PATH_LEN];
+
+
+static const char *cgroup_root(void)
+{
+	if (!access(CGROUP_V2_ROOT "/cgroup.controllers", F_OK))
+		return CGROUP_V2_ROOT;
+
+	return CGROUP_V1_CPU_ROOT;
+}
+
+/* ids are then resolved in the cpu controller hierarchy */
+bool cgroup_is_v1(void)
+{
+	return strcmp(cgroup_root(), CGROUP_V2_ROOT);
+}
+
+/* Return the path relative to the cgroup root, "/" for the root itself */
+static const char *cgroup_relative_path(const char *path)
+{
+	const char *root = cgroup_root();
+	size_t len = strlen(root);
+
+	if (!strncmp(path, root, len)) {
+		path += len;
+		if (!*path)
+			return "/";
+	}
+
+	return path;
+}
+
+/* num_buckets is always a power of 2 */
+static unsigned int cgroup_bucket(unsigned long long id, unsigned int nr)
+{
+	id ^= id >> 33;
+	id *= 0xff51afd7ed558ccdULL;
+	id ^= id >> 33;
+
+	return id & (nr - 1);
+}
+
+static struct cgroup_path *__find_cgroup(unsigned long long id)
+{
+	struct cgroup_path *cgroup;
+
+	if (!num_buckets)
+		return NULL;
+
+	for (cgroup = cgroups[cgroup_bucket(id, num_buckets)]; cgroup; cgroup = cgroup->next)
+		if (cgroup->id == id)
+			return cgroup;
+
+	return NULL;
+}
+
+/* Double the buckets once the chains get longer than 1 on average */
+static int __grow_cgroups(void)
+{
+	unsigned int nr = num_buckets ? num_buckets * 2 : MIN_CGROUPS_BUCKETS;
+	struct cgroup_path **buckets, *cgroup, *next;
+	unsigned int i, b;
+
+	buckets = calloc(nr, sizeof(*buckets));
+	if (!buckets)
+		return -1;
+
+	for (i = 0; i < num_buckets; i++) {
+		for (cgroup = cgroups[i]; cgroup; cgroup = next) {
+			next = cgroup->next;
+			b = cgroup_bucket(cgroup->id, nr);
+			cgroup->next = buckets[b];
+			buckets[b] = cgroup;
+		}
+	}
+
+	free(cgroups);
+	cgroups = buckets;
+	num_buckets = nr;
+
+	return 0;
+}
+
+static struct cgroup_path *__add_cgroup(unsigned long long id, const char *path)
+{
+	struct cgroup_path *cgroup;
+	unsigned int b;
+
+	if (num_cgroups >= num_buckets && __grow_cgroups() && !num_buckets) {
+		fprintf(stderr, "Failed to allocate cgroups cache, can't add %s\n", path);
+		return NULL;
+	}
+
+	cgroup = malloc(sizeof(*cgroup));
+	if (!cgroup) {
+		fprintf(stderr, "Failed to allocate cgroups cache entry, can't add %s\n", path);
+		return NULL;
+	}
+
+	cgroup->id = id;
+	strncpy(cgroup->path, cgroup_relative_path(path), CGROUP_PATH_LEN-1);
+	cgroup->path[CGROUP_PATH_LEN-1] = 0;
+
+	b = cgroup_bucket(id, num_buckets);
+	cgroup->next = cgroups[b];
+	cgroups[b] = cgroup;
+	num_cgroups++;
+
+	return cgroup;
+}
+
+static int walk_cgroup(const char *path, const struct stat *sb,
+		       int typeflag, struct FTW *ftwbuf)
+{
+	if (typeflag != FTW_D)
+		return 0;
+
+	if (sb->st_ino != walk_id)
+		return 0;
+
+	strncpy(walk_path, path, CGROUP_PATH_LEN-1);
+	walk_path[CGROUP_PATH_LEN-1] = 0;
+
+	/* Found it, stop walking */
+	return 1;
+}
+
+/*
+ * cgroup can be a path to the cgroup, either absolute or relative to the
+ * cgroup root, or its id. The id of a cgroup is the inode number of its
+ * directory.
+ */
+unsigned long long get_cgroup_id(const char *cgroup)
+{
+	char path[CGROUP_PATH_LEN];
+	unsigned long long id;
+	struct stat sb;
+	char *end_ptr;
+
+	id = strtoull(cgroup, &end_ptr, 0);
+	if (end_ptr != cgroup && !*end_ptr)
+		return id;
+
+	if (cgroup[0] == '/')
+		snprintf(path, sizeof(path), "%s", cgroup);
+	else
+		snprintf(path, sizeof(path), "%s/%s", cgroup_root(), cgroup);
+
+	if (stat(path, &sb)) {
+		fprintf(stderr, "Failed to find cgroup %s\n", path);
+		return 0;
+	}
+
+	pthread_mutex_lock(&cgroups_lock);
+	if (!__find_cgroup(sb.st_ino))
+		__add_cgroup(sb.st_ino, path);
+	pthread_mutex_unlock(&cgroups_lock);
+
+	return sb.st_ino;
+}
+
+char *find_cgroup_path(unsigned long long id)
+{
+	struct cgroup_path *cgroup;
+
+	pthread_mutex_lock(&cgroups_lock);
+
+	cgroup = __find_cgroup(id);
+	if (cgroup)
+		goto out;
+
+	walk_id = id;
+	walk_path[0] = 0;
+	nftw(cgroup_root(), walk_cgroup, 16, FTW_PHYS | FTW_MOUNT);
+
+	if (walk_path[0]) {
+		cgroup = __add_cgroup(id, walk_path);
+	} else {
+		/* Cache the miss too, so we don't walk again for dead cgroups */
+		snprintf(walk_path, sizeof(walk_path), "cgroup-%llu", id);
+		cgroup = __add_cgroup(id, walk_path);
+	}
+
+out:
+	pthread_mutex_unlock(&cgroups_lock);
+
+	return cgroup ? cgroup->path : NULL;
+}
@@ -0,0 +1,12 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright (C) 2024 Qais Yousef */
+#ifndef __PARSE_CGROUPS_H__
+#define __PARSE_CGROUPS_H__
+
+#include <stdbool.h>
+
+bool cgroup_is_v1(void);
+unsigned long long get_cgroup_id(const char *cgroup);
+char *find_cgroup_path(unsigned long long id);
+
+#endif /* __PARSE_CGROUPS_H__ */
@@ -13,10 +13,25 @@
 PERFETTO_DEFINE_CATEGORIES(
 	perfetto::Category("pelt-cpu").SetDescription("Track PELT at CPU level"),
 	perfetto::Category("pelt-task").SetDescription("Track PELT at task level"),
+	perfetto::Category("pelt-cgroup").SetDescription("Track PELT at cgroup level"),
 	perfetto::Category("nr-running-cpu").SetDescription("Track number of tasks running on each CPU"),
 	perfetto::Category("cpu-idle").SetDescription("Track cpu idle info for each CPU"),
 	perfetto::Category("load-balance").SetDescription("Track load balance internals"),
 	perfetto::Category("ipi").SetDescription("Track inter-processor interrupts"),
+	perfetto::Category("wakeup-latency").SetDescription("Track tasks wakeup latency"),
+	perfetto::Category("runq-wait").SetDescription("Track time tasks spent waiting on the runqueue"),
+	perfetto::Category("irq").SetDescription("Track time spent in hard and soft irqs"),
+	perfetto::Category("placement").SetDescription("Track task placement decisions"),
+	perfetto::Category("schedutil").SetDescription("Track schedutil frequency requests"),
+	perfetto::Category("rq-lock").SetDescription("Track contention on runqueue locks"),
+	perfetto::Category("cfs-throttle").SetDescription("Track CFS bandwidth throttling of cgroups"),
+	perfetto::Category("rt-dl").SetDescription("Track RT and DL push/pull, throttling and dl_server"),
+	perfetto::Category("psi").SetDescription("Track pressure stall time of cgroups"),
+	perfetto::Category("migration").SetDescription("Track tasks migrations"),
+	perfetto::Category("energy").SetDescription("Track EAS decisions and estimated energy of performance domains"),
+	perfetto::Category("eevdf").SetDescription("Track EEVDF lag, deadline and slice of tasks"),
+	perfetto::Category("pmu").SetDescription("Track tasks hardware counters"),
+	perfetto::Category("stacks").SetDescription("Track kernel stacks of scheduler outliers"),
 );
 
 PERFETTO_TRACK_EVENT_STATIC_STORAGE();
@@ -25,11 +40,28 @@ enum sched_analyzer_track_ids {
 	SA_TRACK_ID_CPU_IDLE_MISS = 1,		/* must start from none 0 */
 	SA_TRACK_ID_LOAD_BALANCE,
 	SA_TRACK_ID_IPI,
+	SA_TRACK_ID_WAKEUP_LATENCY,
+	SA_TRACK_ID_PLACEMENT,
+	SA_TRACK_ID_IDLE_GOV,
+	SA_TRACK_ID_IPI_LATENCY,
+	SA_TRACK_ID_SCHED_DOMAIN,
+	SA_TRACK_ID_STACK,
+	SA_TRACK_ID_CFS_THROTTLE,
+	SA_TRACK_ID_RT_THROTTLE,
+	SA_TRACK_ID_EAS,
 };
 
 #define TRACK_SPACING		1000
 #define TRACK_ID(ID)		(SA_TRACK_ID_##ID * TRACK_SPACING)
 
+/* Per task tracks, keep them out of the way of per CPU ones */
+#define TASK_TRACK_ID(ID, pid)	(((uint64_t)SA_TRACK_ID_##ID << 32) | (uint32_t)(pid))
+
+/* Per cgroup per CPU tracks, cgroup ids are inode numbers */
+#define CGROUP_TRACK_ID(ID, id, cpu)	(((uint64_t)SA_TRACK_ID_##ID << 56) |	\
+					 (((uint64_t)(id) & 0xffffffffffULL) << 16) |	\
+					 ((uint64_t)(cpu) & 0xffff))
+
 #define FAKE_DURATION		10000  /* 10us */
 
 
@@ -120,8 +152,6 @@ extern "C" void start_perfetto_trace(void)
 	ftrace_cfg.add_ftrace_events("task/task_newtask");
 	ftrace_cfg.add_ftrace_events("task/task_rename");
 	ftrace_cfg.add_ftrace_events("ftrace/print");
-	if (sa_opts.irq)
-		ftrace_cfg.add_atrace_categories("irq");
 
 	for (unsigned int i = 0; i < sa_opts.num_ftrace_event; i++)
 		ftrace_cfg.add_ftrace_events(sa_opts.ftrace_event[i]);
@@ -259,6 +289,105 @@ extern "C" void trace_cpu_load_avg_thermal(uint64_t ts, int cpu, int value)
 	TRACE_COUNTER("pelt-cpu", track_name, ts, value);
 }
 
+extern "C" void trace_cgroup_load_avg(uint64_t ts, const char *path, int cpu, int value)
+{
+	char track_name[128];
+	snprintf(track_name, sizeof(track_name), "%s CPU%d load_avg", path, cpu);
+
+	TRACE_COUNTER("pelt-cgroup", track_name, ts, value);
+}
+
+extern "C" void trace_cgroup_runnable_avg(uint64_t ts, const char *path, int cpu, int value)
+{
+	char track_name[128];
+	snprintf(track_name, sizeof(track_name), "%s CPU%d runnable_avg", path, cpu);
+
+	TRACE_COUNTER("pelt-cgroup", track_name, ts, value);
+}
+
+extern "C" void trace_cgroup_util_avg(uint64_t ts, const char *path, int cpu, int value)
+{
+	char track_name[128];
+	snprintf(track_name, sizeof(track_name), "%s CPU%d util_avg", path, cpu);
+
+	TRACE_COUNTER("pelt-cgroup", track_name, ts, value);
+}
+
+extern "C" void trace_cgroup_throttled(uint64_t ts, const char *path, uint64_t id,
+				       int cpu, uint64_t duration)
+{
+	TRACE_EVENT_BEGIN("cfs-throttle", "throttled",
+			  perfetto::Track(CGROUP_TRACK_ID(CFS_THROTTLE, id, cpu)),
+			  ts - duration, "CGROUP", path, "CPU", cpu);
+
+	TRACE_EVENT_END("cfs-throttle",
+			perfetto::Track(CGROUP_TRACK_ID(CFS_THROTTLE, id, cpu)), ts);
+}
+
+extern "C" void trace_cgroup_throttle_count(uint64_t ts, const char *path,
+					    const char *stat, uint64_t value)
+{
+	char track_name[128];
+	snprintf(track_name, sizeof(track_name), "%s %s", path, stat);
+
+	TRACE_COUNTER("cfs-throttle", track_name, ts, value);
+}
+
+extern "C" void trace_cgroup_psi(uint64_t ts, const char *path, const char *stat,
+				 uint64_t value)
+{
+	char track_name[128];
+	snprintf(track_name, sizeof(track_name), "%s psi_%s", path, stat);
+
+	TRACE_COUNTER("psi", track_name, ts, value);
+}
+
+extern "C" void trace_rt_throttled(uint64_t ts, int cpu, uint64_t duration)
+{
+	TRACE_EVENT_BEGIN("rt-dl", "rt_throttled",
+			  perfetto::Track(TRACK_ID(RT_THROTTLE) + cpu),
+			  ts - duration, "CPU", cpu);
+
+	TRACE_EVENT_END("rt-dl", perfetto::Track(TRACK_ID(RT_THROTTLE) + cpu), ts);
+}
+
+extern "C" void trace_rt_dl_count(uint64_t ts, int cpu, const char *stat, uint64_t value)
+{
+	char track_name[32];
+	snprintf(track_name, sizeof(track_name), "CPU%d %s", cpu, stat);
+
+	TRACE_COUNTER("rt-dl", track_name, ts, value);
+}
+
+extern "C" void trace_eas_decision(uint64_t ts, int cpu, const char *name, int pid,
+				   int prev_cpu, int target_cpu, const char *candidates)
+{
+	TRACE_EVENT("energy", "find_energy_efficient_cpu",
+		    perfetto::Track(TRACK_ID(EAS) + cpu), ts,
+		    "COMM", name, "PID", pid,
+		    "PREV_CPU", prev_cpu, "TARGET_CPU", target_cpu,
+		    "CANDIDATES", candidates);
+
+	TRACE_EVENT_END("energy", perfetto::Track(TRACK_ID(EAS) + cpu),
+			ts + FAKE_DURATION);
+}
+
+extern "C" void trace_eas_count(uint64_t ts, const char *stat, uint64_t value)
+{
+	char track_name[32];
+	snprintf(track_name, sizeof(track_name), "eas %s", stat);
+
+	TRACE_COUNTER("energy", track_name, ts, value);
+}
+
+extern "C" void trace_pd_energy(uint64_t ts, int pd_cpu, const char *stat, uint64_t value)
+{
+	char track_name[32];
+	snprintf(track_name, sizeof(track_name), "PD%d %s", pd_cpu, stat);
+
+	TRACE_COUNTER("energy", track_name, ts, value);
+}
+
 extern "C" void trace_task_load_avg(uint64_t ts, const char *name, int pid, int value)
 {
 	char track_name[32];
@@ -291,6 +420,24 @@ extern "C" void trace_task_uclamped_avg(uint64_t ts, const char *name, int pid,
 	TRACE_COUNTER("pelt-task", track_name, ts, value);
 }
 
+extern "C" void trace_task_pelt_running(uint64_t ts, const char *name, int pid,
+					const char *signal, int value)
+{
+	char track_name[64];
+	snprintf(track_name, sizeof(track_name), "%s-%d %s_running", name, pid, signal);
+
+	TRACE_COUNTER("pelt-task", track_name, ts, value);
+}
+
+extern "C" void trace_tgid_pelt(uint64_t ts, const char *name, int tgid,
+				const char *signal, int64_t value)
+{
+	char track_name[64];
+	snprintf(track_name, sizeof(track_name), "%s-%d process %s", name, tgid, signal);
+
+	TRACE_COUNTER("pelt-task", track_name, ts, value);
+}
+
 extern "C" void trace_task_util_est_enqueued(uint64_t ts, const char *name, int pid, int value)
 {
 	char track_name[32];
@@ -335,6 +482,28 @@ extern "C" void trace_cpu_idle_miss(uint64_t ts, int cpu, int state, int miss)
 			ts + FAKE_DURATION);
 }
 
+extern "C" void trace_idle_gov_miss(uint64_t ts, int cpu, int state,
+				    const char *outcome, int64_t sleep_length,
+				    uint64_t residency)
+{
+	TRACE_EVENT_BEGIN("cpu-idle", "idle_gov_miss",
+			  perfetto::Track(TRACK_ID(IDLE_GOV) + cpu),
+			  ts - residency,
+			  "CPU", cpu, "STATE", state, "MISS", outcome,
+			  "SLEEP_LENGTH", sleep_length, "RESIDENCY", residency);
+
+	TRACE_EVENT_END("cpu-idle", perfetto::Track(TRACK_ID(IDLE_GOV) + cpu), ts);
+}
+
+extern "C" void trace_idle_gov_count(uint64_t ts, int cpu, const char *outcome,
+				     uint64_t value)
+{
+	char track_name[32];
+	snprintf(track_name, sizeof(track_name), "CPU%d idle_%s", cpu, outcome);
+
+	TRACE_COUNTER("cpu-idle", track_name, ts, value);
+}
+
 extern "C" void trace_lb_entry(uint64_t ts, int this_cpu, int lb_cpu, char *phase)
 {
 	TRACE_EVENT_BEGIN("load-balance", phase,
@@ -357,6 +526,9 @@ extern "C" void trace_lb_sd_stats(uint64_t ts, struct lb_sd_stats *sd_stats)
 		if (sd_stats->level[i] == -1 && !sd_stats->balance_interval[i])
 			break;
 
+		if (!(sd_stats->changed & (1 << i)))
+			continue;
+
 		snprintf(track_name, sizeof(track_name), "CPU%d.level%d.balance_interval",
 			 sd_stats->cpu, sd_stats->level[i]);
 
@@ -364,18 +536,38 @@ extern "C" void trace_lb_sd_stats(uint64_t ts, struct lb_sd_stats *sd_stats)
 	}
 }
 
-extern "C" void trace_lb_overloaded(uint64_t ts, unsigned int value)
+extern "C" void trace_lb_sd_topology(uint64_t ts, struct lb_sd_stats *sd_stats)
+{
+	int i;
+
+	for (i = 0; i < MAX_SD_LEVELS; i++) {
+		if (sd_stats->level[i] == -1)
+			break;
+
+		TRACE_EVENT("load-balance", "sched_domain",
+			    perfetto::Track(TRACK_ID(SCHED_DOMAIN) + sd_stats->cpu), ts,
+			    "CPU", sd_stats->cpu, "LEVEL", sd_stats->level[i],
+			    "NAME", sd_stats->name[i],
+			    "SPAN_WEIGHT", sd_stats->span_weight[i]);
+
+		TRACE_EVENT_END("load-balance",
+				perfetto::Track(TRACK_ID(SCHED_DOMAIN) + sd_stats->cpu),
+				ts + FAKE_DURATION);
+	}
+}
+
+extern "C" void trace_lb_overloaded(uint64_t ts, int cpu, unsigned int value)
 {
 	char track_name[32];
-	snprintf(track_name, sizeof(track_name), "rd.overloaded");
+	snprintf(track_name, sizeof(track_name), "CPU%d rd.overloaded", cpu);
 
 	TRACE_COUNTER("load-balance", track_name, ts, value);
 }
 
-extern "C" void trace_lb_overutilized(uint64_t ts, unsigned int value)
+extern "C" void trace_lb_overutilized(uint64_t ts, int cpu, unsigned int value)
 {
 	char track_name[32];
-	snprintf(track_name, sizeof(track_name), "rd.overutilized");
+	snprintf(track_name, sizeof(track_name), "CPU%d rd.overutilized", cpu);
 
 	TRACE_COUNTER("load-balance", track_name, ts, value);
 }
@@ -388,6 +580,14 @@ extern "C" void trace_lb_misfit(uint64_t ts, int cpu, unsigned long misfit_task_
 	TRACE_COUNTER("load-balance", track_name, ts, misfit_task_load);
 }
 
+extern "C" void trace_lb_level_stat(uint64_t ts, int level, const char *stat, uint64_t value)
+{
+	char track_name[32];
+	snprintf(track_name, sizeof(track_name), "sd_level%d lb_%s", level, stat);
+
+	TRACE_COUNTER("load-balance", track_name, ts, value);
+}
+
 extern "C" void trace_ipi_send_cpu(uint64_t ts, int from_cpu, int target_cpu,
 				   char *callsite, void *callsitep,
 				   char *callback, void *callbackp)
@@ -405,6 +605,221 @@ extern "C" void trace_ipi_send_cpu(uint64_t ts, int from_cpu, int target_cpu,
 			ts + FAKE_DURATION);
 }
 
+extern "C" void trace_ipi_count(uint64_t ts, int from_cpu, int target_cpu, uint64_t value)
+{
+	char track_name[32];
+	snprintf(track_name, sizeof(track_name), "CPU%d ipi to CPU%d", from_cpu, target_cpu);
+
+	TRACE_COUNTER("ipi", track_name, ts, value);
+}
+
+extern "C" void trace_ipi_latency(uint64_t ts, int cpu, int from_cpu,
+				  char *callback, void *callbackp,
+				  uint64_t latency, uint64_t duration)
+{
+	if (latency) {
+		TRACE_EVENT_BEGIN("ipi", "ipi_latency",
+				  perfetto::Track(TRACK_ID(IPI_LATENCY) + cpu),
+				  ts - latency,
+				  "FROM_CPU", from_cpu, "TARGET_CPU", cpu,
+				  callback ? callback : "CALLBACK",
+				  callback ? (void *)2 : callbackp);
+	} else {
+		TRACE_EVENT_BEGIN("ipi", "ipi_callback",
+				  perfetto::Track(TRACK_ID(IPI_LATENCY) + cpu),
+				  ts - duration,
+				  "CPU", cpu,
+				  callback ? callback : "CALLBACK",
+				  callback ? (void *)2 : callbackp);
+	}
+
+	TRACE_EVENT_END("ipi", perfetto::Track(TRACK_ID(IPI_LATENCY) + cpu), ts);
+}
+
+extern "C" void trace_rq_lock_count(uint64_t ts, int cpu, const char *stat, uint64_t value)
+{
+	char track_name[32];
+	snprintf(track_name, sizeof(track_name), "CPU%d rq_lock_%s", cpu, stat);
+
+	TRACE_COUNTER("rq-lock", track_name, ts, value);
+}
+
+extern "C" void trace_stack_outlier(uint64_t ts, int cpu, char *source,
+				    int arg, const char *comm, int pid,
+				    uint64_t duration, const char *stack)
+{
+	TRACE_EVENT_BEGIN("stacks", source,
+			  perfetto::Track(TRACK_ID(STACK) + cpu),
+			  ts - duration,
+			  "CPU", cpu, "ARG", arg, "COMM", comm, "PID", pid,
+			  "STACK", stack);
+
+	TRACE_EVENT_END("stacks", perfetto::Track(TRACK_ID(STACK) + cpu), ts);
+}
+
+extern "C" void trace_wakeup_latency(uint64_t ts, int cpu, const char *name,
+				     int pid, int tgid, uint64_t latency)
+{
+	TRACE_EVENT_BEGIN("wakeup-latency", "wakeup_latency",
+			  perfetto::Track(TASK_TRACK_ID(WAKEUP_LATENCY, pid)),
+			  ts - latency,
+			  "COMM", name, "PID", pid, "TGID", tgid, "CPU", cpu);
+
+	TRACE_EVENT_END("wakeup-latency",
+			perfetto::Track(TASK_TRACK_ID(WAKEUP_LATENCY, pid)), ts);
+}
+
+extern "C" void trace_cpu_runq_wait(uint64_t ts, int cpu, uint64_t value)
+{
+	char track_name[32];
+	snprintf(track_name, sizeof(track_name), "CPU%d runq_wait", cpu);
+
+	TRACE_COUNTER("runq-wait", track_name, ts, value);
+}
+
+extern "C" void trace_task_runq_wait_total(uint64_t ts, const char *name, int pid, uint64_t value)
+{
+	char track_name[32];
+	snprintf(track_name, sizeof(track_name), "%s-%d runq_wait_total", name, pid);
+
+	TRACE_COUNTER("runq-wait", track_name, ts, value);
+}
+
+extern "C" void trace_migrate_count(uint64_t ts, const char *class_name, uint64_t value)
+{
+	char track_name[32];
+	snprintf(track_name, sizeof(track_name), "migrations %s", class_name);
+
+	TRACE_COUNTER("migration", track_name, ts, value);
+}
+
+extern "C" void trace_cpu_migrate_count(uint64_t ts, int cpu, const char *dir, uint64_t value)
+{
+	char track_name[32];
+	snprintf(track_name, sizeof(track_name), "CPU%d migrations_%s", cpu, dir);
+
+	TRACE_COUNTER("migration", track_name, ts, value);
+}
+
+extern "C" void trace_task_migrate_count(uint64_t ts, const char *name, int pid, uint64_t value)
+{
+	char track_name[32];
+	snprintf(track_name, sizeof(track_name), "%s-%d migrations", name, pid);
+
+	TRACE_COUNTER("migration", track_name, ts, value);
+}
+
+extern "C" void trace_task_pmu(uint64_t ts, const char *name, int pid, int capacity,
+			       const char *unit, uint64_t cycles, uint64_t instructions)
+{
+	char track_name[64];
+	char suffix[16] = "";
+
+	if (capacity >= 0)
+		snprintf(suffix, sizeof(suffix), "@%d", capacity);
+
+	snprintf(track_name, sizeof(track_name), "%s-%d %s%s", name, pid, unit, suffix);
+	TRACE_COUNTER("pmu", track_name, ts, cycles);
+
+	if (!instructions)
+		return;
+
+	snprintf(track_name, sizeof(track_name), "%s-%d instructions%s", name, pid, suffix);
+	TRACE_COUNTER("pmu", track_name, ts, instructions);
+
+	if (!cycles)
+		return;
+
+	snprintf(track_name, sizeof(track_name), "%s-%d ipc%s", name, pid, suffix);
+	TRACE_COUNTER("pmu", track_name, ts, (double)instructions / cycles);
+}
+
+extern "C" void trace_task_eevdf(uint64_t ts, const char *name, int pid,
+				 int64_t vlag, int64_t vdeadline, uint64_t slice)
+{
+	char track_name[64];
+
+	snprintf(track_name, sizeof(track_name), "%s-%d vlag", name, pid);
+	TRACE_COUNTER("eevdf", track_name, ts, vlag);
+
+	snprintf(track_name, sizeof(track_name), "%s-%d vdeadline", name, pid);
+	TRACE_COUNTER("eevdf", track_name, ts, vdeadline);
+
+	snprintf(track_name, sizeof(track_name), "%s-%d slice", name, pid);
+	TRACE_COUNTER("eevdf", track_name, ts, slice);
+}
+
+extern "C" void trace_cpu_softirq_time(uint64_t ts, int cpu, uint64_t value)
+{
+	char track_name[32];
+	snprintf(track_name, sizeof(track_name), "CPU%d softirq_time", cpu);
+
+	TRACE_COUNTER("irq", track_name, ts, value);
+}
+
+extern "C" void trace_cpu_hardirq_time(uint64_t ts, int cpu, uint64_t value)
+{
+	char track_name[32];
+	snprintf(track_name, sizeof(track_name), "CPU%d hardirq_time", cpu);
+
+	TRACE_COUNTER("irq", track_name, ts, value);
+}
+
+extern "C" void trace_softirq_time(uint64_t ts, const char *name, uint64_t value)
+{
+	char track_name[32];
+	snprintf(track_name, sizeof(track_name), "softirq.%s time", name);
+
+	TRACE_COUNTER("irq", track_name, ts, value);
+}
+
+extern "C" void trace_placement(uint64_t ts, int this_cpu, const char *name,
+				int pid, int prev_cpu, int new_cpu,
+				int wake_flags, const char *path)
+{
+	TRACE_EVENT("placement", "select_task_rq_fair",
+		    perfetto::Track(TRACK_ID(PLACEMENT) + this_cpu), ts,
+		    "COMM", name, "PID", pid,
+		    "PREV_CPU", prev_cpu, "NEW_CPU", new_cpu,
+		    "WAKE_FLAGS", wake_flags, "PATH", path);
+
+	TRACE_EVENT_END("placement", perfetto::Track(TRACK_ID(PLACEMENT) + this_cpu),
+			ts + FAKE_DURATION);
+}
+
+extern "C" void trace_placement_count(uint64_t ts, const char *path,
+				      const char *outcome, uint64_t value)
+{
+	char track_name[64];
+	snprintf(track_name, sizeof(track_name), "placement %s %s", path, outcome);
+
+	TRACE_COUNTER("placement", track_name, ts, value);
+}
+
+extern "C" void trace_sugov_util(uint64_t ts, int cpu, unsigned long value)
+{
+	char track_name[32];
+	snprintf(track_name, sizeof(track_name), "CPU%d sugov_util", cpu);
+
+	TRACE_COUNTER("schedutil", track_name, ts, value);
+}
+
+extern "C" void trace_sugov_next_freq(uint64_t ts, int policy_cpu, unsigned int value)
+{
+	char track_name[32];
+	snprintf(track_name, sizeof(track_name), "policy%d sugov_next_freq", policy_cpu);
+
+	TRACE_COUNTER("schedutil", track_name, ts, value);
+}
+
+extern "C" void trace_sugov_rate_limited(uint64_t ts, int policy_cpu, uint64_t value)
+{
+	char track_name[32];
+	snprintf(track_name, sizeof(track_name), "policy%d sugov_rate_limited", policy_cpu);
+
+	TRACE_COUNTER("schedutil", track_name, ts, value);
+}
+
 #if 0
 extern "C" int main(int argc, char **argv)
 {
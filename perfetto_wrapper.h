@@ -15,21 +15,77 @@ void trace_cpu_util_avg_rt(uint64_t ts, int cpu, int value);
 void trace_cpu_util_avg_dl(uint64_t ts, int cpu, int value);
 void trace_cpu_util_avg_irq(uint64_t ts, int cpu, int value);
 void trace_cpu_load_avg_thermal(uint64_t ts, int cpu, int value);
+void trace_cgroup_load_avg(uint64_t ts, const char *path, int cpu, int value);
+void trace_cgroup_runnable_avg(uint64_t ts, const char *path, int cpu, int value);
+void trace_cgroup_util_avg(uint64_t ts, const char *path, int cpu, int value);
+void trace_cgroup_throttled(uint64_t ts, const char *path, uint64_t id,
+			    int cpu, uint64_t duration);
+void trace_cgroup_throttle_count(uint64_t ts, const char *path,
+				 const char *stat, uint64_t value);
+void trace_cgroup_psi(uint64_t ts, const char *path, const char *stat,
+		      uint64_t value);
+void trace_rt_throttled(uint64_t ts, int cpu, uint64_t duration);
+void trace_rt_dl_count(uint64_t ts, int cpu, const char *stat, uint64_t value);
+void trace_eas_decision(uint64_t ts, int cpu, const char *name, int pid,
+			int prev_cpu, int target_cpu, const char *candidates);
+void trace_eas_count(uint64_t ts, const char *stat, uint64_t value);
+void trace_pd_energy(uint64_t ts, int pd_cpu, const char *stat, uint64_t value);
 void trace_task_load_avg(uint64_t ts, const char *name, int pid, int value);
 void trace_task_runnable_avg(uint64_t ts, const char *name, int pid, int value);
 void trace_task_util_avg(uint64_t ts, const char *name, int pid, int value);
 void trace_task_uclamped_avg(uint64_t ts, const char *name, int pid, int value);
+void trace_task_pelt_running(uint64_t ts, const char *name, int pid,
+			     const char *signal, int value);
+void trace_tgid_pelt(uint64_t ts, const char *name, int tgid,
+		     const char *signal, int64_t value);
 void trace_task_util_est_enqueued(uint64_t ts, const char *name, int pid, int value);
 void trace_task_util_est_ewma(uint64_t ts, const char *name, int pid, int value);
 void trace_cpu_nr_running(uint64_t ts, int cpu, int value);
 void trace_cpu_idle(uint64_t ts, int cpu, int state);
 void trace_cpu_idle_miss(uint64_t ts, int cpu, int state, int miss);
+void trace_idle_gov_miss(uint64_t ts, int cpu, int state,
+			 const char *outcome, int64_t sleep_length,
+			 uint64_t residency);
+void trace_idle_gov_count(uint64_t ts, int cpu, const char *outcome,
+			  uint64_t value);
 void trace_lb_entry(uint64_t ts, int this_cpu, int lb_cpu, char *phase);
 void trace_lb_exit(uint64_t ts, int this_cpu, int lb_cpu);
 void trace_lb_sd_stats(uint64_t ts, struct lb_sd_stats *sd_stats);
-void trace_lb_overloaded(uint64_t ts, unsigned int value);
-void trace_lb_overutilized(uint64_t ts, unsigned int value);
+void trace_lb_sd_topology(uint64_t ts, struct lb_sd_stats *sd_stats);
+void trace_lb_overloaded(uint64_t ts, int cpu, unsigned int value);
+void trace_lb_overutilized(uint64_t ts, int cpu, unsigned int value);
 void trace_lb_misfit(uint64_t ts, int cpu, unsigned long misfit_task_load);
+void trace_lb_level_stat(uint64_t ts, int level, const char *stat, uint64_t value);
 void trace_ipi_send_cpu(uint64_t ts, int from_cpu, int target_cpu,
 			char *callsite, void *callsitep,
 			char *callback, void *callbackp);
+void trace_ipi_count(uint64_t ts, int from_cpu, int target_cpu, uint64_t value);
+void trace_ipi_latency(uint64_t ts, int cpu, int from_cpu,
+		       char *callback, void *callbackp,
+		       uint64_t latency, uint64_t duration);
+void trace_rq_lock_count(uint64_t ts, int cpu, const char *stat, uint64_t value);
+void trace_stack_outlier(uint64_t ts, int cpu, char *source,
+			 int arg, const char *comm, int pid,
+			 uint64_t duration, const char *stack);
+void trace_wakeup_latency(uint64_t ts, int cpu, const char *name,
+			  int pid, int tgid, uint64_t latency);
+void trace_cpu_runq_wait(uint64_t ts, int cpu, uint64_t value);
+void trace_task_runq_wait_total(uint64_t ts, const char *name, int pid, uint64_t value);
+void trace_migrate_count(uint64_t ts, const char *class_name, uint64_t value);
+void trace_cpu_migrate_count(uint64_t ts, int cpu, const char *dir, uint64_t value);
+void trace_task_migrate_count(uint64_t ts, const char *name, int pid, uint64_t value);
+void trace_task_pmu(uint64_t ts, const char *name, int pid, int capacity,
+		    const char *unit, uint64_t cycles, uint64_t instructions);
+void trace_task_eevdf(uint64_t ts, const char *name, int pid,
+		      int64_t vlag, int64_t vdeadline, uint64_t slice);
+void trace_cpu_softirq_time(uint64_t ts, int cpu, uint64_t value);
+void trace_cpu_hardirq_time(uint64_t ts, int cpu, uint64_t value);
+void trace_softirq_time(uint64_t ts, const char *name, uint64_t value);
+void trace_placement(uint64_t ts, int this_cpu, const char *name,
+		     int pid, int prev_cpu, int new_cpu,
+		     int wake_flags, const char *path);
+void trace_placement_count(uint64_t ts, const char *path,
+			   const char *outcome, uint64_t value);
+void trace_sugov_util(uint64_t ts, int cpu, unsigned long value);
+void trace_sugov_next_freq(uint64_t ts, int policy_cpu, unsigned int value);
+void trace_sugov_rate_limited(uint64_t ts, int policy_cpu, uint64_t value);
@@ -25,6 +25,7 @@ struct rq_pelt_event {
 	unsigned long long ts;
 	int cpu;
 	enum pelt_type type;
+	unsigned long long cgroup_id;	/* 0 for root cfs_rq */
 	unsigned long load_avg;
 	unsigned long runnable_avg;
 	unsigned long util_avg;
@@ -65,6 +66,16 @@ struct sched_switch_event {
 	int running;
 };
 
+struct pmu_event {
+	unsigned long long ts;
+	int cpu;
+	pid_t pid;
+	char comm[TASK_COMM_LEN];
+	unsigned int capacity;
+	unsigned long long cycles;
+	unsigned long long instructions;
+};
+
 struct freq_idle_event {
 	unsigned long long ts;
 	int cpu;
@@ -73,11 +84,11 @@ struct freq_idle_event {
 	int idle_miss;
 };
 
-struct softirq_event {
-	unsigned long long ts;
-	int cpu;
-	char softirq[TASK_COMM_LEN];
-	unsigned long duration;
+#define MAX_SOFTIRQS		10
+#define IRQ_NAME_LEN		32
+
+struct irq_name {
+	char name[IRQ_NAME_LEN];
 };
 
 enum lb_phases {
@@ -88,14 +99,21 @@ enum lb_phases {
 	LB_PICK_NEXT_TASK_FAIR,
 	LB_NEWIDLE_BALANCE,
 	LB_LOAD_BALANCE,
+	NR_LB_PHASES,
 };
 
 #define MAX_SD_LEVELS		10
+#define SD_NAME_LEN		16
+#define MAX_CPUS		1024
 
 struct lb_sd_stats {
 	int cpu;
+	bool topology;		/* sched domains of cpu were (re)built */
+	unsigned int changed;	/* bitmask of levels whose balance_interval changed */
 	int level[MAX_SD_LEVELS];
 	unsigned int balance_interval[MAX_SD_LEVELS];
+	unsigned int span_weight[MAX_SD_LEVELS];
+	char name[MAX_SD_LEVELS][SD_NAME_LEN];
 };
 
 struct lb_event {
@@ -107,9 +125,29 @@ struct lb_event {
 	unsigned int overloaded;
 	unsigned int overutilized;
 	unsigned long misfit_task_load;
+};
+
+struct lb_sd_event {
+	unsigned long long ts;
 	struct lb_sd_stats sd_stats;
 };
 
+#define NR_LB_MIGRATION_TYPES	4	/* enum migration_type */
+
+struct lb_stats {
+	unsigned long long attempts;
+	unsigned long long success;
+	unsigned long long tasks_moved;
+	unsigned long long time;
+	unsigned long long detach[NR_LB_MIGRATION_TYPES];
+	unsigned long long imbalance_pulled[NR_LB_MIGRATION_TYPES];
+};
+
+struct lb_busiest_key {
+	int level;
+	int cpu;
+};
+
 struct ipi_event {
 	unsigned long long ts;
 	int from_cpu;
@@ -118,58 +156,324 @@ struct ipi_event {
 	void *callback;
 };
 
+struct ipi_key {
+	int from_cpu;
+	int target_cpu;
+	void *callback;
+};
 
-#ifdef __VMLINUX_H__
-char hi_softirq[TASK_COMM_LEN] = "hi";
-char timer_softirq[TASK_COMM_LEN] = "timer";
-char net_tx_softirq[TASK_COMM_LEN] = "net_tx";
-char net_rx_softirq[TASK_COMM_LEN] = "net_rx";
-char block_softirq[TASK_COMM_LEN] = "block";
-char irq_poll_softirq[TASK_COMM_LEN] = "irq_poll";
-char tasklet_softirq[TASK_COMM_LEN] = "tasklet";
-char sched_softirq[TASK_COMM_LEN] = "sched";
-char hrtimer_softirq[TASK_COMM_LEN] = "hrtimer";
-char rcu_softirq[TASK_COMM_LEN] = "rcu";
-char unknown_softirq[TASK_COMM_LEN] = "unknown";
 
-static inline void copy_softirq(char *dst, unsigned int vec_nr)
-{
-	switch (vec_nr) {
-	case HI_SOFTIRQ:
-		copy_str(dst, hi_softirq, TASK_COMM_LEN);
-		break;
-	case TIMER_SOFTIRQ:
-		copy_str(dst, timer_softirq, TASK_COMM_LEN);
-		break;
-	case NET_TX_SOFTIRQ:
-		copy_str(dst, net_tx_softirq, TASK_COMM_LEN);
-		break;
-	case NET_RX_SOFTIRQ:
-		copy_str(dst, net_rx_softirq, TASK_COMM_LEN);
-		break;
-	case BLOCK_SOFTIRQ:
-		copy_str(dst, block_softirq, TASK_COMM_LEN);
-		break;
-	case IRQ_POLL_SOFTIRQ:
-		copy_str(dst, irq_poll_softirq, TASK_COMM_LEN);
-		break;
-	case TASKLET_SOFTIRQ:
-		copy_str(dst, tasklet_softirq, TASK_COMM_LEN);
-		break;
-	case SCHED_SOFTIRQ:
-		copy_str(dst, sched_softirq, TASK_COMM_LEN);
-		break;
-	case HRTIMER_SOFTIRQ:
-		copy_str(dst, hrtimer_softirq, TASK_COMM_LEN);
-		break;
-	case RCU_SOFTIRQ:
-		copy_str(dst, rcu_softirq, TASK_COMM_LEN);
-		break;
-	default:
-		copy_str(dst, unknown_softirq, TASK_COMM_LEN);
-		break;
-	}
-}
-#endif /* __VMLINUX_H__ */
+struct ipi_lat_key {
+	void *callback;
+	int cpu;
+};
+
+struct ipi_lat_event {
+	unsigned long long ts;
+	int cpu;
+	int from_cpu;
+	void *callback;
+	unsigned long long latency;
+	unsigned long long duration;
+};
+
+#define HIST_SLOTS		32
+
+/*
+ * log2 histogram. slots[i] counts values in [2^i, 2^(i+1)), last slot
+ * collects everything bigger.
+ */
+struct log2_hist {
+	unsigned long long slots[HIST_SLOTS];
+	unsigned long long count;
+	unsigned long long total;
+	unsigned long long max;
+};
+
+/* Per rq lock, updated by every CPU contending on it */
+struct rq_lock_stats {
+	long long contenders;
+	unsigned long long contentions;
+};
+
+struct cfs_throttle_key {
+	unsigned long long cgroup_id;
+	int cpu;
+};
+
+struct cfs_throttle_event {
+	unsigned long long ts;
+	int cpu;
+	unsigned long long cgroup_id;
+	unsigned long long duration;
+};
+
+struct eevdf_event {
+	unsigned long long ts;
+	int cpu;
+	pid_t pid;
+	char comm[TASK_COMM_LEN];
+	long long vlag;
+	unsigned long long vruntime;
+	unsigned long long deadline;
+	unsigned long long slice;
+	int running;
+};
+
+/* vlag of tasks when they're switched out to sleep, in virtual ns */
+struct eevdf_stats {
+	char comm[TASK_COMM_LEN];
+	struct log2_hist pos_lag;
+	struct log2_hist neg_lag;
+	unsigned long long slice;
+};
+
+#define EAS_MAX_CANDIDATES	16
+
+/*
+ * Energy delta estimated by compute_energy() for placing the task on dst_cpu
+ * of the performance domain pd_cpu belongs to, in energy model units.
+ */
+struct eas_candidate {
+	int pd_cpu;
+	int dst_cpu;
+	long long delta;
+};
+
+struct eas_event {
+	unsigned long long ts;
+	int cpu;
+	pid_t pid;
+	char comm[TASK_COMM_LEN];
+	int prev_cpu;
+	int target_cpu;
+	unsigned int nr_candidates;
+	struct eas_candidate candidates[EAS_MAX_CANDIDATES];
+};
+
+struct eas_stats {
+	unsigned long long decisions;
+	unsigned long long prev_cpu;
+	unsigned long long candidates;
+	/* Sum of prev_cpu delta - target delta when the task moved */
+	unsigned long long saved;
+};
+
+/*
+ * Sum of PELT signals of all threads of a process. Per CPU values are deltas
+ * and can be negative, only their sum is meaningful.
+ */
+struct tgid_pelt {
+	char comm[TASK_COMM_LEN];
+	long long util_avg;
+	long long runnable_avg;
+	long long util_est;
+};
+
+/* Latest max(util_avg, util_est) of a task, to pick --top_tasks */
+struct task_util {
+	char comm[TASK_COMM_LEN];
+	unsigned long util;
+};
+
+/* Time a task ran at a frequency, in ns */
+struct freq_residency_key {
+	pid_t pid;
+	unsigned int freq;
+};
+
+struct freq_residency {
+	char comm[TASK_COMM_LEN];
+	unsigned long long time;
+};
+
+/* Time a CPU spent busy at a frequency, to estimate energy from the EM */
+struct energy_busy_key {
+	int cpu;
+	unsigned int freq;
+};
+
+/* Per CPU, times in ns */
+struct rt_dl_stats {
+	unsigned long long rt_push;
+	unsigned long long rt_pushed;
+	unsigned long long rt_push_time;
+	unsigned long long rt_pull;
+	unsigned long long rt_pull_time;
+	unsigned long long dl_push;
+	unsigned long long dl_pull;
+	unsigned long long rt_throttled;
+	unsigned long long rt_throttled_time;
+	unsigned long long dl_server_starts;
+	unsigned long long dl_server_time;
+};
+
+struct rt_throttle_event {
+	unsigned long long ts;
+	int cpu;
+	unsigned long long duration;
+};
+
+enum psi_stat {
+	PSI_STAT_CPU_SOME,
+	PSI_STAT_CPU_FULL,
+	PSI_STAT_MEM_SOME,
+	PSI_STAT_MEM_FULL,
+	PSI_STAT_IO_SOME,
+	PSI_STAT_IO_FULL,
+	NR_PSI_STATS,
+};
+
+/* Stall time in ns */
+struct psi_stats {
+	unsigned long long total[NR_PSI_STATS];
+};
+
+struct psi_cpu_key {
+	unsigned long long cgroup_id;
+	int cpu;
+};
+
+/*
+ * Last psi_group_cpu->times[] seen, and the psi_stat states still stalling
+ * since ts, which times[] only covers once they change again.
+ */
+struct psi_prev {
+	unsigned int times[NR_PSI_STATS];
+	unsigned int active;
+	unsigned long long ts;
+};
+
+enum migrate_class {
+	MIGRATE_SAME_LLC,
+	MIGRATE_CROSS_LLC,
+	MIGRATE_CROSS_NODE,
+	MIGRATE_NUMA_MOVE,
+	MIGRATE_NUMA_SWAP,
+	NR_MIGRATE_CLASSES,
+};
+
+struct migrate_key {
+	int from_cpu;
+	int to_cpu;
+};
+
+struct migrate_stats {
+	unsigned long long count[NR_MIGRATE_CLASSES];
+};
+
+struct migrate_task_stats {
+	char comm[TASK_COMM_LEN];
+	unsigned long long count[NR_MIGRATE_CLASSES];
+};
+
+struct runq_wait_stats {
+	char comm[TASK_COMM_LEN];
+	struct log2_hist hist;
+};
+
+struct wakeup_lat_event {
+	unsigned long long ts;
+	int cpu;
+	pid_t pid;
+	pid_t tgid;
+	char comm[TASK_COMM_LEN];
+	unsigned long long latency;
+};
+
+enum placement_path {
+	PLACEMENT_PATH_OTHER,
+	PLACEMENT_PATH_EAS,
+	PLACEMENT_PATH_FAST,
+	PLACEMENT_PATH_SLOW,
+	NR_PLACEMENT_PATHS,
+};
+
+enum placement_outcome {
+	PLACEMENT_PREV_CPU,
+	PLACEMENT_WAKER_CPU,
+	PLACEMENT_OTHER_CPU,
+	NR_PLACEMENT_OUTCOMES,
+};
+
+/* Functions select_task_rq_fair() went through */
+#define PLACEMENT_F_EAS			(1 << 0)
+#define PLACEMENT_F_WAKE_AFFINE		(1 << 1)
+#define PLACEMENT_F_SIS			(1 << 2)
+#define PLACEMENT_F_SLOW		(1 << 3)
+
+struct placement_stats {
+	unsigned long long count[NR_PLACEMENT_PATHS][NR_PLACEMENT_OUTCOMES];
+};
+
+struct placement_event {
+	unsigned long long ts;
+	int this_cpu;
+	pid_t pid;
+	char comm[TASK_COMM_LEN];
+	int prev_cpu;
+	int new_cpu;
+	int wake_flags;
+	unsigned int path_flags;
+};
+
+struct sugov_stats {
+	unsigned long long updates;
+	unsigned long long rate_limited;
+	unsigned long long freq_changes;
+};
+
+struct sugov_event {
+	unsigned long long ts;
+	int cpu;
+	int policy_cpu;
+	unsigned long util;
+	unsigned int prev_freq;
+	unsigned int next_freq;
+};
+
+#define MAX_IDLE_STATES		10	/* CPUIDLE_STATE_MAX */
+
+enum idle_gov_outcome {
+	IDLE_GOV_HIT,
+	IDLE_GOV_TOO_DEEP,
+	IDLE_GOV_TOO_SHALLOW,
+	NR_IDLE_GOV_OUTCOMES,
+};
+
+struct idle_gov_stats {
+	unsigned long long count[NR_IDLE_GOV_OUTCOMES];
+};
+
+struct idle_gov_event {
+	unsigned long long ts;
+	int cpu;
+	int state;
+	int outcome;
+	long long sleep_length;
+	unsigned long long residency;
+};
+
+#define MAX_STACK_DEPTH		127	/* PERF_MAX_STACK_DEPTH */
+#define STACK_MAP_SIZE		1024
+
+enum stack_source {
+	STACK_SOURCE_WAKEUP_LATENCY,
+	STACK_SOURCE_LOAD_BALANCE,
+	STACK_SOURCE_SOFTIRQ,
+	STACK_SOURCE_RQ_LOCK,
+	NR_STACK_SOURCES,
+};
+
+struct stack_event {
+	unsigned long long ts;
+	int cpu;
+	pid_t pid;
+	char comm[TASK_COMM_LEN];
+	int source;
+	int arg;	/* woken pid, lb phase, softirq vector or rq lock cpu */
+	int stack_id;
+	unsigned long long duration;
+};
 
 #endif /* __SCHED_ANALYZER_EVENTS_H__ */
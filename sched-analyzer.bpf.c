@@ -11,11 +11,32 @@
 extern int LINUX_KERNEL_VERSION __kconfig;
 
 #define UTIL_AVG_UNCHANGED              0x80000000
+#define PF_EXITING                      0x00000004
+#define TASK_ON_RQ_MIGRATING            2
 
 /*
  * Global variables shared with userspace counterpart.
  */
 struct sa_opts sa_opts;
+int nr_cpu_ids;
+bool rq_locks_learnt;
+bool cgroup_v1;
+/* Updates lost because the map was full */
+__u64 ipi_count_drops;
+/* Entries created in freq_residency, the ones missing got evicted */
+__u64 freq_residency_inserts;
+__u64 freq_residency_drops;
+__u64 cfs_throttle_drops;
+bool eevdf_dequeue_hooked;
+unsigned int cpu_capacity[MAX_CPUS];
+/* Topology learnt by userspace at startup */
+int cpu_llc_id[MAX_CPUS];
+int cpu_node_id[MAX_CPUS];
+/* scaling_cur_freq at startup, until cpu_frequency fires */
+unsigned int cpu_init_freq[MAX_CPUS];
+
+/* Needs per-cpu variables in BTF (pahole 1.18+), checked by userspace */
+extern const struct rq runqueues __ksym __weak;
 
 char LICENSE[] SEC("license") = "GPL";
 
@@ -32,6 +53,10 @@ struct task_struct__old {
 	int cpu;
 } __attribute__((preserve_access_index));
 
+struct task_struct__pre514 {
+	long state;
+} __attribute__((preserve_access_index));
+
 struct util_est {
 	unsigned int enqueued;
 	unsigned int ewma;
@@ -49,6 +74,20 @@ struct sched_avg__pre68 {
 	struct util_est util_est;
 };
 
+/* CONFIG_RT_GROUP_SCHED */
+struct rt_rq___group {
+	struct rq *rq;
+} __attribute__((preserve_access_index));
+
+/* 6.8+ dl_server */
+struct sched_dl_entity___server {
+	struct rq *rq;
+} __attribute__((preserve_access_index));
+
+/* 6.12+ DELAY_DEQUEUE */
+struct sched_entity___delayed {
+	unsigned char sched_delayed;
+} __attribute__((preserve_access_index));
 
 #define RB_SIZE		(256 * 1024)
 
@@ -59,12 +98,17 @@ struct {
 	__type(value, int);
 } sched_switch SEC(".maps");
 
+struct irq_entry_ts {
+	u64 softirq;
+	u64 hardirq;
+};
+
 struct {
-	__uint(type, BPF_MAP_TYPE_HASH);
-	__uint(max_entries, 8192);
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
 	__type(key, int);
-	__type(value, u64);
-} softirq_entry SEC(".maps");
+	__type(value, struct irq_entry_ts);
+} irq_entry SEC(".maps");
 
 struct {
 	__uint(type, BPF_MAP_TYPE_HASH);
@@ -74,1040 +118,4501 @@ struct {
 } lb_map SEC(".maps");
 
 /*
- * We define multiple ring buffers, one per event.
+ * Entry of load balance phases that run on every schedule. Their events are
+ * only emitted on exit if they took long enough or load_balance() ran.
  */
-struct {
-	__uint(type, BPF_MAP_TYPE_RINGBUF);
-	__uint(max_entries, RB_SIZE);
-} rq_pelt_rb SEC(".maps");
+struct lb_phase_entry {
+	u64 ts;
+	u64 nr_load_balance;
+	int lb_cpu;
+	unsigned int overloaded;
+	unsigned int overutilized;
+	unsigned long misfit_task_load;
+};
 
 struct {
-	__uint(type, BPF_MAP_TYPE_RINGBUF);
-	__uint(max_entries, RB_SIZE);
-} task_pelt_rb SEC(".maps");
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, NR_LB_PHASES);
+	__type(key, int);
+	__type(value, struct lb_phase_entry);
+} lb_phase_entry SEC(".maps");
 
 struct {
-       __uint(type, BPF_MAP_TYPE_RINGBUF);
-       __uint(max_entries, RB_SIZE);
-} rq_nr_running_rb SEC(".maps");
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, int);
+	__type(value, u64);
+} lb_nr_load_balance SEC(".maps");
 
+/* Kernel stacks of outliers, deduplicated by stack id */
 struct {
-       __uint(type, BPF_MAP_TYPE_RINGBUF);
-       __uint(max_entries, RB_SIZE);
-} sched_switch_rb SEC(".maps");
+	__uint(type, BPF_MAP_TYPE_STACK_TRACE);
+	__uint(max_entries, STACK_MAP_SIZE);
+	__uint(key_size, sizeof(u32));
+	__uint(value_size, MAX_STACK_DEPTH * sizeof(u64));
+} stack_traces SEC(".maps");
+
+/*
+ * Last emitted state, only emit what changed. Indexed by lb_cpu, whose
+ * domains can be balanced from another CPU when it's nohz idle.
+ */
+struct lb_cpu_state {
+	struct sched_domain *sd;
+	unsigned int balance_interval[MAX_SD_LEVELS];
+	unsigned long misfit_task_load;
+	/* What lb_cpu last saw of its root domain */
+	unsigned int overloaded;
+	unsigned int overutilized;
+	bool valid;
+};
 
 struct {
-       __uint(type, BPF_MAP_TYPE_RINGBUF);
-       __uint(max_entries, RB_SIZE);
-} freq_idle_rb SEC(".maps");
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, MAX_CPUS);
+	__type(key, int);
+	__type(value, struct lb_cpu_state);
+} lb_cpu_state SEC(".maps");
 
+/* Duration of all calls of the deferred phases */
 struct {
-       __uint(type, BPF_MAP_TYPE_RINGBUF);
-       __uint(max_entries, RB_SIZE);
-} softirq_rb SEC(".maps");
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, NR_LB_PHASES);
+	__type(key, int);
+	__type(value, struct log2_hist);
+} lb_phase_hist SEC(".maps");
 
+/*
+ * cgroup ids we're interested in, populated by userspace.
+ */
 struct {
-       __uint(type, BPF_MAP_TYPE_RINGBUF);
-       __uint(max_entries, RB_SIZE);
-} lb_rb SEC(".maps");
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, MAX_FILTERS_NUM);
+	__type(key, u64);
+	__type(value, bool);
+} cgroup_filter SEC(".maps");
 
+/*
+ * Tasks last seen running in a filtered cgroup, for userspace to match events
+ * that aren't filtered in kernel.
+ */
 struct {
-       __uint(type, BPF_MAP_TYPE_RINGBUF);
-       __uint(max_entries, RB_SIZE);
-} ipi_rb SEC(".maps");
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(max_entries, 16384);
+	__type(key, pid_t);
+	__type(value, bool);
+} cgroup_tasks SEC(".maps");
 
-static inline bool entity_is_task(struct sched_entity *se)
-{
-	if (bpf_core_field_exists(se->my_q))
-		return !BPF_CORE_READ(se, my_q);
-	else
-		return true;
-}
+/*
+ * Per task context, lives as long as the task does.
+ */
+struct task_ctx {
+	u64 waking_ts;
+	/* Waiting to run since enqueue_ts, on the current rq since rq_enqueue_ts */
+	u64 enqueue_ts;
+	u64 rq_enqueue_ts;
+	/* runq_wait_task entry was reset for this task, the pid may be reused */
+	bool runq_wait_seen;
+	u32 placement_count;
+	/* hw counters accumulated since pmu_ts on a CPU of pmu_capacity */
+	u64 pmu_ts;
+	u64 cycles;
+	u64 instructions;
+	unsigned int pmu_capacity;
+	u32 eas_count;
+	/* Last PELT values the task contributed to its tgid_pelt */
+	unsigned long tgid_util_avg;
+	unsigned long tgid_runnable_avg;
+	unsigned long tgid_util_est;
+	/* Last signals seen by the --task_min_util gate */
+	unsigned long gate_util_avg;
+	unsigned long gate_util_est;
+	bool gate_open;
+};
 
-static inline struct rq *rq_of(struct cfs_rq *cfs_rq)
-{
-	if (bpf_core_field_exists(cfs_rq->rq))
-		return BPF_CORE_READ(cfs_rq, rq);
-	else
-		return container_of(cfs_rq, struct rq, cfs);
-}
+struct {
+	__uint(type, BPF_MAP_TYPE_TASK_STORAGE);
+	__uint(map_flags, BPF_F_NO_PREALLOC);
+	__type(key, int);
+	__type(value, struct task_ctx);
+} task_ctx_map SEC(".maps");
 
-static inline bool cfs_rq_is_root(struct cfs_rq *cfs_rq)
-{
-	struct rq *rq = rq_of(cfs_rq);
+/*
+ * Histograms are per-cpu so that no atomics are required to update them.
+ * Userspace sums them up when reading.
+ */
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, int);
+	__type(value, struct log2_hist);
+} wakeup_lat_cpu_hist SEC(".maps");
 
-	if (rq)
-		return &rq->cfs == cfs_rq;
-	else
-		return false;
-}
+/* Exited processes are never removed, let the oldest be recycled */
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_PERCPU_HASH);
+	__uint(max_entries, 8192);
+	__type(key, pid_t);
+	__type(value, struct log2_hist);
+} wakeup_lat_tgid_hist SEC(".maps");
 
-SEC("raw_tp/pelt_se_tp")
-int BPF_PROG(handle_pelt_se, struct sched_entity *se)
-{
-	if (entity_is_task(se)) {
-		struct task_struct *p = container_of(se, struct task_struct, se);
-		unsigned long uclamp_min, uclamp_max;
-		struct task_pelt_event *e;
-		char comm[TASK_COMM_LEN];
-		int *running, cpu;
-		pid_t pid;
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, int);
+	__type(value, struct log2_hist);
+} runq_wait_cpu_hist SEC(".maps");
 
-		if (bpf_core_field_exists(p->wake_cpu)) {
-			cpu = BPF_CORE_READ(p, wake_cpu);
-		} else {
-			struct task_struct__old *p_old = (void *)p;
-			cpu = BPF_CORE_READ(p_old, cpu);
-		}
-		pid = BPF_CORE_READ(p, pid);
-		BPF_CORE_READ_STR_INTO(&comm, p, comm);
+/*
+ * A task can only be switched in on one CPU at a time, so no need for
+ * per-cpu copies here. Once full the least recently switched in task is
+ * evicted, and a new task reusing a pid resets the entry it inherits.
+ */
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(max_entries, 16384);
+	__type(key, pid_t);
+	__type(value, struct runq_wait_stats);
+} runq_wait_task SEC(".maps");
 
-		running = bpf_map_lookup_elem(&sched_switch, &pid);
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, MAX_SOFTIRQS);
+	__type(key, int);
+	__type(value, struct log2_hist);
+} softirq_hist SEC(".maps");
 
-		uclamp_min = -1;
-		uclamp_max = -1;
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+	__uint(max_entries, 1024);
+	__type(key, int);
+	__type(value, struct log2_hist);
+} hardirq_hist SEC(".maps");
 
-		if (bpf_core_field_exists(p->uclamp_req[UCLAMP_MIN].value))
-			uclamp_min = BPF_CORE_READ_BITFIELD_PROBED(p, uclamp_req[UCLAMP_MIN].value);
-		if (bpf_core_field_exists(p->uclamp_req[UCLAMP_MAX].value))
-			uclamp_max = BPF_CORE_READ_BITFIELD_PROBED(p, uclamp_req[UCLAMP_MAX].value);
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, 1024);
+	__type(key, int);
+	__type(value, struct irq_name);
+} hardirq_name SEC(".maps");
 
-		bpf_printk("[%s] Req: uclamp_min = %lu uclamp_max = %lu",
-			   comm, uclamp_min, uclamp_max);
+/*
+ * Functions select_task_rq_fair() went through. Wakeups happen with irqs
+ * disabled, so it can't nest on the same CPU.
+ */
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, int);
+	__type(value, u32);
+} placement_flags SEC(".maps");
 
-		if (bpf_core_field_exists(p->uclamp[UCLAMP_MIN].value)) {
-			bool active = BPF_CORE_READ_BITFIELD_PROBED(p, uclamp[UCLAMP_MIN].active);
-			if (active)
-				uclamp_min = BPF_CORE_READ_BITFIELD_PROBED(p, uclamp[UCLAMP_MIN].value);
-		}
-		if (bpf_core_field_exists(p->uclamp[UCLAMP_MAX].value)) {
-			bool active = BPF_CORE_READ_BITFIELD_PROBED(p, uclamp[UCLAMP_MAX].active);
-			if (active)
-				uclamp_max = BPF_CORE_READ_BITFIELD_PROBED(p, uclamp[UCLAMP_MAX].value);
-		}
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, int);
+	__type(value, struct placement_stats);
+} placement_stats SEC(".maps");
+
+/* State of sugov_policy when entering sugov_update_*() */
+struct sugov_entry {
+	u64 last_freq_update_time;
+	unsigned int next_freq;
+	bool rate_limited;
+};
 
-		bpf_printk("[%s] Eff: uclamp_min = %lu uclamp_max = %lu",
-			   comm, uclamp_min, uclamp_max);
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, int);
+	__type(value, struct sugov_entry);
+} sugov_entry SEC(".maps");
 
-		e = bpf_ringbuf_reserve(&task_pelt_rb, sizeof(*e), 0);
-		if (e) {
-			e->ts = bpf_ktime_get_boot_ns();
-			e->cpu = cpu;
-			e->pid = pid;
-			BPF_CORE_READ_STR_INTO(&e->comm, p, comm);
-			e->load_avg = BPF_CORE_READ(se, avg.load_avg);
-			e->runnable_avg = BPF_CORE_READ(se, avg.runnable_avg);
-			e->util_avg = BPF_CORE_READ(se, avg.util_avg);
-			e->util_est_enqueued = -1;
-			e->util_est_ewma = -1;
-			e->uclamp_min = uclamp_min;
-			e->uclamp_max = uclamp_max;
-			if (running)
-				e->running = 1;
-			else
-				e->running = 0;
-			bpf_ringbuf_submit(e, 0);
-		}
-	}
+/* Indexed by policy->cpu */
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+	__uint(max_entries, 256);
+	__type(key, int);
+	__type(value, struct sugov_stats);
+} sugov_stats SEC(".maps");
+
+/* Idle governor decision in flight on this CPU */
+struct idle_gov_select {
+	struct cpuidle_driver *drv;
+	s64 sleep_length;
+	int state;
+	bool in_select;
+};
 
-	return 0;
-}
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, int);
+	__type(value, struct idle_gov_select);
+} idle_gov_select SEC(".maps");
 
-SEC("raw_tp/sched_util_est_se_tp")
-int BPF_PROG(handle_util_est_se, struct sched_entity *se)
-{
-	if (entity_is_task(se)) {
-		struct task_struct *p = container_of(se, struct task_struct, se);
-		unsigned long util_est_enqueued, util_est_ewma;
-		struct task_pelt_event *e;
-		char comm[TASK_COMM_LEN];
-		int *running, cpu;
-		pid_t pid;
+/* Indexed by idle state */
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, MAX_IDLE_STATES);
+	__type(key, int);
+	__type(value, struct idle_gov_stats);
+} idle_gov_stats SEC(".maps");
 
-		if (bpf_core_field_exists(p->wake_cpu)) {
-			cpu = BPF_CORE_READ(p, wake_cpu);
-		} else {
-			struct task_struct__old *p_old = (void *)p;
-			cpu = BPF_CORE_READ(p_old, cpu);
-		}
-		pid = BPF_CORE_READ(p, pid);
-		BPF_CORE_READ_STR_INTO(&comm, p, comm);
+/*
+ * Number of IPIs sent, only updated from the sending CPU. Resized by userspace
+ * to fit every CPU pair.
+ */
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, 16384);
+	__type(key, struct ipi_key);
+	__type(value, u64);
+} ipi_count SEC(".maps");
 
-		running = bpf_map_lookup_elem(&sched_switch, &pid);
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, int);
+	__type(value, u64);
+} ipi_sample SEC(".maps");
 
-		if (LINUX_KERNEL_VERSION < KERNEL_VERSION(6, 8, 0)) {
-			struct sched_avg__pre68 *avg_old = (void *)&se->avg;
-			util_est_enqueued = BPF_PROBE_READ(avg_old, util_est.enqueued);
-			util_est_ewma = BPF_PROBE_READ(avg_old, util_est.ewma);
-		} else {
-			util_est_enqueued = BPF_CORE_READ(se, avg.util_est);
-			util_est_ewma = 0;
-		}
+struct lb_entry {
+	u64 ts;
+	long imbalance;
+};
 
-		e = bpf_ringbuf_reserve(&task_pelt_rb, sizeof(*e), 0);
-		if (e) {
-			e->ts = bpf_ktime_get_boot_ns();
-			e->cpu = cpu;
-			e->pid = pid;
-			BPF_CORE_READ_STR_INTO(&e->comm, p, comm);
-			e->load_avg = -1;
-			e->runnable_avg = -1;
-			e->util_avg = -1;
-			e->util_est_enqueued = util_est_enqueued & ~UTIL_AVG_UNCHANGED;
-			e->util_est_ewma = util_est_ewma;
-			e->uclamp_min = -1;
-			e->uclamp_max = -1;
-			if (running)
-				e->running = 1;
-			else
-				e->running = 0;
-			bpf_ringbuf_submit(e, 0);
-		}
-	}
+/* load_balance() can't nest on the same CPU */
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, int);
+	__type(value, struct lb_entry);
+} lb_entry SEC(".maps");
 
-	return 0;
-}
+/* Indexed by sched_domain level */
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, MAX_SD_LEVELS);
+	__type(key, int);
+	__type(value, struct lb_stats);
+} lb_stats SEC(".maps");
 
-SEC("raw_tp/pelt_cfs_tp")
-int BPF_PROG(handle_pelt_cfs, struct cfs_rq *cfs_rq)
-{
-	if (cfs_rq_is_root(cfs_rq)) {
-		struct rq *rq = rq_of(cfs_rq);
-		int cpu = BPF_CORE_READ(rq, cpu);
-		struct rq_pelt_event *e;
+/* Number of tasks pulled from each busiest CPU */
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, 4096);
+	__type(key, struct lb_busiest_key);
+	__type(value, u64);
+} lb_busiest SEC(".maps");
 
-		unsigned long uclamp_min = -1;
-		unsigned long uclamp_max = -1;
+/*
+ * Oldest call function IPI pending delivery, indexed by target cpu. ts is 1
+ * while the sender fills in the other fields.
+ */
+#define IPI_PENDING_BUSY	1
+#define IPI_PENDING_EXPIRE	(100 * 1000 * 1000)	/* 100ms */
+/*
+ * IPIs without a callback are matched as reschedule IPIs, the others of them
+ * never arrive there. Reschedule IPIs don't wait behind other callbacks,
+ * expire these sooner.
+ */
+#define IPI_RESCHED_EXPIRE	(10 * 1000 * 1000)	/* 10ms */
 
-		if (bpf_core_field_exists(rq->uclamp[UCLAMP_MIN].value))
-			uclamp_min = BPF_CORE_READ(rq, uclamp[UCLAMP_MIN].value);
-		if (bpf_core_field_exists(rq->uclamp[UCLAMP_MAX].value))
-			uclamp_max = BPF_CORE_READ(rq, uclamp[UCLAMP_MAX].value);
+struct ipi_pending {
+	u64 ts;
+	void *callback;
+	int from_cpu;
+};
 
-		bpf_printk("cfs: [CPU%d] uclamp_min = %lu uclamp_max = %lu",
-			   cpu, uclamp_min, uclamp_max);
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, MAX_CPUS);
+	__type(key, int);
+	__type(value, struct ipi_pending);
+} ipi_pending SEC(".maps");
 
-		e = bpf_ringbuf_reserve(&rq_pelt_rb, sizeof(*e), 0);
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, MAX_CPUS);
+	__type(key, int);
+	__type(value, struct ipi_pending);
+} ipi_resched_pending SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, int);
+	__type(value, u64);
+} csd_entry SEC(".maps");
+
+/* Only updated from the target cpu */
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, 4096);
+	__type(key, struct ipi_lat_key);
+	__type(value, struct log2_hist);
+} ipi_lat_hist SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, 4096);
+	__type(key, struct ipi_lat_key);
+	__type(value, struct log2_hist);
+} ipi_func_hist SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, 65536);
+	__type(key, struct migrate_key);
+	__type(value, u64);
+} migrate_count SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, int);
+	__type(value, struct migrate_stats);
+} migrate_stats SEC(".maps");
+
+/* Per task, the least recently migrated tasks make room for new ones */
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(max_entries, 8192);
+	__type(key, pid_t);
+	__type(value, struct migrate_task_stats);
+} migrate_task_count SEC(".maps");
+
+/*
+ * Throttled cfs_rq of a cgroup on a CPU, serialized by the rq lock. Resized
+ * by userspace with the number of CPUs.
+ */
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, 8192);
+	__type(key, struct cfs_throttle_key);
+	__type(value, u64);
+} cfs_throttle_start SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, 8192);
+	__type(key, struct cfs_throttle_key);
+	__type(value, struct log2_hist);
+} cfs_throttle_hist SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, MAX_CPUS);
+	__type(key, int);
+	__type(value, struct rt_dl_stats);
+} rt_dl_stats SEC(".maps");
+
+struct rt_dl_entry {
+	u64 push;
+	u64 pull;
+};
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, int);
+	__type(value, struct rt_dl_entry);
+} rt_dl_entry SEC(".maps");
+
+/* When the root rt_rq of a CPU got throttled */
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, MAX_CPUS);
+	__type(key, int);
+	__type(value, u64);
+} rt_throttle_start SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, MAX_CPUS);
+	__type(key, int);
+	__type(value, u64);
+} dl_server_start_ts SEC(".maps");
+
+/* Lag of tasks that haven't slept for a while is the first to go */
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(max_entries, 8192);
+	__type(key, pid_t);
+	__type(value, struct eevdf_stats);
+} eevdf_stats SEC(".maps");
+
+/*
+ * Candidates evaluated by find_energy_efficient_cpu(). Wakeups happen with
+ * irqs disabled, so it can't nest on the same CPU.
+ */
+struct eas_state {
+	u64 pd;
+	u64 base_energy;
+	int pd_cpu;
+	unsigned int nr_candidates;
+	struct eas_candidate candidates[EAS_MAX_CANDIDATES];
+};
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, int);
+	__type(value, struct eas_state);
+} eas_state SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, int);
+	__type(value, struct eas_stats);
+} eas_stats SEC(".maps");
+
+/* Frequency and idle state of a CPU since ts */
+/* next_freq and next_ts are posted by cpu_frequency from any CPU */
+struct energy_cpu {
+	u64 ts;
+	unsigned int freq;
+	bool idle;
+	u64 next_ts;
+	u32 next_freq;
+};
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, MAX_CPUS);
+	__type(key, int);
+	__type(value, struct energy_cpu);
+} energy_cpu SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, 16384);
+	__type(key, struct energy_busy_key);
+	__type(value, u64);
+} energy_busy SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+	__uint(max_entries, 8192);
+	__type(key, pid_t);
+	__type(value, struct tgid_pelt);
+} tgid_pelt SEC(".maps");
+
+/* Refreshed by userspace every stats_period with the --top_tasks pids */
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, MAX_TOP_TASKS);
+	__type(key, pid_t);
+	__type(value, bool);
+} top_tasks SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(max_entries, 16384);
+	__type(key, pid_t);
+	__type(value, struct task_util);
+} task_util SEC(".maps");
+
+/* Task running on a CPU since ts and the frequency it runs at */
+/*
+ * Only ever updated by the CPU it belongs to, but for next_freq and next_ts
+ * that cpu_frequency posts from whichever CPU of the policy changed it.
+ */
+struct freq_residency_cpu {
+	u64 ts;
+	unsigned int freq;
+	pid_t pid;
+	bool tracked;
+	char comm[TASK_COMM_LEN];
+	u64 next_ts;
+	u32 next_freq;
+};
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, MAX_CPUS);
+	__type(key, int);
+	__type(value, struct freq_residency_cpu);
+} freq_residency_cpu SEC(".maps");
+
+/* Exited tasks are never removed, the least recently accounted are recycled */
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(max_entries, 16384);
+	__type(key, struct freq_residency_key);
+	__type(value, struct freq_residency);
+} freq_residency SEC(".maps");
+
+/*
+ * psi_group address to the id of the cgroup it belongs to. Only the root and
+ * filtered cgroups live here, entries are removed when the cgroup is.
+ */
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, MAX_FILTERS_NUM + 1);
+	__type(key, u64);
+	__type(value, u64);
+} psi_cgroup SEC(".maps");
+
+/* psi_group addresses already walked that belong to no tracked cgroup */
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(max_entries, 4096);
+	__type(key, u64);
+	__type(value, bool);
+} psi_untracked SEC(".maps");
+
+/* Updated under the rq lock of cpu */
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, 16384);
+	__type(key, struct psi_cpu_key);
+	__type(value, struct psi_prev);
+} psi_prev SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, 4096);
+	__type(key, u64);
+	__type(value, struct psi_stats);
+} psi_stats SEC(".maps");
+
+/* Per-CPU perf events opened by userspace */
+struct {
+	__uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
+	__uint(max_entries, MAX_CPUS);
+	__type(key, int);
+	__type(value, int);
+} pmu_cycles SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
+	__uint(max_entries, MAX_CPUS);
+	__type(key, int);
+	__type(value, int);
+} pmu_instructions SEC(".maps");
+
+struct pmu_last {
+	u64 cycles;
+	u64 instructions;
+};
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, int);
+	__type(value, struct pmu_last);
+} pmu_last SEC(".maps");
+
+/* rq->__lock address to the CPU of the rq */
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, MAX_CPUS);
+	__type(key, u64);
+	__type(value, int);
+} rq_lock_cpu SEC(".maps");
+
+struct rq_lock_wait {
+	u64 ts;
+	u64 lock;
+	int cpu;
+};
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, int);
+	__type(value, struct rq_lock_wait);
+} rq_lock_wait SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, MAX_CPUS);
+	__type(key, int);
+	__type(value, struct rq_lock_stats);
+} rq_lock_stats SEC(".maps");
+
+/* Reset by userspace every stats period */
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, MAX_CPUS);
+	__type(key, int);
+	__type(value, u64);
+} rq_lock_max_contenders SEC(".maps");
+
+/* Wait time on the rq lock of a CPU, accounted on the waiting CPU */
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+	__uint(max_entries, MAX_CPUS);
+	__type(key, int);
+	__type(value, struct log2_hist);
+} rq_lock_hist SEC(".maps");
+
+/*
+ * We define multiple ring buffers, one per event.
+ */
+struct {
+	__uint(type, BPF_MAP_TYPE_RINGBUF);
+	__uint(max_entries, RB_SIZE);
+} rq_pelt_rb SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_RINGBUF);
+	__uint(max_entries, RB_SIZE);
+} task_pelt_rb SEC(".maps");
+
+struct {
+       __uint(type, BPF_MAP_TYPE_RINGBUF);
+       __uint(max_entries, RB_SIZE);
+} rq_nr_running_rb SEC(".maps");
+
+struct {
+       __uint(type, BPF_MAP_TYPE_RINGBUF);
+       __uint(max_entries, RB_SIZE);
+} sched_switch_rb SEC(".maps");
+
+struct {
+       __uint(type, BPF_MAP_TYPE_RINGBUF);
+       __uint(max_entries, RB_SIZE);
+} freq_idle_rb SEC(".maps");
+
+struct {
+       __uint(type, BPF_MAP_TYPE_RINGBUF);
+       __uint(max_entries, RB_SIZE);
+} lb_rb SEC(".maps");
+
+struct {
+       __uint(type, BPF_MAP_TYPE_RINGBUF);
+       __uint(max_entries, RB_SIZE);
+} lb_sd_rb SEC(".maps");
+
+struct {
+       __uint(type, BPF_MAP_TYPE_RINGBUF);
+       __uint(max_entries, RB_SIZE);
+} stack_rb SEC(".maps");
+
+struct {
+       __uint(type, BPF_MAP_TYPE_RINGBUF);
+       __uint(max_entries, RB_SIZE);
+} pmu_rb SEC(".maps");
+
+struct {
+       __uint(type, BPF_MAP_TYPE_RINGBUF);
+       __uint(max_entries, RB_SIZE);
+} cfs_throttle_rb SEC(".maps");
+
+struct {
+       __uint(type, BPF_MAP_TYPE_RINGBUF);
+       __uint(max_entries, RB_SIZE);
+} rt_throttle_rb SEC(".maps");
+
+struct {
+       __uint(type, BPF_MAP_TYPE_RINGBUF);
+       __uint(max_entries, RB_SIZE);
+} eevdf_rb SEC(".maps");
+
+struct {
+       __uint(type, BPF_MAP_TYPE_RINGBUF);
+       __uint(max_entries, RB_SIZE);
+} eas_rb SEC(".maps");
+
+struct {
+       __uint(type, BPF_MAP_TYPE_RINGBUF);
+       __uint(max_entries, RB_SIZE);
+} ipi_rb SEC(".maps");
+
+struct {
+       __uint(type, BPF_MAP_TYPE_RINGBUF);
+       __uint(max_entries, RB_SIZE);
+} ipi_lat_rb SEC(".maps");
+
+struct {
+       __uint(type, BPF_MAP_TYPE_RINGBUF);
+       __uint(max_entries, RB_SIZE);
+} wakeup_lat_rb SEC(".maps");
+
+struct {
+       __uint(type, BPF_MAP_TYPE_RINGBUF);
+       __uint(max_entries, RB_SIZE);
+} placement_rb SEC(".maps");
+
+struct {
+       __uint(type, BPF_MAP_TYPE_RINGBUF);
+       __uint(max_entries, RB_SIZE);
+} sugov_rb SEC(".maps");
+
+struct {
+       __uint(type, BPF_MAP_TYPE_RINGBUF);
+       __uint(max_entries, RB_SIZE);
+} idle_gov_rb SEC(".maps");
+
+static const struct log2_hist zero_hist;
+static const struct runq_wait_stats zero_runq_wait_stats;
+
+static inline unsigned int log2_u32(u32 v)
+{
+	unsigned int r, shift;
+
+	r = (v > 0xFFFF) << 4; v >>= r;
+	shift = (v > 0xFF) << 3; v >>= shift; r |= shift;
+	shift = (v > 0xF) << 2; v >>= shift; r |= shift;
+	shift = (v > 0x3) << 1; v >>= shift; r |= shift;
+	r |= (v >> 1);
+
+	return r;
+}
+
+static inline unsigned int log2_u64(u64 v)
+{
+	u32 hi = v >> 32;
+
+	if (hi)
+		return log2_u32(hi) + 32;
+	else
+		return log2_u32(v);
+}
+
+static inline void hist_add(struct log2_hist *hist, u64 value)
+{
+	unsigned int slot = log2_u64(value);
+
+	if (slot >= HIST_SLOTS)
+		slot = HIST_SLOTS - 1;
+
+	hist->slots[slot]++;
+	hist->count++;
+	hist->total += value;
+	if (value > hist->max)
+		hist->max = value;
+}
+
+static inline struct log2_hist *lookup_or_init_hist(void *map, void *key)
+{
+	struct log2_hist *hist = bpf_map_lookup_elem(map, key);
+
+	if (!hist) {
+		bpf_map_update_elem(map, key, &zero_hist, BPF_NOEXIST);
+		hist = bpf_map_lookup_elem(map, key);
+	}
+
+	return hist;
+}
+
+/*
+ * Capture the kernel stack of an event that exceeded its threshold.
+ */
+static inline void capture_stack(void *ctx, enum stack_source source, int arg,
+				 u64 duration, u64 ts)
+{
+	struct stack_event *e;
+
+	if (!sa_opts.stacks)
+		return;
+
+	e = bpf_ringbuf_reserve(&stack_rb, sizeof(*e), 0);
+	if (e) {
+		e->ts = ts;
+		e->cpu = bpf_get_smp_processor_id();
+		e->pid = bpf_get_current_pid_tgid();
+		bpf_get_current_comm(&e->comm, sizeof(e->comm));
+		e->source = source;
+		e->arg = arg;
+		e->stack_id = bpf_get_stackid(ctx, &stack_traces, 0);
+		e->duration = duration;
+		bpf_ringbuf_submit(e, 0);
+	}
+}
+
+static inline bool entity_is_task(struct sched_entity *se)
+{
+	if (bpf_core_field_exists(se->my_q))
+		return !BPF_CORE_READ(se, my_q);
+	else
+		return true;
+}
+
+static inline struct rq *rq_of(struct cfs_rq *cfs_rq)
+{
+	if (bpf_core_field_exists(cfs_rq->rq))
+		return BPF_CORE_READ(cfs_rq, rq);
+	else
+		return container_of(cfs_rq, struct rq, cfs);
+}
+
+static inline u64 cfs_rq_cgroup_id(struct cfs_rq *cfs_rq)
+{
+	if (!bpf_core_field_exists(cfs_rq->tg))
+		return 0;
+
+	return BPF_CORE_READ(cfs_rq, tg, css.cgroup, kn, id);
+}
+
+static inline bool cgroup_is_filtered(u64 cgroup_id)
+{
+	return bpf_map_lookup_elem(&cgroup_filter, &cgroup_id) != NULL;
+}
+
+/*
+ * Only the cgroup the task is in matches, not its ancestors. On v1 --cgroup
+ * ids are resolved in the cpu controller hierarchy.
+ */
+static inline u64 task_cgroup_id(struct task_struct *p)
+{
+	struct cgroup_subsys_state *css;
+	struct css_set *cset;
+	int cpu_id;
+
+	if (!cgroup_v1)
+		return BPF_CORE_READ(p, cgroups, dfl_cgrp, kn, id);
+
+	cpu_id = bpf_core_enum_value(enum cgroup_subsys_id, cpu_cgrp_id);
+	cset = BPF_CORE_READ(p, cgroups);
+	if (bpf_core_read(&css, sizeof(css), &cset->subsys[cpu_id]))
+		return 0;
+
+	return BPF_CORE_READ(css, cgroup, kn, id);
+}
+
+/*
+ * Apply --pid and --cgroup filters in kernel, a task matching either is
+ * collected. --comm is left to userspace.
+ */
+static inline bool ignore_task(struct task_struct *p)
+{
+	pid_t pid;
+	int i;
+
+	if (!sa_opts.num_pids && !sa_opts.num_cgroups)
+		return false;
+
+	if (sa_opts.num_cgroups && cgroup_is_filtered(task_cgroup_id(p)))
+		return false;
+
+	/* Let userspace match --comm */
+	if (sa_opts.num_comms)
+		return false;
+
+	pid = BPF_CORE_READ(p, pid);
+	for (i = 0; i < MAX_FILTERS_NUM; i++) {
+		if (i >= sa_opts.num_pids)
+			break;
+		if (sa_opts.pid[i] == pid)
+			return false;
+	}
+
+	return true;
+}
+
+static inline unsigned int get_task_state(struct task_struct *p)
+{
+	if (bpf_core_field_exists(p->__state)) {
+		return BPF_CORE_READ(p, __state);
+	} else {
+		struct task_struct__pre514 *p_old = (void *)p;
+		return BPF_CORE_READ(p_old, state);
+	}
+}
+
+static inline bool cfs_rq_is_root(struct cfs_rq *cfs_rq)
+{
+	struct rq *rq = rq_of(cfs_rq);
+
+	if (rq)
+		return &rq->cfs == cfs_rq;
+	else
+		return false;
+}
+
+static inline struct tgid_pelt *lookup_tgid_pelt(struct task_struct *p)
+{
+	static const struct tgid_pelt zero;
+	pid_t tgid = BPF_CORE_READ(p, tgid);
+	struct tgid_pelt *pelt;
+
+	pelt = bpf_map_lookup_elem(&tgid_pelt, &tgid);
+	if (!pelt) {
+		bpf_map_update_elem(&tgid_pelt, &tgid, &zero, BPF_NOEXIST);
+		pelt = bpf_map_lookup_elem(&tgid_pelt, &tgid);
+		if (!pelt)
+			return NULL;
+	}
+
+	/* Every CPU gets its own zeroed copy */
+	if (!pelt->comm[0])
+		BPF_CORE_READ_STR_INTO(&pelt->comm, p, group_leader, comm);
+
+	return pelt;
+}
+
+/*
+ * Its contribution was removed at sched_process_exit, the final dequeue and
+ * the PELT updates that come with it happen after and must not re-add it.
+ */
+static inline bool pelt_tgid_skip(struct task_struct *p)
+{
+	if (BPF_CORE_READ(p, flags) & PF_EXITING)
+		return true;
+
+	return sa_opts.num_cgroups && !cgroup_is_filtered(task_cgroup_id(p));
+}
+
+/*
+ * Fold the change of the task signals since its last update into its
+ * process. Only deltas are accounted so no walk of the threads is needed.
+ */
+static inline void pelt_tgid_account_avg(struct task_struct *p, struct sched_entity *se)
+{
+	unsigned long util_avg, runnable_avg;
+	struct tgid_pelt *pelt;
+	struct task_ctx *tctx;
+
+	if (pelt_tgid_skip(p))
+		return;
+
+	tctx = bpf_task_storage_get(&task_ctx_map, p, 0,
+				    BPF_LOCAL_STORAGE_GET_F_CREATE);
+	if (!tctx)
+		return;
+
+	pelt = lookup_tgid_pelt(p);
+	if (!pelt)
+		return;
+
+	util_avg = BPF_CORE_READ(se, avg.util_avg);
+	runnable_avg = BPF_CORE_READ(se, avg.runnable_avg);
+
+	pelt->util_avg += (long long)util_avg - (long long)tctx->tgid_util_avg;
+	pelt->runnable_avg += (long long)runnable_avg - (long long)tctx->tgid_runnable_avg;
+
+	tctx->tgid_util_avg = util_avg;
+	tctx->tgid_runnable_avg = runnable_avg;
+}
+
+static inline void pelt_tgid_account_util_est(struct task_struct *p, unsigned long util_est)
+{
+	struct tgid_pelt *pelt;
+	struct task_ctx *tctx;
+
+	if (pelt_tgid_skip(p))
+		return;
+
+	tctx = bpf_task_storage_get(&task_ctx_map, p, 0,
+				    BPF_LOCAL_STORAGE_GET_F_CREATE);
+	if (!tctx)
+		return;
+
+	pelt = lookup_tgid_pelt(p);
+	if (!pelt)
+		return;
+
+	pelt->util_est += (long long)util_est - (long long)tctx->tgid_util_est;
+	tctx->tgid_util_est = util_est;
+}
+
+static inline bool task_uclamp_is_default(struct task_struct *p)
+{
+	unsigned long uclamp_min = 0, uclamp_max = 1024;
+
+	if (bpf_core_field_exists(p->uclamp_req[UCLAMP_MIN].value))
+		uclamp_min = BPF_CORE_READ_BITFIELD_PROBED(p, uclamp_req[UCLAMP_MIN].value);
+	if (bpf_core_field_exists(p->uclamp_req[UCLAMP_MAX].value))
+		uclamp_max = BPF_CORE_READ_BITFIELD_PROBED(p, uclamp_req[UCLAMP_MAX].value);
+
+	return uclamp_min == 0 && uclamp_max == 1024;
+}
+
+/*
+ * Whether PELT events of a task should be emitted. Pass -1 for the signal
+ * that wasn't updated. The gate opens when util_avg or util_est reaches
+ * task_min_util and only closes once they drop below 3/4 of it, so tasks
+ * hovering around the threshold don't flicker in and out.
+ */
+static inline bool task_pelt_gate(struct task_struct *p, long util_avg, long util_est)
+{
+	struct task_ctx *tctx;
+	unsigned long util;
+	pid_t pid;
+
+	if (!sa_opts.task_min_util && !sa_opts.top_tasks)
+		return true;
+
+	tctx = bpf_task_storage_get(&task_ctx_map, p, 0,
+				    BPF_LOCAL_STORAGE_GET_F_CREATE);
+	if (!tctx)
+		return false;
+
+	if (util_avg >= 0)
+		tctx->gate_util_avg = util_avg;
+	if (util_est >= 0)
+		tctx->gate_util_est = util_est;
+
+	util = tctx->gate_util_avg > tctx->gate_util_est ?
+	       tctx->gate_util_avg : tctx->gate_util_est;
+
+	if (sa_opts.task_min_util) {
+		if (util >= sa_opts.task_min_util)
+			tctx->gate_open = true;
+		else if (util < sa_opts.task_min_util * 3 / 4)
+			tctx->gate_open = false;
+	}
+
+	pid = BPF_CORE_READ(p, pid);
+
+	if (sa_opts.top_tasks) {
+		struct task_util *value;
+
+		/* Hot path, only allocate and copy comm the first time */
+		value = bpf_map_lookup_elem(&task_util, &pid);
+		if (value) {
+			if (value->util != util)
+				value->util = util;
+		} else {
+			struct task_util new_value = { .util = util };
+
+			BPF_CORE_READ_STR_INTO(&new_value.comm, p, comm);
+			bpf_map_update_elem(&task_util, &pid, &new_value, BPF_NOEXIST);
+		}
+
+		if (bpf_map_lookup_elem(&top_tasks, &pid))
+			return true;
+	}
+
+	return tctx->gate_open || !task_uclamp_is_default(p);
+}
+
+SEC("raw_tp/pelt_se_tp")
+int BPF_PROG(handle_pelt_se, struct sched_entity *se)
+{
+	if (entity_is_task(se)) {
+		struct task_struct *p = container_of(se, struct task_struct, se);
+		unsigned long uclamp_min, uclamp_max;
+		struct task_pelt_event *e;
+		char comm[TASK_COMM_LEN];
+		int running, cpu;
+		pid_t pid;
+
+		if (bpf_core_field_exists(p->wake_cpu)) {
+			cpu = BPF_CORE_READ(p, wake_cpu);
+		} else {
+			struct task_struct__old *p_old = (void *)p;
+			cpu = BPF_CORE_READ(p_old, cpu);
+		}
+		pid = BPF_CORE_READ(p, pid);
+		BPF_CORE_READ_STR_INTO(&comm, p, comm);
+
+		/* sched_switch map isn't maintained, handle_sched_switch is disabled */
+		running = BPF_CORE_READ(p, on_cpu);
+
+		if (sa_opts.pelt_tgid) {
+			pelt_tgid_account_avg(p, se);
+			if (!sa_opts.load_avg_task && !sa_opts.runnable_avg_task &&
+			    !sa_opts.util_avg_task)
+				return 0;
+		}
+
+		if (!task_pelt_gate(p, BPF_CORE_READ(se, avg.util_avg), -1))
+			return 0;
+
+		uclamp_min = -1;
+		uclamp_max = -1;
+
+		if (bpf_core_field_exists(p->uclamp_req[UCLAMP_MIN].value))
+			uclamp_min = BPF_CORE_READ_BITFIELD_PROBED(p, uclamp_req[UCLAMP_MIN].value);
+		if (bpf_core_field_exists(p->uclamp_req[UCLAMP_MAX].value))
+			uclamp_max = BPF_CORE_READ_BITFIELD_PROBED(p, uclamp_req[UCLAMP_MAX].value);
+
+		bpf_printk("[%s] Req: uclamp_min = %lu uclamp_max = %lu",
+			   comm, uclamp_min, uclamp_max);
+
+		if (bpf_core_field_exists(p->uclamp[UCLAMP_MIN].value)) {
+			bool active = BPF_CORE_READ_BITFIELD_PROBED(p, uclamp[UCLAMP_MIN].active);
+			if (active)
+				uclamp_min = BPF_CORE_READ_BITFIELD_PROBED(p, uclamp[UCLAMP_MIN].value);
+		}
+		if (bpf_core_field_exists(p->uclamp[UCLAMP_MAX].value)) {
+			bool active = BPF_CORE_READ_BITFIELD_PROBED(p, uclamp[UCLAMP_MAX].active);
+			if (active)
+				uclamp_max = BPF_CORE_READ_BITFIELD_PROBED(p, uclamp[UCLAMP_MAX].value);
+		}
+
+		bpf_printk("[%s] Eff: uclamp_min = %lu uclamp_max = %lu",
+			   comm, uclamp_min, uclamp_max);
+
+		e = bpf_ringbuf_reserve(&task_pelt_rb, sizeof(*e), 0);
 		if (e) {
 			e->ts = bpf_ktime_get_boot_ns();
 			e->cpu = cpu;
-			e->type = PELT_TYPE_CFS;
-			e->load_avg = BPF_CORE_READ(cfs_rq, avg.load_avg);
-			e->runnable_avg = BPF_CORE_READ(cfs_rq, avg.runnable_avg);
-			e->util_avg = BPF_CORE_READ(cfs_rq, avg.util_avg);
+			e->pid = pid;
+			BPF_CORE_READ_STR_INTO(&e->comm, p, comm);
+			e->load_avg = BPF_CORE_READ(se, avg.load_avg);
+			e->runnable_avg = BPF_CORE_READ(se, avg.runnable_avg);
+			e->util_avg = BPF_CORE_READ(se, avg.util_avg);
 			e->util_est_enqueued = -1;
 			e->util_est_ewma = -1;
 			e->uclamp_min = uclamp_min;
 			e->uclamp_max = uclamp_max;
+			if (running)
+				e->running = 1;
+			else
+				e->running = 0;
+			bpf_ringbuf_submit(e, 0);
+		}
+	}
+
+	return 0;
+}
+
+static inline void read_util_est(struct sched_entity *se,
+				 unsigned long *enqueued, unsigned long *ewma)
+{
+	if (LINUX_KERNEL_VERSION < KERNEL_VERSION(6, 8, 0)) {
+		struct sched_avg__pre68 *avg_old = (void *)&se->avg;
+		*enqueued = BPF_PROBE_READ(avg_old, util_est.enqueued);
+		*ewma = BPF_PROBE_READ(avg_old, util_est.ewma);
+	} else {
+		*enqueued = BPF_CORE_READ(se, avg.util_est);
+		*ewma = 0;
+	}
+}
+
+SEC("raw_tp/sched_util_est_se_tp")
+int BPF_PROG(handle_util_est_se, struct sched_entity *se)
+{
+	if (entity_is_task(se)) {
+		struct task_struct *p = container_of(se, struct task_struct, se);
+		unsigned long util_est_enqueued, util_est_ewma;
+		struct task_pelt_event *e;
+		char comm[TASK_COMM_LEN];
+		int running, cpu;
+		pid_t pid;
+
+		if (bpf_core_field_exists(p->wake_cpu)) {
+			cpu = BPF_CORE_READ(p, wake_cpu);
+		} else {
+			struct task_struct__old *p_old = (void *)p;
+			cpu = BPF_CORE_READ(p_old, cpu);
+		}
+		pid = BPF_CORE_READ(p, pid);
+		BPF_CORE_READ_STR_INTO(&comm, p, comm);
+
+		/* sched_switch map isn't maintained, handle_sched_switch is disabled */
+		running = BPF_CORE_READ(p, on_cpu);
+
+		read_util_est(se, &util_est_enqueued, &util_est_ewma);
+
+		if (sa_opts.pelt_tgid) {
+			pelt_tgid_account_util_est(p, util_est_enqueued & ~UTIL_AVG_UNCHANGED);
+			if (!sa_opts.util_est_task)
+				return 0;
+		}
+
+		if (!task_pelt_gate(p, -1, util_est_enqueued & ~UTIL_AVG_UNCHANGED))
+			return 0;
+
+		e = bpf_ringbuf_reserve(&task_pelt_rb, sizeof(*e), 0);
+		if (e) {
+			e->ts = bpf_ktime_get_boot_ns();
+			e->cpu = cpu;
+			e->pid = pid;
+			BPF_CORE_READ_STR_INTO(&e->comm, p, comm);
+			e->load_avg = -1;
+			e->runnable_avg = -1;
+			e->util_avg = -1;
+			e->util_est_enqueued = util_est_enqueued & ~UTIL_AVG_UNCHANGED;
+			e->util_est_ewma = util_est_ewma;
+			e->uclamp_min = -1;
+			e->uclamp_max = -1;
+			if (running)
+				e->running = 1;
+			else
+				e->running = 0;
+			bpf_ringbuf_submit(e, 0);
+		}
+	}
+
+	return 0;
+}
+
+SEC("raw_tp/pelt_cfs_tp")
+int BPF_PROG(handle_pelt_cfs, struct cfs_rq *cfs_rq)
+{
+	struct rq *rq = rq_of(cfs_rq);
+	int cpu = BPF_CORE_READ(rq, cpu);
+	bool root = cfs_rq_is_root(cfs_rq);
+	struct rq_pelt_event *e;
+	u64 cgroup_id = 0;
+
+	unsigned long uclamp_min = -1;
+	unsigned long uclamp_max = -1;
+
+	if (root) {
+		if (!sa_opts.load_avg_cpu && !sa_opts.runnable_avg_cpu && !sa_opts.util_avg_cpu)
+			return 0;
+
+		if (bpf_core_field_exists(rq->uclamp[UCLAMP_MIN].value))
+			uclamp_min = BPF_CORE_READ(rq, uclamp[UCLAMP_MIN].value);
+		if (bpf_core_field_exists(rq->uclamp[UCLAMP_MAX].value))
+			uclamp_max = BPF_CORE_READ(rq, uclamp[UCLAMP_MAX].value);
+
+		bpf_printk("cfs: [CPU%d] uclamp_min = %lu uclamp_max = %lu",
+			   cpu, uclamp_min, uclamp_max);
+	} else {
+		/*
+		 * Only the cgroups userspace asked for, there could be
+		 * thousands of them.
+		 */
+		if (!sa_opts.cgroup_pelt)
+			return 0;
+
+		cgroup_id = cfs_rq_cgroup_id(cfs_rq);
+		if (!cgroup_id || !cgroup_is_filtered(cgroup_id))
+			return 0;
+	}
+
+	e = bpf_ringbuf_reserve(&rq_pelt_rb, sizeof(*e), 0);
+	if (e) {
+		e->ts = bpf_ktime_get_boot_ns();
+		e->cpu = cpu;
+		e->type = PELT_TYPE_CFS;
+		e->cgroup_id = cgroup_id;
+		e->load_avg = BPF_CORE_READ(cfs_rq, avg.load_avg);
+		e->runnable_avg = BPF_CORE_READ(cfs_rq, avg.runnable_avg);
+		e->util_avg = BPF_CORE_READ(cfs_rq, avg.util_avg);
+		e->util_est_enqueued = -1;
+		e->util_est_ewma = -1;
+		e->uclamp_min = uclamp_min;
+		e->uclamp_max = uclamp_max;
+		bpf_ringbuf_submit(e, 0);
+	}
+
+	return 0;
+}
+
+SEC("raw_tp/sched_util_est_cfs_tp")
+int BPF_PROG(handle_util_est_cfs, struct cfs_rq *cfs_rq)
+{
+	if (cfs_rq_is_root(cfs_rq)) {
+		unsigned long util_est_enqueued, util_est_ewma;
+		struct rq *rq = rq_of(cfs_rq);
+		int cpu = BPF_CORE_READ(rq, cpu);
+		struct rq_pelt_event *e;
+
+
+		if (LINUX_KERNEL_VERSION < KERNEL_VERSION(6, 8, 0)) {
+			struct sched_avg__pre68 *avg_old = (void *)&cfs_rq->avg;
+			util_est_enqueued = BPF_PROBE_READ(avg_old, util_est.enqueued);
+			util_est_ewma = BPF_PROBE_READ(avg_old, util_est.ewma);
+		} else {
+			util_est_enqueued = BPF_CORE_READ(cfs_rq, avg.util_est);
+			util_est_ewma = 0;
+		}
+
+		bpf_printk("cfs: [CPU%d] util_est.enqueued = %lu util_est.ewma = %lu",
+			   cpu, util_est_enqueued, util_est_ewma);
+
+		e = bpf_ringbuf_reserve(&rq_pelt_rb, sizeof(*e), 0);
+		if (e) {
+			e->ts = bpf_ktime_get_boot_ns();
+			e->cpu = cpu;
+			e->cgroup_id = 0;
+			e->load_avg = -1;
+			e->runnable_avg = -1;
+			e->util_avg = -1;
+			e->util_est_enqueued = util_est_enqueued & ~UTIL_AVG_UNCHANGED;
+			e->util_est_ewma = util_est_ewma;
+			e->uclamp_min = -1;
+			e->uclamp_max = -1;
 			bpf_ringbuf_submit(e, 0);
 		}
 	}
 
-	return 0;
+	return 0;
+}
+
+SEC("raw_tp/pelt_rt_tp")
+int BPF_PROG(handle_pelt_rt, struct rq *rq)
+{
+	int cpu = BPF_CORE_READ(rq, cpu);
+	struct rq_pelt_event *e;
+
+	if (!bpf_core_field_exists(rq->avg_rt))
+		return 0;
+
+	unsigned long util_avg = BPF_CORE_READ(rq, avg_rt.util_avg);
+
+	e = bpf_ringbuf_reserve(&rq_pelt_rb, sizeof(*e), 0);
+	if (e) {
+		e->ts = bpf_ktime_get_boot_ns();
+		e->cpu = cpu;
+		e->type = PELT_TYPE_RT;
+		e->cgroup_id = 0;
+		e->load_avg = -1;
+		e->runnable_avg = -1;
+		e->util_avg = util_avg;
+		e->util_est_enqueued = -1;
+		e->util_est_ewma = -1;
+		e->uclamp_min = -1;
+		e->uclamp_max = -1;
+		bpf_ringbuf_submit(e, 0);
+	}
+
+	return 0;
+}
+
+SEC("raw_tp/pelt_dl_tp")
+int BPF_PROG(handle_pelt_dl, struct rq *rq)
+{
+	int cpu = BPF_CORE_READ(rq, cpu);
+	struct rq_pelt_event *e;
+
+	if (!bpf_core_field_exists(rq->avg_dl))
+		return 0;
+
+	unsigned long util_avg = BPF_CORE_READ(rq, avg_dl.util_avg);
+
+	e = bpf_ringbuf_reserve(&rq_pelt_rb, sizeof(*e), 0);
+	if (e) {
+		e->ts = bpf_ktime_get_boot_ns();
+		e->cpu = cpu;
+		e->type = PELT_TYPE_DL;
+		e->cgroup_id = 0;
+		e->load_avg = -1;
+		e->runnable_avg = -1;
+		e->util_avg = util_avg;
+		e->util_est_enqueued = -1;
+		e->util_est_ewma = -1;
+		e->uclamp_min = -1;
+		e->uclamp_max = -1;
+		bpf_ringbuf_submit(e, 0);
+	}
+
+	return 0;
+}
+
+SEC("raw_tp/pelt_irq_tp")
+int BPF_PROG(handle_pelt_irq, struct rq *rq)
+{
+	int cpu = BPF_CORE_READ(rq, cpu);
+	struct rq_pelt_event *e;
+
+	if (!bpf_core_field_exists(rq->avg_irq))
+		return 0;
+
+	unsigned long util_avg = BPF_CORE_READ(rq, avg_irq.util_avg);
+
+	e = bpf_ringbuf_reserve(&rq_pelt_rb, sizeof(*e), 0);
+	if (e) {
+		e->ts = bpf_ktime_get_boot_ns();
+		e->cpu = cpu;
+		e->type = PELT_TYPE_IRQ;
+		e->cgroup_id = 0;
+		e->load_avg = -1;
+		e->runnable_avg = -1;
+		e->util_avg = util_avg;
+		e->util_est_enqueued = -1;
+		e->util_est_ewma = -1;
+		e->uclamp_min = -1;
+		e->uclamp_max = -1;
+		bpf_ringbuf_submit(e, 0);
+	}
+
+	return 0;
+}
+
+SEC("raw_tp/pelt_thermal_tp")
+int BPF_PROG(handle_pelt_thermal, struct rq *rq)
+{
+	int cpu = BPF_CORE_READ(rq, cpu);
+	struct rq_pelt_event *e;
+
+	if (!bpf_core_field_exists(rq->avg_thermal))
+		return 0;
+
+	unsigned long load_avg = BPF_CORE_READ(rq, avg_thermal.load_avg);
+
+	e = bpf_ringbuf_reserve(&rq_pelt_rb, sizeof(*e), 0);
+	if (e) {
+		e->ts = bpf_ktime_get_boot_ns();
+		e->cpu = cpu;
+		e->type = PELT_TYPE_THERMAL;
+		e->cgroup_id = 0;
+		e->load_avg = load_avg;
+		e->runnable_avg = -1;
+		e->util_avg = -1;
+		e->util_est_enqueued = -1;
+		e->util_est_ewma = -1;
+		e->uclamp_min = -1;
+		e->uclamp_max = -1;
+		bpf_ringbuf_submit(e, 0);
+	}
+
+	return 0;
+}
+
+SEC("raw_tp/sched_update_nr_running_tp")
+int BPF_PROG(handle_sched_update_nr_running, struct rq *rq, int change)
+{
+	int cpu = BPF_CORE_READ(rq, cpu);
+	struct rq_nr_running_event *e;
+
+	int nr_running = BPF_CORE_READ(rq, nr_running);
+
+	bpf_printk("[CPU%d] nr_running = %d change = %d",
+		  cpu, nr_running, change);
+
+	e = bpf_ringbuf_reserve(&rq_nr_running_rb, sizeof(*e), 0);
+	if (e) {
+	       e->ts = bpf_ktime_get_boot_ns();
+	       e->cpu = cpu;
+	       e->nr_running = nr_running;
+	       e->change = change;
+	       bpf_ringbuf_submit(e, 0);
+	}
+
+	return 0;
+}
+
+SEC("raw_tp/sched_switch")
+int BPF_PROG(handle_sched_switch, bool preempt,
+	     struct task_struct *prev, struct task_struct *next)
+{
+	int cpu;
+	if (bpf_core_field_exists(prev->wake_cpu)) {
+		cpu = BPF_CORE_READ(prev, wake_cpu);
+	} else {
+		struct task_struct__old *prev_old = (void*)prev;
+		cpu = BPF_CORE_READ(prev_old, cpu);
+	}
+	struct sched_switch_event *e;
+	char comm[TASK_COMM_LEN];
+	int running = 1;
+	pid_t pid;
+
+	pid = BPF_CORE_READ(prev, pid);
+	bpf_map_delete_elem(&sched_switch, &pid);
+
+	BPF_CORE_READ_STR_INTO(&comm, prev, comm);
+	bpf_printk("[CPU%d] comm = %s running = %d",
+		   cpu, comm, 0);
+
+	pid = BPF_CORE_READ(next, pid);
+	bpf_map_update_elem(&sched_switch, &pid, &running, BPF_ANY);
+
+	BPF_CORE_READ_STR_INTO(&comm, next, comm);
+	bpf_printk("[CPU%d] comm = %s running = %d",
+		   cpu, comm, 1);
+
+	e = bpf_ringbuf_reserve(&sched_switch_rb, sizeof(*e), 0);
+	if (e) {
+		e->ts = bpf_ktime_get_boot_ns();
+		e->cpu = cpu;
+		e->pid = BPF_CORE_READ(prev, pid);
+		BPF_CORE_READ_STR_INTO(&e->comm, prev, comm);
+		e->running = 0;
+		bpf_ringbuf_submit(e, 0);
+	}
+
+	e = bpf_ringbuf_reserve(&sched_switch_rb, sizeof(*e), 0);
+	if (e) {
+		e->ts = bpf_ktime_get_boot_ns();
+		e->cpu = cpu;
+		e->pid = BPF_CORE_READ(next, pid);
+		BPF_CORE_READ_STR_INTO(&e->comm, next, comm);
+		e->running = 1;
+		bpf_ringbuf_submit(e, 0);
+	}
+
+	return 0;
+}
+
+SEC("raw_tp/sched_process_free")
+int BPF_PROG(handle_sched_process_free, struct task_struct *p)
+{
+	struct task_pelt_event *e;
+	char comm[TASK_COMM_LEN];
+	pid_t pid;
+	int cpu;
+
+	if (bpf_core_field_exists(p->wake_cpu)) {
+		cpu = BPF_CORE_READ(p, wake_cpu);
+	} else {
+		struct task_struct__old *p_old = (void *)p;
+		cpu = BPF_CORE_READ(p_old, cpu);
+	}
+	pid = BPF_CORE_READ(p, pid);
+	BPF_CORE_READ_STR_INTO(&comm, p, comm);
+
+	/* Only zero out tasks whose signals were emitted */
+	if (sa_opts.task_min_util || sa_opts.top_tasks) {
+		bool emitted = task_pelt_gate(p, -1, -1);
+
+		bpf_map_delete_elem(&task_util, &pid);
+		if (!emitted)
+			return 0;
+	}
+
+	e = bpf_ringbuf_reserve(&task_pelt_rb, sizeof(*e), 0);
+	if (e) {
+		e->ts = bpf_ktime_get_boot_ns();
+		e->cpu = cpu;
+		e->pid = pid;
+		BPF_CORE_READ_STR_INTO(&e->comm, p, comm);
+		e->load_avg = 0;
+		e->runnable_avg = 0;
+		e->util_avg = -0;
+		e->util_est_enqueued = 0;
+		e->util_est_ewma = 0;
+		e->uclamp_min = 0;
+		e->uclamp_max = 0;
+		e->running = 0;
+		bpf_ringbuf_submit(e, 0);
+	}
+
+	return 0;
+}
+
+SEC("raw_tp/cpu_frequency")
+int BPF_PROG(handle_cpu_frequency, unsigned int frequency, unsigned int cpu)
+{
+	struct freq_idle_event *e;
+	int idle_state = -1;
+
+	bpf_printk("[CPU%d] freq = %u idle_state = %u",
+		   cpu, frequency, idle_state);
+
+	e = bpf_ringbuf_reserve(&freq_idle_rb, sizeof(*e), 0);
+	if (e) {
+		e->ts = bpf_ktime_get_boot_ns();
+		e->cpu = cpu;
+		e->frequency = frequency;
+		e->idle_state = idle_state;
+		e->idle_miss = 0;
+		bpf_ringbuf_submit(e, 0);
+	}
+
+	return 0;
+}
+
+SEC("raw_tp/cpu_idle")
+int BPF_PROG(handle_cpu_idle, unsigned int state, unsigned int cpu)
+{
+	int idle_state = (int)state;
+	unsigned int frequency = 0;
+	struct freq_idle_event *e;
+
+	bpf_printk("[CPU%d] freq = %u idle_state = %u",
+		   cpu, frequency, idle_state);
+
+	e = bpf_ringbuf_reserve(&freq_idle_rb, sizeof(*e), 0);
+	if (e) {
+		e->ts = bpf_ktime_get_boot_ns();
+		e->cpu = cpu;
+		e->frequency = frequency;
+		e->idle_state = idle_state;
+		e->idle_miss = 0;
+		bpf_ringbuf_submit(e, 0);
+	}
+
+	return 0;
+}
+
+SEC("raw_tp/cpu_idle_miss")
+int BPF_PROG(handle_cpu_idle_miss, unsigned int cpu,
+	     unsigned int state, bool below)
+{
+	int idle_state = (int)state;
+	unsigned int frequency = 0;
+	struct freq_idle_event *e;
+
+	bpf_printk("[CPU%d] freq = %u idle_state = %u",
+		   cpu, frequency, idle_state);
+
+	e = bpf_ringbuf_reserve(&freq_idle_rb, sizeof(*e), 0);
+	if (e) {
+		e->ts = bpf_ktime_get_boot_ns();
+		e->cpu = cpu;
+		e->frequency = frequency;
+		e->idle_state = idle_state;
+		e->idle_miss = below ? -1 : 1;
+		bpf_ringbuf_submit(e, 0);
+	}
+
+	return 0;
+}
+
+SEC("raw_tp/softirq_entry")
+int BPF_PROG(handle_softirq_entry, unsigned int vec_nr)
+{
+	struct irq_entry_ts *entry;
+	int zero = 0;
+
+	entry = bpf_map_lookup_elem(&irq_entry, &zero);
+	if (entry)
+		entry->softirq = bpf_ktime_get_boot_ns();
+
+	return 0;
+}
+
+SEC("raw_tp/softirq_exit")
+int BPF_PROG(handle_softirq_exit, unsigned int vec_nr)
+{
+	u64 exit_ts = bpf_ktime_get_boot_ns();
+	struct irq_entry_ts *entry;
+	u64 duration;
+	struct log2_hist *hist;
+	int zero = 0;
+	int key = vec_nr;
+
+	entry = bpf_map_lookup_elem(&irq_entry, &zero);
+	if (!entry || !entry->softirq)
+		return 0;
+
+	duration = exit_ts - entry->softirq;
+	entry->softirq = 0;
+
+	hist = bpf_map_lookup_elem(&softirq_hist, &key);
+	if (hist)
+		hist_add(hist, duration);
+
+	if (sa_opts.softirq_threshold && duration >= sa_opts.softirq_threshold)
+		capture_stack(ctx, STACK_SOURCE_SOFTIRQ, vec_nr, duration, exit_ts);
+
+	return 0;
+}
+
+SEC("raw_tp/irq_handler_entry")
+int BPF_PROG(handle_irq_handler_entry, int irq, struct irqaction *action)
+{
+	struct irq_entry_ts *entry;
+	int zero = 0;
+
+	entry = bpf_map_lookup_elem(&irq_entry, &zero);
+	if (entry)
+		entry->hardirq = bpf_ktime_get_boot_ns();
+
+	return 0;
+}
+
+SEC("raw_tp/irq_handler_exit")
+int BPF_PROG(handle_irq_handler_exit, int irq, struct irqaction *action, int ret)
+{
+	u64 exit_ts = bpf_ktime_get_boot_ns();
+	struct irq_entry_ts *entry;
+	struct log2_hist *hist;
+	int zero = 0;
+
+	entry = bpf_map_lookup_elem(&irq_entry, &zero);
+	if (!entry || !entry->hardirq)
+		return 0;
+
+	hist = bpf_map_lookup_elem(&hardirq_hist, &irq);
+	if (!hist) {
+		/* First time we see this irq, save its name for userspace */
+		struct irq_name name = {};
+
+		bpf_probe_read_kernel_str(&name.name, sizeof(name.name),
+					  BPF_CORE_READ(action, name));
+		bpf_map_update_elem(&hardirq_name, &irq, &name, BPF_NOEXIST);
+
+		hist = lookup_or_init_hist(&hardirq_hist, &irq);
+	}
+	if (hist)
+		hist_add(hist, exit_ts - entry->hardirq);
+
+	entry->hardirq = 0;
+
+	return 0;
+}
+
+/*
+ * Only pass on overloaded, overutilized and misfit_task_load if they changed
+ * since they were last emitted, -1 otherwise. The state is only updated when
+ * lb_cpu balances itself, so each slot has a single writer.
+ */
+static inline void lb_set_changed(struct lb_event *e, int lb_cpu,
+				  unsigned int overloaded, unsigned int overutilized,
+				  unsigned long misfit_task_load)
+{
+	struct lb_cpu_state *cpu_state;
+
+	e->overloaded = -1;
+	e->overutilized = -1;
+	e->misfit_task_load = -1;
+
+	if (e->this_cpu != lb_cpu)
+		return;
+
+	cpu_state = bpf_map_lookup_elem(&lb_cpu_state, &lb_cpu);
+	if (!cpu_state)
+		return;
+
+	if (!cpu_state->valid || cpu_state->overloaded != overloaded)
+		e->overloaded = overloaded;
+	if (!cpu_state->valid || cpu_state->overutilized != overutilized)
+		e->overutilized = overutilized;
+	cpu_state->overloaded = overloaded;
+	cpu_state->overutilized = overutilized;
+
+	if (misfit_task_load != -1) {
+		if (!cpu_state->valid || cpu_state->misfit_task_load != misfit_task_load)
+			e->misfit_task_load = misfit_task_load;
+		cpu_state->misfit_task_load = misfit_task_load;
+	}
+
+	cpu_state->valid = true;
+}
+
+SEC("kprobe/_nohz_idle_balance.isra.0")
+int BPF_PROG(handle_nohz_idle_balance_entry, struct rq *rq)
+{
+	int this_cpu = bpf_get_smp_processor_id();
+	int lb_cpu = BPF_CORE_READ(rq, cpu);
+	u64 ts = bpf_ktime_get_boot_ns();
+	struct lb_event *e;
+
+	int key = LB_NOHZ_IDLE_BALANCE << 16 | this_cpu;
+	bpf_map_update_elem(&lb_map, &key, &lb_cpu, BPF_ANY);
+
+	e = bpf_ringbuf_reserve(&lb_rb, sizeof(*e), 0);
+	if (e) {
+		e->ts = ts;
+		e->this_cpu = this_cpu;
+		e->lb_cpu = lb_cpu;
+		e->phase = LB_NOHZ_IDLE_BALANCE;
+		e->entry = true;
+		lb_set_changed(e, lb_cpu,
+			       BPF_CORE_READ(rq, rd, overload),
+			       BPF_CORE_READ(rq, rd, overutilized), -1);
+		bpf_ringbuf_submit(e, 0);
+	}
+
+	return 0;
+}
+
+SEC("kretprobe/_nohz_idle_balance.isra.0")
+int BPF_PROG(handle_nohz_idle_balance_exit)
+{
+	int this_cpu = bpf_get_smp_processor_id();
+	u64 ts = bpf_ktime_get_boot_ns();
+	struct lb_event *e;
+
+	int key = LB_NOHZ_IDLE_BALANCE << 16 | this_cpu;
+	int *lb_cpu = bpf_map_lookup_elem(&lb_map, &key);
+	if (!lb_cpu)
+		return 0;
+	bpf_map_delete_elem(&lb_map, &key);
+
+	e = bpf_ringbuf_reserve(&lb_rb, sizeof(*e), 0);
+	if (e) {
+		e->ts = ts;
+		e->this_cpu = this_cpu;
+		e->lb_cpu = *lb_cpu;
+		e->phase = LB_NOHZ_IDLE_BALANCE;
+		e->entry = false;
+		e->overloaded = -1;
+		e->overutilized = -1;
+		e->misfit_task_load = -1;
+		bpf_ringbuf_submit(e, 0);
+	}
+
+	return 0;
+}
+
+SEC("kprobe/run_rebalance_domains")
+int BPF_PROG(handle_run_rebalance_domains_entry)
+{
+	int this_cpu = bpf_get_smp_processor_id();
+	u64 ts = bpf_ktime_get_boot_ns();
+	struct lb_event *e;
+
+	e = bpf_ringbuf_reserve(&lb_rb, sizeof(*e), 0);
+	if (e) {
+		e->ts = ts;
+		e->this_cpu = this_cpu;
+		e->lb_cpu = this_cpu;
+		e->phase = LB_RUN_REBALANCE_DOMAINS;
+		e->entry = true;
+		e->overloaded = -1;
+		e->overutilized = -1;
+		e->misfit_task_load = -1;
+		bpf_ringbuf_submit(e, 0);
+	}
+
+	return 0;
+}
+
+SEC("kretprobe/run_rebalance_domains")
+int BPF_PROG(handle_run_rebalance_domains_exit)
+{
+	int this_cpu = bpf_get_smp_processor_id();
+	u64 ts = bpf_ktime_get_boot_ns();
+	struct lb_event *e;
+
+	e = bpf_ringbuf_reserve(&lb_rb, sizeof(*e), 0);
+	if (e) {
+		e->ts = ts;
+		e->this_cpu = this_cpu;
+		e->lb_cpu = this_cpu;
+		e->phase = LB_RUN_REBALANCE_DOMAINS;
+		e->entry = false;
+		e->overloaded = -1;
+		e->overutilized = -1;
+		e->misfit_task_load = -1;
+		bpf_ringbuf_submit(e, 0);
+	}
+
+	return 0;
+}
+
+/*
+ * Emit the sched domains of rq->cpu the first time we see them or when they
+ * get rebuilt, and balance_interval of the levels that changed otherwise.
+ */
+static void gen_sched_domain_stats(struct rq *rq, enum cpu_idle_type idle, u64 ts)
+{
+	struct sched_domain *sd = BPF_CORE_READ(rq, sd);
+	int cpu = BPF_CORE_READ(rq, cpu);
+	struct lb_cpu_state *cpu_state;
+	struct lb_sd_stats *sd_stats;
+	struct lb_sd_event *e;
+	int i = 0;
+
+	bool sched_idle = BPF_CORE_READ(rq, nr_running) == BPF_CORE_READ(rq, cfs.idle_h_nr_running);
+	sched_idle = sched_idle && BPF_CORE_READ(rq, nr_running);
+	bool busy = idle != CPU_IDLE && !sched_idle;
+
+	cpu_state = bpf_map_lookup_elem(&lb_cpu_state, &cpu);
+	if (!cpu_state)
+		return;
+
+	e = bpf_ringbuf_reserve(&lb_sd_rb, sizeof(*e), 0);
+	if (!e)
+		return;
+
+	e->ts = ts;
+	sd_stats = &e->sd_stats;
+	sd_stats->cpu = cpu;
+	sd_stats->topology = sd != cpu_state->sd;
+	sd_stats->changed = 0;
+
+	while (sd && i < MAX_SD_LEVELS) {
+		unsigned int interval = BPF_CORE_READ(sd, balance_interval);
+		if (busy)
+			interval *= BPF_CORE_READ(sd, busy_factor);
+
+		sd_stats->level[i] = BPF_CORE_READ(sd, level);
+		sd_stats->balance_interval[i] = interval;
+
+		if (sd_stats->topology || cpu_state->balance_interval[i] != interval)
+			sd_stats->changed |= 1 << i;
+		cpu_state->balance_interval[i] = interval;
+
+		if (sd_stats->topology) {
+			sd_stats->span_weight[i] = BPF_CORE_READ(sd, span_weight);
+			sd_stats->name[i][0] = '\0';
+			if (bpf_core_field_exists(sd->name))
+				bpf_probe_read_kernel_str(sd_stats->name[i], SD_NAME_LEN,
+							  BPF_CORE_READ(sd, name));
+		}
+
+		sd = BPF_CORE_READ(sd, parent);
+		i++;
+	}
+
+	if (i < MAX_SD_LEVELS) {
+		sd_stats->level[i] = -1;
+		sd_stats->balance_interval[i] = 0;
+	}
+
+	cpu_state->sd = BPF_CORE_READ(rq, sd);
+
+	if (sd_stats->changed)
+		bpf_ringbuf_submit(e, 0);
+	else
+		bpf_ringbuf_discard(e, 0);
+}
+
+SEC("kprobe/rebalance_domains")
+int BPF_PROG(handle_rebalance_domains_entry, struct rq *rq, enum cpu_idle_type idle)
+{
+	int this_cpu = bpf_get_smp_processor_id();
+	int lb_cpu = BPF_CORE_READ(rq, cpu);
+	u64 ts = bpf_ktime_get_boot_ns();
+	struct lb_event *e;
+
+	int key = LB_REBALANCE_DOMAINS << 16 | this_cpu;
+	bpf_map_update_elem(&lb_map, &key, &lb_cpu, BPF_ANY);
+
+	e = bpf_ringbuf_reserve(&lb_rb, sizeof(*e), 0);
+	if (e) {
+		e->ts = ts;
+		e->this_cpu = this_cpu;
+		e->lb_cpu = lb_cpu;
+		e->phase = LB_REBALANCE_DOMAINS;
+		e->entry = true;
+		lb_set_changed(e, lb_cpu,
+			       BPF_CORE_READ(rq, rd, overload),
+			       BPF_CORE_READ(rq, rd, overutilized),
+			       BPF_CORE_READ(rq, misfit_task_load));
+		bpf_ringbuf_submit(e, 0);
+	}
+
+	gen_sched_domain_stats(rq, idle, ts);
+
+	return 0;
+}
+
+SEC("kretprobe/rebalance_domains")
+int BPF_PROG(handle_rebalance_domains_exit)
+{
+	int this_cpu = bpf_get_smp_processor_id();
+	u64 ts = bpf_ktime_get_boot_ns();
+	struct lb_event *e;
+
+	int key = LB_REBALANCE_DOMAINS << 16 | this_cpu;
+	int *lb_cpu = bpf_map_lookup_elem(&lb_map, &key);
+	if (!lb_cpu)
+		return 0;
+	bpf_map_delete_elem(&lb_map, &key);
+
+	e = bpf_ringbuf_reserve(&lb_rb, sizeof(*e), 0);
+	if (e) {
+		e->ts = ts;
+		e->this_cpu = this_cpu;
+		e->lb_cpu = *lb_cpu;
+		e->phase = LB_REBALANCE_DOMAINS;
+		e->entry = false;
+		e->overloaded = -1;
+		e->overutilized = -1;
+		e->misfit_task_load = -1;
+		bpf_ringbuf_submit(e, 0);
+	}
+
+	return 0;
+}
+
+static inline void lb_phase_enter(enum lb_phases phase, struct rq *rq)
+{
+	struct lb_phase_entry *entry;
+	int key = phase, zero = 0;
+	u64 *nr_load_balance;
+
+	entry = bpf_map_lookup_elem(&lb_phase_entry, &key);
+	nr_load_balance = bpf_map_lookup_elem(&lb_nr_load_balance, &zero);
+	if (!entry || !nr_load_balance)
+		return;
+
+	entry->ts = bpf_ktime_get_boot_ns();
+	entry->nr_load_balance = *nr_load_balance;
+	entry->lb_cpu = BPF_CORE_READ(rq, cpu);
+	entry->overloaded = BPF_CORE_READ(rq, rd, overload);
+	entry->overutilized = BPF_CORE_READ(rq, rd, overutilized);
+	entry->misfit_task_load = BPF_CORE_READ(rq, misfit_task_load);
+}
+
+static inline void lb_phase_exit(void *ctx, enum lb_phases phase)
+{
+	int this_cpu = bpf_get_smp_processor_id();
+	u64 ts = bpf_ktime_get_boot_ns();
+	struct lb_phase_entry *entry;
+	int key = phase, zero = 0;
+	struct log2_hist *hist;
+	u64 *nr_load_balance;
+	struct lb_event *e;
+	bool lb_ran;
+	u64 duration;
+
+	entry = bpf_map_lookup_elem(&lb_phase_entry, &key);
+	nr_load_balance = bpf_map_lookup_elem(&lb_nr_load_balance, &zero);
+	if (!entry || !nr_load_balance || !entry->ts)
+		return;
+
+	duration = ts - entry->ts;
+	lb_ran = *nr_load_balance != entry->nr_load_balance;
+
+	hist = bpf_map_lookup_elem(&lb_phase_hist, &key);
+	if (hist)
+		hist_add(hist, duration);
+
+	if (duration < sa_opts.load_balance_threshold && !lb_ran) {
+		entry->ts = 0;
+		return;
+	}
+
+	if (sa_opts.load_balance_threshold && duration >= sa_opts.load_balance_threshold)
+		capture_stack(ctx, STACK_SOURCE_LOAD_BALANCE, phase, duration, ts);
+
+	e = bpf_ringbuf_reserve(&lb_rb, sizeof(*e), 0);
+	if (e) {
+		e->ts = entry->ts;
+		e->this_cpu = this_cpu;
+		e->lb_cpu = entry->lb_cpu;
+		e->phase = phase;
+		e->entry = true;
+		lb_set_changed(e, entry->lb_cpu, entry->overloaded,
+			       entry->overutilized, entry->misfit_task_load);
+		bpf_ringbuf_submit(e, 0);
+	}
+
+	e = bpf_ringbuf_reserve(&lb_rb, sizeof(*e), 0);
+	if (e) {
+		e->ts = ts;
+		e->this_cpu = this_cpu;
+		e->lb_cpu = entry->lb_cpu;
+		e->phase = phase;
+		e->entry = false;
+		e->overloaded = -1;
+		e->overutilized = -1;
+		e->misfit_task_load = -1;
+		bpf_ringbuf_submit(e, 0);
+	}
+
+	entry->ts = 0;
+}
+
+SEC("kprobe/balance_fair")
+int BPF_PROG(handle_balance_fair_entry, struct rq *rq)
+{
+	lb_phase_enter(LB_BALANCE_FAIR, rq);
+
+	return 0;
+}
+
+SEC("kretprobe/balance_fair")
+int BPF_PROG(handle_balance_fair_exit)
+{
+	lb_phase_exit(ctx, LB_BALANCE_FAIR);
+
+	return 0;
+}
+
+SEC("kprobe/pick_next_task_fair")
+int BPF_PROG(handle_pick_next_task_fair_entry, struct rq *rq)
+{
+	lb_phase_enter(LB_PICK_NEXT_TASK_FAIR, rq);
+
+	return 0;
+}
+
+SEC("kretprobe/pick_next_task_fair")
+int BPF_PROG(handle_pick_next_task_fair_exit)
+{
+	lb_phase_exit(ctx, LB_PICK_NEXT_TASK_FAIR);
+
+	return 0;
+}
+
+SEC("kprobe/newidle_balance")
+int BPF_PROG(handle_newidle_balance_entry, struct rq *rq)
+{
+	lb_phase_enter(LB_NEWIDLE_BALANCE, rq);
+
+	return 0;
+}
+
+SEC("kretprobe/newidle_balance")
+int BPF_PROG(handle_newidle_balance_exit)
+{
+	lb_phase_exit(ctx, LB_NEWIDLE_BALANCE);
+
+	return 0;
+}
+
+SEC("kprobe/load_balance")
+int BPF_PROG(handle_load_balance_entry, int lb_cpu, struct rq *lb_rq,
+	     struct sched_domain *sd, enum cpu_idle_type idle)
+{
+	int this_cpu = bpf_get_smp_processor_id();
+	u64 ts = bpf_ktime_get_boot_ns();
+	u64 *nr_load_balance;
+	struct lb_event *e;
+	int zero = 0;
+
+	int key = LB_LOAD_BALANCE << 16 | this_cpu;
+	bpf_map_update_elem(&lb_map, &key, &lb_cpu, BPF_ANY);
+
+	/* Let the phases we're nested in know they must be emitted */
+	nr_load_balance = bpf_map_lookup_elem(&lb_nr_load_balance, &zero);
+	if (nr_load_balance)
+		(*nr_load_balance)++;
+
+	e = bpf_ringbuf_reserve(&lb_rb, sizeof(*e), 0);
+	if (e) {
+		e->ts = ts;
+		e->this_cpu = this_cpu;
+		e->lb_cpu = lb_cpu;
+		e->phase = LB_LOAD_BALANCE;
+		e->entry = true;
+		lb_set_changed(e, lb_cpu,
+			       BPF_CORE_READ(lb_rq, rd, overload),
+			       BPF_CORE_READ(lb_rq, rd, overutilized),
+			       BPF_CORE_READ(lb_rq, misfit_task_load));
+		bpf_ringbuf_submit(e, 0);
+	}
+
+	return 0;
+}
+
+SEC("kretprobe/load_balance")
+int BPF_PROG(handle_load_balance_exit)
+{
+	int this_cpu = bpf_get_smp_processor_id();
+	u64 ts = bpf_ktime_get_boot_ns();
+	struct lb_event *e;
+
+	int key = LB_LOAD_BALANCE << 16 | this_cpu;
+	int *lb_cpu = bpf_map_lookup_elem(&lb_map, &key);
+	if (!lb_cpu)
+		return 0;
+	bpf_map_delete_elem(&lb_map, &key);
+
+	e = bpf_ringbuf_reserve(&lb_rb, sizeof(*e), 0);
+	if (e) {
+		e->ts = ts;
+		e->this_cpu = this_cpu;
+		e->lb_cpu = *lb_cpu;
+		e->phase = LB_LOAD_BALANCE;
+		e->entry = false;
+		e->overloaded = -1;
+		e->overutilized = -1;
+		e->misfit_task_load = -1;
+		bpf_ringbuf_submit(e, 0);
+	}
+
+	return 0;
+}
+
+SEC("fentry/load_balance")
+int BPF_PROG(handle_lb_stats_entry)
+{
+	struct lb_entry *entry;
+	int zero = 0;
+
+	entry = bpf_map_lookup_elem(&lb_entry, &zero);
+	if (entry)
+		entry->ts = bpf_ktime_get_boot_ns();
+
+	return 0;
+}
+
+SEC("fexit/load_balance")
+int BPF_PROG(handle_lb_stats_exit, int this_cpu, struct rq *this_rq,
+	     struct sched_domain *sd, enum cpu_idle_type idle,
+	     int *continue_balancing, int ld_moved)
+{
+	int level = BPF_CORE_READ(sd, level);
+	struct lb_entry *entry;
+	struct lb_stats *stats;
+	int zero = 0;
+
+	entry = bpf_map_lookup_elem(&lb_entry, &zero);
+	if (!entry || !entry->ts)
+		return 0;
+
+	stats = bpf_map_lookup_elem(&lb_stats, &level);
+	if (stats) {
+		stats->attempts++;
+		stats->time += bpf_ktime_get_boot_ns() - entry->ts;
+		if (ld_moved > 0) {
+			stats->success++;
+			stats->tasks_moved += ld_moved;
+		}
+	}
+
+	entry->ts = 0;
+
+	return 0;
+}
+
+SEC("fentry/detach_tasks")
+int BPF_PROG(handle_detach_tasks_entry, struct lb_env *env)
+{
+	struct lb_entry *entry;
+	int zero = 0;
+
+	entry = bpf_map_lookup_elem(&lb_entry, &zero);
+	if (entry)
+		entry->imbalance = BPF_CORE_READ(env, imbalance);
+
+	return 0;
+}
+
+/*
+ * detach_tasks() consumes env->imbalance as it detaches tasks, in the unit of
+ * env->migration_type.
+ */
+SEC("fexit/detach_tasks")
+int BPF_PROG(handle_detach_tasks_exit, struct lb_env *env, int detached)
+{
+	unsigned int type = BPF_CORE_READ(env, migration_type);
+	int level = BPF_CORE_READ(env, sd, level);
+	struct lb_busiest_key key = {
+		.level = level,
+		.cpu = BPF_CORE_READ(env, src_cpu),
+	};
+	struct lb_entry *entry;
+	struct lb_stats *stats;
+	u64 *count, moved;
+	int zero = 0;
+
+	entry = bpf_map_lookup_elem(&lb_entry, &zero);
+	stats = bpf_map_lookup_elem(&lb_stats, &level);
+	if (!entry || !stats || type >= NR_LB_MIGRATION_TYPES)
+		return 0;
+
+	stats->detach[type]++;
+	stats->imbalance_pulled[type] += entry->imbalance - BPF_CORE_READ(env, imbalance);
+
+	if (detached <= 0)
+		return 0;
+
+	count = bpf_map_lookup_elem(&lb_busiest, &key);
+	if (count) {
+		__sync_fetch_and_add(count, detached);
+	} else {
+		moved = detached;
+		bpf_map_update_elem(&lb_busiest, &key, &moved, BPF_NOEXIST);
+	}
+
+	return 0;
+}
+
+static inline void ipi_stamp(int from_cpu, int target_cpu, void *callback, u64 ts)
+{
+	struct ipi_pending *pending;
+	u64 old, expire;
+
+	/*
+	 * Call function IPIs are matched on csd_function_entry, the ones
+	 * without a callback on the arch reschedule IPI entry.
+	 */
+	if (callback) {
+		pending = bpf_map_lookup_elem(&ipi_pending, &target_cpu);
+		expire = IPI_PENDING_EXPIRE;
+	} else {
+		pending = bpf_map_lookup_elem(&ipi_resched_pending, &target_cpu);
+		expire = IPI_RESCHED_EXPIRE;
+	}
+	if (!pending)
+		return;
+
+	/* Don't let a stamp that was never consumed block all later ones */
+	old = pending->ts;
+	if (old > IPI_PENDING_BUSY && ts > old && ts - old > expire)
+		__sync_val_compare_and_swap(&pending->ts, old, 0);
+
+	/* Keep the oldest one, that's what the target will see first */
+	if (__sync_val_compare_and_swap(&pending->ts, 0, IPI_PENDING_BUSY))
+		return;
+
+	pending->callback = callback;
+	pending->from_cpu = from_cpu;
+	/* Publish ts only once the other fields are written */
+	__sync_lock_test_and_set(&pending->ts, ts);
+}
+
+static inline void ipi_account(int from_cpu, int target_cpu,
+			       void *callsite, void *callback, u64 ts)
+{
+	struct ipi_key key = {
+		.from_cpu = from_cpu,
+		.target_cpu = target_cpu,
+		.callback = callback,
+	};
+	struct ipi_event *e;
+	u64 *count, one = 1;
+	int zero = 0;
+
+	if (sa_opts.ipi_latency)
+		ipi_stamp(from_cpu, target_cpu, callback, ts);
+
+	if (!sa_opts.ipi)
+		return;
+
+	count = bpf_map_lookup_elem(&ipi_count, &key);
+	if (count)
+		__sync_fetch_and_add(count, 1);
+	else if (bpf_map_update_elem(&ipi_count, &key, &one, BPF_NOEXIST))
+		__sync_fetch_and_add(&ipi_count_drops, 1);
+
+	/* Only emit 1 in ipi_sample IPIs if requested */
+	if (!sa_opts.ipi_sample)
+		return;
+
+	count = bpf_map_lookup_elem(&ipi_sample, &zero);
+	if (!count || (*count)++ % sa_opts.ipi_sample)
+		return;
+
+	e = bpf_ringbuf_reserve(&ipi_rb, sizeof(*e), 0);
+	if (e) {
+		e->ts = ts;
+		e->from_cpu = from_cpu;
+		e->target_cpu = target_cpu;
+		e->callsite = callsite;
+		e->callback = callback;
+		bpf_ringbuf_submit(e, 0);
+	}
+}
+
+SEC("raw_tp/ipi_send_cpu")
+int BPF_PROG(handle_ipi_send_cpu, int cpu, void *callsite, void *callback)
+{
+	u64 ts = bpf_ktime_get_boot_ns();
+
+	ipi_account(bpf_get_smp_processor_id(), cpu, callsite, callback, ts);
+
+	return 0;
+}
+
+SEC("raw_tp/ipi_send_cpumask")
+int BPF_PROG(handle_ipi_send_cpumask, struct cpumask *cpumask, void *callsite, void *callback)
+{
+	int from_cpu = bpf_get_smp_processor_id();
+	u64 ts = bpf_ktime_get_boot_ns();
+	unsigned long bits;
+	int w, i;
+
+	/* The mask can be allocated for nr_cpu_ids only, don't read past it */
+	for (w = 0; w < MAX_CPUS / 64; w++) {
+		if (w * 64 >= nr_cpu_ids)
+			break;
+		if (bpf_probe_read_kernel(&bits, sizeof(bits), &cpumask->bits[w]))
+			break;
+		if (nr_cpu_ids - w * 64 < 64)
+			bits &= (1UL << (nr_cpu_ids - w * 64)) - 1;
+
+		for (i = 0; i < 64 && bits; i++) {
+			ipi_account(from_cpu, w * 64 + log2_u64(bits & -bits),
+				    callsite, callback, ts);
+			bits &= bits - 1;
+		}
+	}
+
+	return 0;
+}
+
+SEC("raw_tp/sched_waking")
+int BPF_PROG(handle_wakeup_latency_waking, struct task_struct *p)
+{
+	struct task_ctx *tctx;
+
+	tctx = bpf_task_storage_get(&task_ctx_map, p, 0,
+				    BPF_LOCAL_STORAGE_GET_F_CREATE);
+	if (!tctx)
+		return 0;
+
+	tctx->waking_ts = bpf_ktime_get_boot_ns();
+
+	return 0;
+}
+
+SEC("raw_tp/sched_wakeup_new")
+int BPF_PROG(handle_wakeup_latency_wakeup_new, struct task_struct *p)
+{
+	struct task_ctx *tctx;
+
+	tctx = bpf_task_storage_get(&task_ctx_map, p, 0,
+				    BPF_LOCAL_STORAGE_GET_F_CREATE);
+	if (!tctx)
+		return 0;
+
+	tctx->waking_ts = bpf_ktime_get_boot_ns();
+
+	return 0;
+}
+
+SEC("raw_tp/sched_switch")
+int BPF_PROG(handle_wakeup_latency_switch, bool preempt,
+	     struct task_struct *prev, struct task_struct *next)
+{
+	int cpu = bpf_get_smp_processor_id();
+	u64 ts = bpf_ktime_get_boot_ns();
+	struct wakeup_lat_event *e;
+	struct log2_hist *hist;
+	struct task_ctx *tctx;
+	pid_t pid, tgid;
+	u64 latency;
+	int zero = 0;
+
+	/*
+	 * If prev was woken up while still running, it never waited. Drop the
+	 * stale timestamp so it doesn't get accounted the next time it runs.
+	 */
+	tctx = bpf_task_storage_get(&task_ctx_map, prev, 0, 0);
+	if (tctx)
+		tctx->waking_ts = 0;
+
+	pid = BPF_CORE_READ(next, pid);
+	if (!pid)
+		return 0;
+
+	tctx = bpf_task_storage_get(&task_ctx_map, next, 0, 0);
+	if (!tctx || !tctx->waking_ts)
+		return 0;
+
+	latency = ts - tctx->waking_ts;
+	tctx->waking_ts = 0;
+
+	tgid = BPF_CORE_READ(next, tgid);
+
+	hist = bpf_map_lookup_elem(&wakeup_lat_cpu_hist, &zero);
+	if (hist)
+		hist_add(hist, latency / 1000);
+
+	hist = lookup_or_init_hist(&wakeup_lat_tgid_hist, &tgid);
+	if (hist)
+		hist_add(hist, latency / 1000);
+
+	bpf_printk("[CPU%d] pid = %d wakeup latency = %llu",
+		   cpu, pid, latency);
+
+	if (!sa_opts.wakeup_latency_threshold ||
+	    latency < sa_opts.wakeup_latency_threshold)
+		return 0;
+
+	/* Where prev was when it finally let next run */
+	capture_stack(ctx, STACK_SOURCE_WAKEUP_LATENCY, pid, latency, ts);
+
+	e = bpf_ringbuf_reserve(&wakeup_lat_rb, sizeof(*e), 0);
+	if (e) {
+		e->ts = ts;
+		e->cpu = cpu;
+		e->pid = pid;
+		e->tgid = tgid;
+		BPF_CORE_READ_STR_INTO(&e->comm, next, comm);
+		e->latency = latency;
+		bpf_ringbuf_submit(e, 0);
+	}
+
+	return 0;
+}
+
+/*
+ * Keep the first timestamp if the task was already waiting. ie: woken up while
+ * still sitting on the runqueue. A migration only restarts the wait on the
+ * new runqueue, the task keeps waiting since its original enqueue.
+ */
+static inline void runq_wait_enqueue(struct task_struct *p, u64 ts, bool migrate)
+{
+	struct task_ctx *tctx;
+
+	tctx = bpf_task_storage_get(&task_ctx_map, p, 0,
+				    BPF_LOCAL_STORAGE_GET_F_CREATE);
+	if (!tctx)
+		return;
+
+	if (!tctx->enqueue_ts) {
+		tctx->enqueue_ts = ts;
+		tctx->rq_enqueue_ts = ts;
+	} else if (migrate) {
+		tctx->rq_enqueue_ts = ts;
+	}
+}
+
+SEC("raw_tp/sched_wakeup")
+int BPF_PROG(handle_runq_wait_wakeup, struct task_struct *p)
+{
+	runq_wait_enqueue(p, bpf_ktime_get_boot_ns(), false);
+
+	return 0;
+}
+
+SEC("raw_tp/sched_wakeup_new")
+int BPF_PROG(handle_runq_wait_wakeup_new, struct task_struct *p)
+{
+	runq_wait_enqueue(p, bpf_ktime_get_boot_ns(), false);
+
+	return 0;
+}
+
+SEC("raw_tp/sched_migrate_task")
+int BPF_PROG(handle_runq_wait_migrate_task, struct task_struct *p, int dest_cpu)
+{
+	/*
+	 * Only runnable tasks moved between runqueues matter here, sleeping
+	 * tasks are migrated as part of their wakeup. Queued tasks are marked
+	 * TASK_ON_RQ_MIGRATING before set_task_cpu() emits the tracepoint.
+	 */
+	if (BPF_CORE_READ(p, on_rq) != TASK_ON_RQ_MIGRATING)
+		return 0;
+
+	runq_wait_enqueue(p, bpf_ktime_get_boot_ns(), true);
+
+	return 0;
+}
+
+SEC("raw_tp/sched_switch")
+int BPF_PROG(handle_runq_wait_switch, bool preempt,
+	     struct task_struct *prev, struct task_struct *next)
+{
+	u64 ts = bpf_ktime_get_boot_ns();
+	struct runq_wait_stats *stats;
+	struct log2_hist *hist;
+	struct task_ctx *tctx;
+	u64 wait, rq_wait;
+	int zero = 0;
+	pid_t pid;
+
+	/*
+	 * prev is still runnable if it got preempted, even after it set its
+	 * state to sleep, it starts waiting on the runqueue now. Otherwise it's
+	 * going to sleep.
+	 */
+	if (BPF_CORE_READ(prev, pid)) {
+		bool runnable = preempt || !get_task_state(prev);
+
+		tctx = bpf_task_storage_get(&task_ctx_map, prev, 0,
+					    runnable ? BPF_LOCAL_STORAGE_GET_F_CREATE : 0);
+		if (tctx) {
+			tctx->enqueue_ts = runnable ? ts : 0;
+			tctx->rq_enqueue_ts = tctx->enqueue_ts;
+		}
+	}
+
+	pid = BPF_CORE_READ(next, pid);
+	if (!pid)
+		return 0;
+
+	tctx = bpf_task_storage_get(&task_ctx_map, next, 0, 0);
+	if (!tctx || !tctx->enqueue_ts)
+		return 0;
+
+	wait = (ts - tctx->enqueue_ts) / 1000;
+	rq_wait = wait;
+	if (tctx->rq_enqueue_ts > tctx->enqueue_ts)
+		rq_wait = (ts - tctx->rq_enqueue_ts) / 1000;
+	tctx->enqueue_ts = 0;
+	tctx->rq_enqueue_ts = 0;
+
+	/* Time waited on this CPU's runqueue */
+	hist = bpf_map_lookup_elem(&runq_wait_cpu_hist, &zero);
+	if (hist)
+		hist_add(hist, rq_wait);
+
+	/* Don't inherit what a previous task with the same pid waited */
+	stats = NULL;
+	if (tctx->runq_wait_seen)
+		stats = bpf_map_lookup_elem(&runq_wait_task, &pid);
+	if (!stats) {
+		bpf_map_update_elem(&runq_wait_task, &pid, &zero_runq_wait_stats, BPF_ANY);
+		stats = bpf_map_lookup_elem(&runq_wait_task, &pid);
+		if (!stats)
+			return 0;
+		BPF_CORE_READ_STR_INTO(&stats->comm, next, comm);
+		tctx->runq_wait_seen = true;
+	}
+
+	/* Since the original enqueue, across migrations */
+	hist_add(&stats->hist, wait);
+
+	return 0;
+}
+
+static inline void pmu_emit(struct task_struct *p, struct task_ctx *tctx,
+			    int cpu, u64 ts)
+{
+	struct pmu_event *e;
+
+	e = bpf_ringbuf_reserve(&pmu_rb, sizeof(*e), 0);
+	if (e) {
+		e->ts = ts;
+		e->cpu = cpu;
+		e->pid = BPF_CORE_READ(p, pid);
+		BPF_CORE_READ_STR_INTO(&e->comm, p, comm);
+		e->capacity = tctx->pmu_capacity;
+		e->cycles = tctx->cycles;
+		e->instructions = tctx->instructions;
+		bpf_ringbuf_submit(e, 0);
+	}
+
+	tctx->cycles = 0;
+	tctx->instructions = 0;
+}
+
+SEC("raw_tp/sched_switch")
+int BPF_PROG(handle_pmu_switch, bool preempt,
+	     struct task_struct *prev, struct task_struct *next)
+{
+	struct bpf_perf_event_value cycles = { 0 }, instructions = { 0 };
+	u64 period = sa_opts.stats_period * 1000000ULL;
+	int cpu = bpf_get_smp_processor_id();
+	u64 ts = bpf_ktime_get_boot_ns();
+	u64 delta_cycles, delta_instructions;
+	unsigned int capacity = 0;
+	struct task_ctx *tctx;
+	struct pmu_last *last;
+	int zero = 0;
+	bool first;
+
+	last = bpf_map_lookup_elem(&pmu_last, &zero);
+	if (!last)
+		return 0;
+
+	/* A failed read would underflow the delta, drop this switch */
+	if (bpf_perf_event_read_value(&pmu_cycles, BPF_F_CURRENT_CPU,
+				      &cycles, sizeof(cycles)))
+		return 0;
+
+	/* No instructions counter with the cpu-clock fallback */
+	if (bpf_perf_event_read_value(&pmu_instructions, BPF_F_CURRENT_CPU,
+				      &instructions, sizeof(instructions)))
+		instructions.counter = last->instructions;
+
+	first = !last->cycles && !last->instructions;
+	delta_cycles = cycles.counter - last->cycles;
+	delta_instructions = instructions.counter - last->instructions;
+	last->cycles = cycles.counter;
+	last->instructions = instructions.counter;
+
+	/* Nothing to attribute until we have a reference on this CPU */
+	if (first || !BPF_CORE_READ(prev, pid) || ignore_task(prev))
+		return 0;
+
+	tctx = bpf_task_storage_get(&task_ctx_map, prev, 0,
+				    BPF_LOCAL_STORAGE_GET_F_CREATE);
+	if (!tctx)
+		return 0;
+
+	if ((unsigned int)cpu < MAX_CPUS)
+		capacity = cpu_capacity[cpu];
+
+	/*
+	 * Emit what was accumulated once per stats period, or when the task
+	 * moves to a different type of CPU so that IPC isn't mixed across them.
+	 */
+	if (tctx->cycles &&
+	    (capacity != tctx->pmu_capacity || ts - tctx->pmu_ts >= period))
+		pmu_emit(prev, tctx, cpu, ts);
+
+	if (!tctx->cycles) {
+		tctx->pmu_ts = ts;
+		tctx->pmu_capacity = capacity;
+	}
+
+	tctx->cycles += delta_cycles;
+	tctx->instructions += delta_instructions;
+
+	return 0;
+}
+
+static const struct migrate_task_stats zero_migrate_task_stats;
+
+static inline void migrate_account_task(struct task_struct *p, enum migrate_class class)
+{
+	struct migrate_task_stats *stats;
+	pid_t pid = BPF_CORE_READ(p, pid);
+
+	if (!pid || ignore_task(p))
+		return;
+
+	stats = bpf_map_lookup_elem(&migrate_task_count, &pid);
+	if (!stats) {
+		bpf_map_update_elem(&migrate_task_count, &pid, &zero_migrate_task_stats, BPF_NOEXIST);
+		stats = bpf_map_lookup_elem(&migrate_task_count, &pid);
+		if (!stats)
+			return;
+		BPF_CORE_READ_STR_INTO(&stats->comm, p, comm);
+	}
+
+	__sync_fetch_and_add(&stats->count[class], 1);
+}
+
+static inline void migrate_account(enum migrate_class class)
+{
+	struct migrate_stats *stats;
+	int zero = 0;
+
+	stats = bpf_map_lookup_elem(&migrate_stats, &zero);
+	if (stats)
+		stats->count[class]++;
+}
+
+SEC("raw_tp/sched_migrate_task")
+int BPF_PROG(handle_migrate_task, struct task_struct *p, int dest_cpu)
+{
+	struct migrate_key key = {
+		.to_cpu = dest_cpu,
+	};
+	enum migrate_class class;
+	u64 one = 1, *count;
+	int orig_cpu;
+
+	/* Only in thread_info since 5.16, task_struct had it before */
+	if (bpf_core_field_exists(p->thread_info.cpu)) {
+		orig_cpu = BPF_CORE_READ(p, thread_info.cpu);
+	} else {
+		struct task_struct__old *p_old = (void *)p;
+		orig_cpu = BPF_CORE_READ(p_old, cpu);
+	}
+	key.from_cpu = orig_cpu;
+
+	if ((unsigned int)orig_cpu >= MAX_CPUS || (unsigned int)dest_cpu >= MAX_CPUS)
+		return 0;
+
+	if (cpu_node_id[orig_cpu] != cpu_node_id[dest_cpu])
+		class = MIGRATE_CROSS_NODE;
+	else if (cpu_llc_id[orig_cpu] != cpu_llc_id[dest_cpu])
+		class = MIGRATE_CROSS_LLC;
+	else
+		class = MIGRATE_SAME_LLC;
+
+	count = bpf_map_lookup_elem(&migrate_count, &key);
+	if (count)
+		__sync_fetch_and_add(count, 1);
+	else
+		bpf_map_update_elem(&migrate_count, &key, &one, BPF_NOEXIST);
+
+	migrate_account(class);
+	migrate_account_task(p, class);
+
+	return 0;
+}
+
+/* NUMA balancing, only present with CONFIG_NUMA_BALANCING */
+SEC("raw_tp/sched_move_numa")
+int BPF_PROG(handle_move_numa, struct task_struct *p, int src_cpu, int dst_cpu)
+{
+	migrate_account(MIGRATE_NUMA_MOVE);
+	migrate_account_task(p, MIGRATE_NUMA_MOVE);
+
+	return 0;
+}
+
+SEC("raw_tp/sched_swap_numa")
+int BPF_PROG(handle_swap_numa, struct task_struct *src_tsk, int src_cpu,
+	     struct task_struct *dst_tsk, int dst_cpu)
+{
+	migrate_account(MIGRATE_NUMA_SWAP);
+	migrate_account_task(src_tsk, MIGRATE_NUMA_SWAP);
+	migrate_account_task(dst_tsk, MIGRATE_NUMA_SWAP);
+
+	return 0;
+}
+
+static inline void placement_set_flag(u32 flag)
+{
+	int zero = 0;
+	u32 *flags;
+
+	flags = bpf_map_lookup_elem(&placement_flags, &zero);
+	if (flags)
+		*flags |= flag;
+}
+
+SEC("fentry/select_task_rq_fair")
+int BPF_PROG(handle_select_task_rq_fair_entry)
+{
+	int zero = 0;
+	u32 *flags;
+
+	flags = bpf_map_lookup_elem(&placement_flags, &zero);
+	if (flags)
+		*flags = 0;
+
+	return 0;
+}
+
+SEC("fentry/find_energy_efficient_cpu")
+int BPF_PROG(handle_find_energy_efficient_cpu_entry)
+{
+	placement_set_flag(PLACEMENT_F_EAS);
+
+	return 0;
+}
+
+SEC("fentry/wake_affine")
+int BPF_PROG(handle_wake_affine_entry)
+{
+	placement_set_flag(PLACEMENT_F_WAKE_AFFINE);
+
+	return 0;
+}
+
+SEC("fentry/select_idle_sibling")
+int BPF_PROG(handle_select_idle_sibling_entry)
+{
+	placement_set_flag(PLACEMENT_F_SIS);
+
+	return 0;
+}
+
+SEC("fentry/find_idlest_cpu")
+int BPF_PROG(handle_find_idlest_cpu_entry)
+{
+	placement_set_flag(PLACEMENT_F_SLOW);
+
+	return 0;
+}
+
+SEC("fexit/select_task_rq_fair")
+int BPF_PROG(handle_select_task_rq_fair_exit, struct task_struct *p,
+	     int prev_cpu, int wake_flags, int new_cpu)
+{
+	int this_cpu = bpf_get_smp_processor_id();
+	struct placement_stats *stats;
+	struct placement_event *e;
+	struct task_ctx *tctx;
+	int path, outcome;
+	u32 *flags, pflags;
+	int zero = 0;
+
+	flags = bpf_map_lookup_elem(&placement_flags, &zero);
+	pflags = flags ? *flags : 0;
+
+	if (pflags & PLACEMENT_F_EAS)
+		path = PLACEMENT_PATH_EAS;
+	else if (pflags & PLACEMENT_F_SLOW)
+		path = PLACEMENT_PATH_SLOW;
+	else if (pflags & PLACEMENT_F_SIS)
+		path = PLACEMENT_PATH_FAST;
+	else
+		path = PLACEMENT_PATH_OTHER;
+
+	if (new_cpu == prev_cpu)
+		outcome = PLACEMENT_PREV_CPU;
+	else if (new_cpu == this_cpu)
+		outcome = PLACEMENT_WAKER_CPU;
+	else
+		outcome = PLACEMENT_OTHER_CPU;
+
+	stats = bpf_map_lookup_elem(&placement_stats, &zero);
+	if (stats)
+		stats->count[path][outcome]++;
+
+	if (ignore_task(p))
+		return 0;
+
+	/* Only emit 1 in placement_sample decisions of every task */
+	tctx = bpf_task_storage_get(&task_ctx_map, p, 0,
+				    BPF_LOCAL_STORAGE_GET_F_CREATE);
+	if (!tctx)
+		return 0;
+
+	if (tctx->placement_count++ % sa_opts.placement_sample)
+		return 0;
+
+	e = bpf_ringbuf_reserve(&placement_rb, sizeof(*e), 0);
+	if (e) {
+		e->ts = bpf_ktime_get_boot_ns();
+		e->this_cpu = this_cpu;
+		e->pid = BPF_CORE_READ(p, pid);
+		BPF_CORE_READ_STR_INTO(&e->comm, p, comm);
+		e->prev_cpu = prev_cpu;
+		e->new_cpu = new_cpu;
+		e->wake_flags = wake_flags;
+		e->path_flags = pflags;
+		bpf_ringbuf_submit(e, 0);
+	}
+
+	return 0;
+}
+
+/*
+ * sugov_should_update_freq(), get_next_freq() and sugov_update_next_freq()
+ * are usually inlined. Instead snapshot sugov_policy around the update_util
+ * hooks and infer whether the request was rate limited or changed frequency.
+ *
+ * This is only an approximation. limits_changed can be set by
+ * ignore_dl_rate_limit() within the hooked call, after the snapshot; an
+ * update that then went through is only caught if it moved
+ * last_freq_update_time. And sugov_update_single_perf() hands a perf level
+ * to the driver without ever updating next_freq, so frequency changes are
+ * never counted for adjust_perf drivers.
+ */
+static inline void sugov_update_entry(struct update_util_data *hook, u64 time)
+{
+	struct sugov_cpu *sg_cpu = container_of(hook, struct sugov_cpu, update_util);
+	struct sugov_policy *sg_policy = BPF_CORE_READ(sg_cpu, sg_policy);
+	struct sugov_entry *entry;
+	s64 delta_ns;
+	int zero = 0;
+
+	entry = bpf_map_lookup_elem(&sugov_entry, &zero);
+	if (!entry)
+		return;
+
+	entry->last_freq_update_time = BPF_CORE_READ(sg_policy, last_freq_update_time);
+	entry->next_freq = BPF_CORE_READ(sg_policy, next_freq);
+
+	delta_ns = time - entry->last_freq_update_time;
+	entry->rate_limited = !BPF_CORE_READ(sg_policy, limits_changed) &&
+			      delta_ns < BPF_CORE_READ(sg_policy, freq_update_delay_ns);
+}
+
+static inline void sugov_update_exit(struct update_util_data *hook, bool perf)
+{
+	struct sugov_cpu *sg_cpu = container_of(hook, struct sugov_cpu, update_util);
+	struct sugov_policy *sg_policy = BPF_CORE_READ(sg_cpu, sg_policy);
+	struct sugov_stats *stats, zero_stats = { 0 };
+	unsigned int next_freq;
+	struct sugov_entry *entry;
+	struct sugov_event *e;
+	int zero = 0;
+	int policy_cpu;
+
+	entry = bpf_map_lookup_elem(&sugov_entry, &zero);
+	if (!entry)
+		return;
+
+	policy_cpu = BPF_CORE_READ(sg_policy, policy, cpu);
+
+	stats = bpf_map_lookup_elem(&sugov_stats, &policy_cpu);
+	if (!stats) {
+		bpf_map_update_elem(&sugov_stats, &policy_cpu, &zero_stats, BPF_NOEXIST);
+		stats = bpf_map_lookup_elem(&sugov_stats, &policy_cpu);
+		if (!stats)
+			return;
+	}
+
+	stats->updates++;
+
+	if (entry->rate_limited &&
+	    BPF_CORE_READ(sg_policy, last_freq_update_time) == entry->last_freq_update_time) {
+		stats->rate_limited++;
+		return;
+	}
+
+	/* next_freq isn't maintained on the adjust_perf path */
+	if (perf)
+		return;
+
+	next_freq = BPF_CORE_READ(sg_policy, next_freq);
+	if (next_freq == entry->next_freq)
+		return;
+
+	stats->freq_changes++;
+
+	e = bpf_ringbuf_reserve(&sugov_rb, sizeof(*e), 0);
+	if (e) {
+		e->ts = bpf_ktime_get_boot_ns();
+		e->cpu = BPF_CORE_READ(sg_cpu, cpu);
+		e->policy_cpu = policy_cpu;
+		e->util = BPF_CORE_READ(sg_cpu, util);
+		e->prev_freq = entry->next_freq;
+		e->next_freq = next_freq;
+		bpf_ringbuf_submit(e, 0);
+	}
+}
+
+SEC("fentry/sugov_update_single_freq")
+int BPF_PROG(handle_sugov_update_single_freq_entry, struct update_util_data *hook,
+	     u64 time, unsigned int flags)
+{
+	sugov_update_entry(hook, time);
+
+	return 0;
+}
+
+SEC("fexit/sugov_update_single_freq")
+int BPF_PROG(handle_sugov_update_single_freq_exit, struct update_util_data *hook,
+	     u64 time, unsigned int flags)
+{
+	sugov_update_exit(hook, false);
+
+	return 0;
+}
+
+SEC("fentry/sugov_update_single_perf")
+int BPF_PROG(handle_sugov_update_single_perf_entry, struct update_util_data *hook,
+	     u64 time, unsigned int flags)
+{
+	sugov_update_entry(hook, time);
+
+	return 0;
+}
+
+SEC("fexit/sugov_update_single_perf")
+int BPF_PROG(handle_sugov_update_single_perf_exit, struct update_util_data *hook,
+	     u64 time, unsigned int flags)
+{
+	sugov_update_exit(hook, true);
+
+	return 0;
+}
+
+SEC("fentry/sugov_update_shared")
+int BPF_PROG(handle_sugov_update_shared_entry, struct update_util_data *hook,
+	     u64 time, unsigned int flags)
+{
+	sugov_update_entry(hook, time);
+
+	return 0;
+}
+
+SEC("fexit/sugov_update_shared")
+int BPF_PROG(handle_sugov_update_shared_exit, struct update_util_data *hook,
+	     u64 time, unsigned int flags)
+{
+	sugov_update_exit(hook, false);
+
+	return 0;
+}
+
+static inline void idle_gov_select_entry(struct cpuidle_driver *drv)
+{
+	struct idle_gov_select *sel;
+	int zero = 0;
+
+	sel = bpf_map_lookup_elem(&idle_gov_select, &zero);
+	if (!sel)
+		return;
+
+	sel->drv = drv;
+	sel->sleep_length = -1;
+	sel->state = -1;
+	sel->in_select = true;
+}
+
+static inline void idle_gov_select_exit(int state)
+{
+	struct idle_gov_select *sel;
+	int zero = 0;
+
+	sel = bpf_map_lookup_elem(&idle_gov_select, &zero);
+	if (!sel)
+		return;
+
+	sel->state = state;
+	sel->in_select = false;
+}
+
+SEC("fentry/teo_select")
+int BPF_PROG(handle_teo_select_entry, struct cpuidle_driver *drv,
+	     struct cpuidle_device *dev, bool *stop_tick)
+{
+	idle_gov_select_entry(drv);
+
+	return 0;
+}
+
+SEC("fexit/teo_select")
+int BPF_PROG(handle_teo_select_exit, struct cpuidle_driver *drv,
+	     struct cpuidle_device *dev, bool *stop_tick, int state)
+{
+	idle_gov_select_exit(state);
+
+	return 0;
+}
+
+SEC("fentry/menu_select")
+int BPF_PROG(handle_menu_select_entry, struct cpuidle_driver *drv,
+	     struct cpuidle_device *dev, bool *stop_tick)
+{
+	idle_gov_select_entry(drv);
+
+	return 0;
+}
+
+SEC("fexit/menu_select")
+int BPF_PROG(handle_menu_select_exit, struct cpuidle_driver *drv,
+	     struct cpuidle_device *dev, bool *stop_tick, int state)
+{
+	idle_gov_select_exit(state);
+
+	return 0;
+}
+
+/*
+ * Both governors base their prediction on the time till the next timer
+ * event. Capture it when called from within select.
+ */
+SEC("fexit/tick_nohz_get_sleep_length")
+int BPF_PROG(handle_tick_nohz_get_sleep_length_exit, ktime_t *delta_next,
+	     ktime_t sleep_length)
+{
+	struct idle_gov_select *sel;
+	int zero = 0;
+
+	sel = bpf_map_lookup_elem(&idle_gov_select, &zero);
+	if (sel && sel->in_select)
+		sel->sleep_length = sleep_length;
+
+	return 0;
+}
+
+static inline s64 idle_state_target_residency(struct cpuidle_driver *drv, int i)
+{
+	struct cpuidle_state *state;
+
+	if (i < 0 || i >= MAX_IDLE_STATES)
+		return -1;
+
+	state = &drv->states[i];
+	return BPF_CORE_READ(state, target_residency_ns);
+}
+
+static inline s64 idle_state_exit_latency(struct cpuidle_driver *drv, int i)
+{
+	struct cpuidle_state *state;
+
+	if (i < 0 || i >= MAX_IDLE_STATES)
+		return 0;
+
+	state = &drv->states[i];
+	return BPF_CORE_READ(state, exit_latency_ns);
+}
+
+/*
+ * Called after the CPU wakes up with the actual residency in
+ * dev->last_residency_ns. Classify the decision the same way
+ * cpuidle_enter_state() does for the above/below usage stats: too deep only
+ * counts when an enabled shallower state existed, and too shallow compares
+ * the residency minus the exit latency of the entered state.
+ */
+SEC("fentry/cpuidle_reflect")
+int BPF_PROG(handle_cpuidle_reflect, struct cpuidle_device *dev, int index)
+{
+	struct cpuidle_state_usage *usage;
+	struct idle_gov_stats *stats;
+	struct idle_gov_select *sel;
+	struct cpuidle_driver *drv;
+	struct idle_gov_event *e;
+	int outcome = IDLE_GOV_HIT;
+	int zero = 0, state_count;
+	u64 residency;
+	s64 target, delay;
+	int i;
+
+	sel = bpf_map_lookup_elem(&idle_gov_select, &zero);
+	if (!sel || !sel->drv || index < 0 || index >= MAX_IDLE_STATES)
+		return 0;
+
+	drv = sel->drv;
+	sel->drv = NULL;
+	residency = BPF_CORE_READ(dev, last_residency_ns);
+
+	target = idle_state_target_residency(drv, index);
+	delay = idle_state_exit_latency(drv, index);
+	if (target >= 0 && residency < target) {
+		/* Only a miss if an enabled shallower state was available */
+		for (i = index - 1; i >= 0; i--) {
+			usage = &dev->states_usage[i];
+			if (BPF_CORE_READ(usage, disable))
+				continue;
+
+			outcome = IDLE_GOV_TOO_DEEP;
+			break;
+		}
+	} else if ((s64)residency > delay) {
+		state_count = BPF_CORE_READ(drv, state_count);
+
+		/* Would the first enabled deeper state have been a better fit? */
+		for (i = index + 1; i < MAX_IDLE_STATES; i++) {
+			if (i >= state_count)
+				break;
+			usage = &dev->states_usage[i];
+			if (BPF_CORE_READ(usage, disable))
+				continue;
+
+			target = idle_state_target_residency(drv, i);
+			if (target >= 0 && (s64)residency - delay >= target)
+				outcome = IDLE_GOV_TOO_SHALLOW;
+			break;
+		}
+	}
+
+	stats = bpf_map_lookup_elem(&idle_gov_stats, &index);
+	if (stats)
+		stats->count[outcome]++;
+
+	/* Only emit the misses */
+	if (outcome == IDLE_GOV_HIT)
+		return 0;
+
+	e = bpf_ringbuf_reserve(&idle_gov_rb, sizeof(*e), 0);
+	if (e) {
+		e->ts = bpf_ktime_get_boot_ns();
+		e->cpu = BPF_CORE_READ(dev, cpu);
+		e->state = index;
+		e->outcome = outcome;
+		e->sleep_length = sel->sleep_length;
+		e->residency = residency;
+		bpf_ringbuf_submit(e, 0);
+	}
+
+	return 0;
+}
+
+static inline void ipi_lat_emit(int cpu, int from_cpu, void *callback,
+				u64 latency, u64 duration, u64 ts)
+{
+	struct ipi_lat_event *e;
+
+	e = bpf_ringbuf_reserve(&ipi_lat_rb, sizeof(*e), 0);
+	if (e) {
+		e->ts = ts;
+		e->cpu = cpu;
+		e->from_cpu = from_cpu;
+		e->callback = callback;
+		e->latency = latency;
+		e->duration = duration;
+		bpf_ringbuf_submit(e, 0);
+	}
+}
+
+/*
+ * Account the time from sending the IPI till the target started running its
+ * callback. The callback can also be flushed before the IPI arrives, ie: from
+ * idle, the latency is still from the request. Reschedule IPIs are accounted
+ * with a NULL callback.
+ */
+static inline void ipi_handled(void *map, void *func)
+{
+	int cpu = bpf_get_smp_processor_id();
+	u64 ts = bpf_ktime_get_boot_ns();
+	struct ipi_pending *pending;
+	struct ipi_lat_key key;
+	struct log2_hist *hist;
+	u64 latency, sent;
+	int from_cpu;
+
+	pending = bpf_map_lookup_elem(map, &cpu);
+	if (!pending)
+		return;
+
+	sent = pending->ts;
+	if (sent <= IPI_PENDING_BUSY || ts < sent || pending->callback != func)
+		return;
+
+	latency = ts - sent;
+	key.callback = func;
+	key.cpu = cpu;
+	from_cpu = pending->from_cpu;
+
+	/* The sender expired and replaced it meanwhile */
+	if (__sync_val_compare_and_swap(&pending->ts, sent, 0) != sent)
+		return;
+
+	hist = lookup_or_init_hist(&ipi_lat_hist, &key);
+	if (hist)
+		hist_add(hist, latency);
+
+	if (sa_opts.ipi_latency_threshold && latency > sa_opts.ipi_latency_threshold)
+		ipi_lat_emit(cpu, from_cpu, key.callback, latency, 0, ts);
+}
+
+SEC("raw_tp/csd_function_entry")
+int BPF_PROG(handle_csd_function_entry, void *func, void *csd)
+{
+	int zero = 0;
+	u64 *entry;
+
+	ipi_handled(&ipi_pending, func);
+
+	entry = bpf_map_lookup_elem(&csd_entry, &zero);
+	if (entry)
+		*entry = bpf_ktime_get_boot_ns();
+
+	return 0;
+}
+
+/* x86 doesn't trace ipi_entry, it has a tracepoint per vector */
+SEC("raw_tp/reschedule_entry")
+int BPF_PROG(handle_reschedule_entry, int vector)
+{
+	ipi_handled(&ipi_resched_pending, NULL);
+
+	return 0;
+}
+
+SEC("raw_tp/ipi_entry")
+int BPF_PROG(handle_ipi_entry, const char *reason)
+{
+	char c = 0;
+
+	/* "Rescheduling interrupts" on arm and arm64 */
+	bpf_probe_read_kernel(&c, sizeof(c), reason);
+	if (c == 'R')
+		ipi_handled(&ipi_resched_pending, NULL);
+
+	return 0;
+}
+
+SEC("raw_tp/csd_function_exit")
+int BPF_PROG(handle_csd_function_exit, void *func, void *csd)
+{
+	int cpu = bpf_get_smp_processor_id();
+	u64 ts = bpf_ktime_get_boot_ns();
+	struct ipi_lat_key key = {
+		.callback = func,
+		.cpu = cpu,
+	};
+	struct log2_hist *hist;
+	u64 *entry, duration;
+	int zero = 0;
+
+	entry = bpf_map_lookup_elem(&csd_entry, &zero);
+	if (!entry || !*entry)
+		return 0;
+
+	duration = ts - *entry;
+	*entry = 0;
+
+	hist = lookup_or_init_hist(&ipi_func_hist, &key);
+	if (hist)
+		hist_add(hist, duration);
+
+	if (sa_opts.ipi_latency_threshold && duration > sa_opts.ipi_latency_threshold)
+		ipi_lat_emit(cpu, -1, func, 0, duration, ts);
+
+	return 0;
+}
+
+/*
+ * contention_begin/end fire for every contended lock in the system. Learn the
+ * address of all rq locks once so we can filter for them only.
+ */
+static inline void learn_rq_locks(void)
+{
+	int cpu;
+
+	if (!bpf_ksym_exists(&runqueues)) {
+		rq_locks_learnt = true;
+		return;
+	}
+
+	for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+		struct rq *rq;
+		u64 lock;
+
+		if (cpu >= nr_cpu_ids)
+			break;
+
+		rq = bpf_per_cpu_ptr(&runqueues, cpu);
+		if (!rq)
+			continue;
+
+		lock = (u64)&rq->__lock;
+		bpf_map_update_elem(&rq_lock_cpu, &lock, &cpu, BPF_ANY);
+	}
+
+	rq_locks_learnt = true;
 }
 
-SEC("raw_tp/sched_util_est_cfs_tp")
-int BPF_PROG(handle_util_est_cfs, struct cfs_rq *cfs_rq)
+SEC("raw_tp/contention_begin")
+int BPF_PROG(handle_contention_begin, void *lock, unsigned int flags)
 {
-	if (cfs_rq_is_root(cfs_rq)) {
-		unsigned long util_est_enqueued, util_est_ewma;
-		struct rq *rq = rq_of(cfs_rq);
-		int cpu = BPF_CORE_READ(rq, cpu);
-		struct rq_pelt_event *e;
+	struct rq_lock_stats *stats;
+	struct rq_lock_wait *wait;
+	u64 addr = (u64)lock;
+	u64 *max, contenders;
+	int *cpu, zero = 0;
 
+	if (!rq_locks_learnt)
+		learn_rq_locks();
 
-		if (LINUX_KERNEL_VERSION < KERNEL_VERSION(6, 8, 0)) {
-			struct sched_avg__pre68 *avg_old = (void *)&cfs_rq->avg;
-			util_est_enqueued = BPF_PROBE_READ(avg_old, util_est.enqueued);
-			util_est_ewma = BPF_PROBE_READ(avg_old, util_est.ewma);
-		} else {
-			util_est_enqueued = BPF_CORE_READ(cfs_rq, avg.util_est);
-			util_est_ewma = 0;
-		}
+	cpu = bpf_map_lookup_elem(&rq_lock_cpu, &addr);
+	if (!cpu)
+		return 0;
 
-		bpf_printk("cfs: [CPU%d] util_est.enqueued = %lu util_est.ewma = %lu",
-			   cpu, util_est_enqueued, util_est_ewma);
+	wait = bpf_map_lookup_elem(&rq_lock_wait, &zero);
+	if (!wait)
+		return 0;
 
-		e = bpf_ringbuf_reserve(&rq_pelt_rb, sizeof(*e), 0);
-		if (e) {
-			e->ts = bpf_ktime_get_boot_ns();
-			e->cpu = cpu;
-			e->load_avg = -1;
-			e->runnable_avg = -1;
-			e->util_avg = -1;
-			e->util_est_enqueued = util_est_enqueued & ~UTIL_AVG_UNCHANGED;
-			e->util_est_ewma = util_est_ewma;
-			e->uclamp_min = -1;
-			e->uclamp_max = -1;
-			bpf_ringbuf_submit(e, 0);
-		}
-	}
+	wait->ts = bpf_ktime_get_boot_ns();
+	wait->lock = addr;
+	wait->cpu = *cpu;
+
+	stats = bpf_map_lookup_elem(&rq_lock_stats, cpu);
+	if (!stats)
+		return 0;
+
+	__sync_fetch_and_add(&stats->contentions, 1);
+	contenders = __sync_fetch_and_add(&stats->contenders, 1) + 1;
+
+	max = bpf_map_lookup_elem(&rq_lock_max_contenders, cpu);
+	if (max && contenders > *max)
+		*max = contenders;
 
 	return 0;
 }
 
-SEC("raw_tp/pelt_rt_tp")
-int BPF_PROG(handle_pelt_rt, struct rq *rq)
+SEC("raw_tp/contention_end")
+int BPF_PROG(handle_contention_end, void *lock, int ret)
 {
-	int cpu = BPF_CORE_READ(rq, cpu);
-	struct rq_pelt_event *e;
-
-	if (!bpf_core_field_exists(rq->avg_rt))
+	u64 ts = bpf_ktime_get_boot_ns();
+	struct rq_lock_stats *stats;
+	struct rq_lock_wait *wait;
+	struct log2_hist *hist;
+	int cpu, zero = 0;
+	u64 duration;
+
+	wait = bpf_map_lookup_elem(&rq_lock_wait, &zero);
+	if (!wait || !wait->ts || wait->lock != (u64)lock)
 		return 0;
 
-	unsigned long util_avg = BPF_CORE_READ(rq, avg_rt.util_avg);
+	duration = ts - wait->ts;
+	cpu = wait->cpu;
+	wait->ts = 0;
 
-	e = bpf_ringbuf_reserve(&rq_pelt_rb, sizeof(*e), 0);
-	if (e) {
-		e->ts = bpf_ktime_get_boot_ns();
-		e->cpu = cpu;
-		e->type = PELT_TYPE_RT;
-		e->load_avg = -1;
-		e->runnable_avg = -1;
-		e->util_avg = util_avg;
-		e->util_est_enqueued = -1;
-		e->util_est_ewma = -1;
-		e->uclamp_min = -1;
-		e->uclamp_max = -1;
-		bpf_ringbuf_submit(e, 0);
-	}
+	stats = bpf_map_lookup_elem(&rq_lock_stats, &cpu);
+	if (stats)
+		__sync_fetch_and_add(&stats->contenders, -1);
+
+	hist = lookup_or_init_hist(&rq_lock_hist, &cpu);
+	if (hist)
+		hist_add(hist, duration);
+
+	if (sa_opts.rq_lock_threshold && duration >= sa_opts.rq_lock_threshold)
+		capture_stack(ctx, STACK_SOURCE_RQ_LOCK, cpu, duration, ts);
 
 	return 0;
 }
 
-SEC("raw_tp/pelt_dl_tp")
-int BPF_PROG(handle_pelt_dl, struct rq *rq)
+static inline bool cfs_throttle_key(struct cfs_rq *cfs_rq, struct cfs_throttle_key *key)
 {
-	int cpu = BPF_CORE_READ(rq, cpu);
-	struct rq_pelt_event *e;
+	key->cgroup_id = cfs_rq_cgroup_id(cfs_rq);
+	if (!key->cgroup_id)
+		return false;
 
-	if (!bpf_core_field_exists(rq->avg_dl))
+	if (sa_opts.num_cgroups && !cgroup_is_filtered(key->cgroup_id))
+		return false;
+
+	key->cpu = BPF_CORE_READ(rq_of(cfs_rq), cpu);
+
+	return true;
+}
+
+SEC("fexit/throttle_cfs_rq")
+int BPF_PROG(handle_throttle_cfs_rq_exit, struct cfs_rq *cfs_rq)
+{
+	struct cfs_throttle_key key = { 0 };
+	u64 ts = bpf_ktime_get_boot_ns();
+
+	/* Returns early when it found runtime to carry on */
+	if (!bpf_core_field_exists(cfs_rq->throttled) ||
+	    !BPF_CORE_READ(cfs_rq, throttled))
 		return 0;
 
-	unsigned long util_avg = BPF_CORE_READ(rq, avg_dl.util_avg);
+	if (!cfs_throttle_key(cfs_rq, &key))
+		return 0;
 
-	e = bpf_ringbuf_reserve(&rq_pelt_rb, sizeof(*e), 0);
-	if (e) {
-		e->ts = bpf_ktime_get_boot_ns();
-		e->cpu = cpu;
-		e->type = PELT_TYPE_DL;
-		e->load_avg = -1;
-		e->runnable_avg = -1;
-		e->util_avg = util_avg;
-		e->util_est_enqueued = -1;
-		e->util_est_ewma = -1;
-		e->uclamp_min = -1;
-		e->uclamp_max = -1;
-		bpf_ringbuf_submit(e, 0);
-	}
+	if (bpf_map_update_elem(&cfs_throttle_start, &key, &ts, BPF_ANY))
+		__sync_fetch_and_add(&cfs_throttle_drops, 1);
 
 	return 0;
 }
 
-SEC("raw_tp/pelt_irq_tp")
-int BPF_PROG(handle_pelt_irq, struct rq *rq)
+SEC("fentry/unthrottle_cfs_rq")
+int BPF_PROG(handle_unthrottle_cfs_rq_entry, struct cfs_rq *cfs_rq)
 {
-	int cpu = BPF_CORE_READ(rq, cpu);
-	struct rq_pelt_event *e;
+	struct cfs_throttle_key key = { 0 };
+	u64 ts = bpf_ktime_get_boot_ns();
+	struct cfs_throttle_event *e;
+	struct log2_hist *hist;
+	u64 *start, duration;
 
-	if (!bpf_core_field_exists(rq->avg_irq))
+	if (!cfs_throttle_key(cfs_rq, &key))
 		return 0;
 
-	unsigned long util_avg = BPF_CORE_READ(rq, avg_irq.util_avg);
+	start = bpf_map_lookup_elem(&cfs_throttle_start, &key);
+	if (!start)
+		return 0;
 
-	e = bpf_ringbuf_reserve(&rq_pelt_rb, sizeof(*e), 0);
+	duration = ts - *start;
+	bpf_map_delete_elem(&cfs_throttle_start, &key);
+
+	hist = lookup_or_init_hist(&cfs_throttle_hist, &key);
+	if (hist)
+		hist_add(hist, duration / 1000);
+	else
+		__sync_fetch_and_add(&cfs_throttle_drops, 1);
+
+	if (duration < sa_opts.cfs_throttle_threshold)
+		return 0;
+
+	e = bpf_ringbuf_reserve(&cfs_throttle_rb, sizeof(*e), 0);
 	if (e) {
-		e->ts = bpf_ktime_get_boot_ns();
-		e->cpu = cpu;
-		e->type = PELT_TYPE_IRQ;
-		e->load_avg = -1;
-		e->runnable_avg = -1;
-		e->util_avg = util_avg;
-		e->util_est_enqueued = -1;
-		e->util_est_ewma = -1;
-		e->uclamp_min = -1;
-		e->uclamp_max = -1;
+		e->ts = ts;
+		e->cpu = key.cpu;
+		e->cgroup_id = key.cgroup_id;
+		e->duration = duration;
 		bpf_ringbuf_submit(e, 0);
 	}
 
 	return 0;
 }
 
-SEC("raw_tp/pelt_thermal_tp")
-int BPF_PROG(handle_pelt_thermal, struct rq *rq)
+#define MAX_CGROUP_DEPTH	16
+#define ROOT_CGROUP_ID		1
+
+static inline bool psi_cgroup_known(u64 psi)
 {
-	int cpu = BPF_CORE_READ(rq, cpu);
-	struct rq_pelt_event *e;
+	return bpf_map_lookup_elem(&psi_cgroup, &psi) ||
+	       bpf_map_lookup_elem(&psi_untracked, &psi);
+}
 
-	if (!bpf_core_field_exists(rq->avg_thermal))
+/*
+ * Learn which psi_group belongs to which cgroup by walking up the hierarchy of
+ * tasks changing state. Only the root and the cgroups we filter for are
+ * tracked. Other cgroups are remembered in an LRU so that busy leaves don't
+ * walk again, without ever taking the place of a tracked one.
+ */
+SEC("fentry/psi_task_change")
+int BPF_PROG(handle_psi_task_change_entry, struct task_struct *task)
+{
+	struct cgroup *cgrp = BPF_CORE_READ(task, cgroups, dfl_cgrp);
+	bool untracked = true;
+	u64 psi, id;
+	int i;
+
+	psi = (u64)BPF_CORE_READ(cgrp, psi);
+	if (!psi || psi_cgroup_known(psi))
 		return 0;
 
-	unsigned long load_avg = BPF_CORE_READ(rq, avg_thermal.load_avg);
+	for (i = 0; i < MAX_CGROUP_DEPTH && cgrp; i++) {
+		psi = (u64)BPF_CORE_READ(cgrp, psi);
+		id = BPF_CORE_READ(cgrp, kn, id);
 
-	e = bpf_ringbuf_reserve(&rq_pelt_rb, sizeof(*e), 0);
-	if (e) {
-		e->ts = bpf_ktime_get_boot_ns();
-		e->cpu = cpu;
-		e->type = PELT_TYPE_THERMAL;
-		e->load_avg = load_avg;
-		e->runnable_avg = -1;
-		e->util_avg = -1;
-		e->util_est_enqueued = -1;
-		e->util_est_ewma = -1;
-		e->uclamp_min = -1;
-		e->uclamp_max = -1;
-		bpf_ringbuf_submit(e, 0);
+		if (psi) {
+			/* Ancestors were learnt along with it */
+			if (i && psi_cgroup_known(psi))
+				break;
+
+			if (id == ROOT_CGROUP_ID || cgroup_is_filtered(id))
+				bpf_map_update_elem(&psi_cgroup, &psi, &id, BPF_NOEXIST);
+			else
+				bpf_map_update_elem(&psi_untracked, &psi, &untracked, BPF_NOEXIST);
+		}
+
+		cgrp = BPF_CORE_READ(cgrp, self.parent, cgroup);
 	}
 
 	return 0;
 }
 
-SEC("raw_tp/sched_update_nr_running_tp")
-int BPF_PROG(handle_sched_update_nr_running, struct rq *rq, int change)
+/* The psi_group is freed with the cgroup, its address can be reused */
+SEC("raw_tp/cgroup_rmdir")
+int BPF_PROG(handle_psi_cgroup_rmdir, struct cgroup *cgrp, const char *path)
 {
-	int cpu = BPF_CORE_READ(rq, cpu);
-	struct rq_nr_running_event *e;
-
-	int nr_running = BPF_CORE_READ(rq, nr_running);
+	u64 psi = (u64)BPF_CORE_READ(cgrp, psi);
 
-	bpf_printk("[CPU%d] nr_running = %d change = %d",
-		  cpu, nr_running, change);
+	if (!psi)
+		return 0;
 
-	e = bpf_ringbuf_reserve(&rq_nr_running_rb, sizeof(*e), 0);
-	if (e) {
-	       e->ts = bpf_ktime_get_boot_ns();
-	       e->cpu = cpu;
-	       e->nr_running = nr_running;
-	       e->change = change;
-	       bpf_ringbuf_submit(e, 0);
-	}
+	bpf_map_delete_elem(&psi_cgroup, &psi);
+	bpf_map_delete_elem(&psi_untracked, &psi);
 
 	return 0;
 }
 
-SEC("raw_tp/sched_switch")
-int BPF_PROG(handle_sched_switch, bool preempt,
-	     struct task_struct *prev, struct task_struct *next)
+static inline int psi_kernel_state(int stat)
 {
-	int cpu;
-	if (bpf_core_field_exists(prev->wake_cpu)) {
-		cpu = BPF_CORE_READ(prev, wake_cpu);
-	} else {
-		struct task_struct__old *prev_old = (void*)prev;
-		cpu = BPF_CORE_READ(prev_old, cpu);
+	switch (stat) {
+	case PSI_STAT_CPU_SOME:
+		return bpf_core_enum_value(enum psi_states, PSI_CPU_SOME);
+	case PSI_STAT_CPU_FULL:
+		/* Added in 5.13 */
+		if (!bpf_core_enum_value_exists(enum psi_states, PSI_CPU_FULL))
+			return -1;
+		return bpf_core_enum_value(enum psi_states, PSI_CPU_FULL);
+	case PSI_STAT_MEM_SOME:
+		return bpf_core_enum_value(enum psi_states, PSI_MEM_SOME);
+	case PSI_STAT_MEM_FULL:
+		return bpf_core_enum_value(enum psi_states, PSI_MEM_FULL);
+	case PSI_STAT_IO_SOME:
+		return bpf_core_enum_value(enum psi_states, PSI_IO_SOME);
+	case PSI_STAT_IO_FULL:
+		return bpf_core_enum_value(enum psi_states, PSI_IO_FULL);
+	default:
+		return -1;
 	}
-	struct sched_switch_event *e;
-	char comm[TASK_COMM_LEN];
-	int running = 1;
-	pid_t pid;
+}
 
-	pid = BPF_CORE_READ(prev, pid);
-	bpf_map_delete_elem(&sched_switch, &pid);
+/*
+ * The kernel accumulates stall times per CPU in psi_group_cpu->times[] when a
+ * state ends. Fold what changed since the last call into the cgroup totals.
+ */
+SEC("fexit/psi_group_change")
+int BPF_PROG(handle_psi_group_change_exit, struct psi_group *group, int cpu)
+{
+	struct psi_cpu_key key = { .cpu = cpu };
+	struct psi_group_cpu *groupc;
+	u64 psi = (u64)group, *id;
+	struct psi_stats *stats;
+	struct psi_prev *prev;
+	u32 time, state_mask;
+	int stat, state;
+	bool first;
+
+	id = bpf_map_lookup_elem(&psi_cgroup, &psi);
+	if (!id)
+		return 0;
 
-	BPF_CORE_READ_STR_INTO(&comm, prev, comm);
-	bpf_printk("[CPU%d] comm = %s running = %d",
-		   cpu, comm, 0);
+	key.cgroup_id = *id;
 
-	pid = BPF_CORE_READ(next, pid);
-	bpf_map_update_elem(&sched_switch, &pid, &running, BPF_ANY);
+	groupc = bpf_per_cpu_ptr(group->pcpu, cpu);
+	if (!groupc)
+		return 0;
 
-	BPF_CORE_READ_STR_INTO(&comm, next, comm);
-	bpf_printk("[CPU%d] comm = %s running = %d",
-		   cpu, comm, 1);
+	prev = bpf_map_lookup_elem(&psi_prev, &key);
+	first = !prev;
+	if (!prev) {
+		struct psi_prev zero_prev = { 0 };
 
-	e = bpf_ringbuf_reserve(&sched_switch_rb, sizeof(*e), 0);
-	if (e) {
-		e->ts = bpf_ktime_get_boot_ns();
-		e->cpu = cpu;
-		e->pid = BPF_CORE_READ(prev, pid);
-		BPF_CORE_READ_STR_INTO(&e->comm, prev, comm);
-		e->running = 0;
-		bpf_ringbuf_submit(e, 0);
+		bpf_map_update_elem(&psi_prev, &key, &zero_prev, BPF_NOEXIST);
+		prev = bpf_map_lookup_elem(&psi_prev, &key);
+		if (!prev)
+			return 0;
 	}
 
-	e = bpf_ringbuf_reserve(&sched_switch_rb, sizeof(*e), 0);
-	if (e) {
-		e->ts = bpf_ktime_get_boot_ns();
-		e->cpu = cpu;
-		e->pid = BPF_CORE_READ(next, pid);
-		BPF_CORE_READ_STR_INTO(&e->comm, next, comm);
-		e->running = 1;
-		bpf_ringbuf_submit(e, 0);
+	stats = bpf_map_lookup_elem(&psi_stats, &key.cgroup_id);
+	if (!stats) {
+		struct psi_stats zero_stats = { 0 };
+
+		bpf_map_update_elem(&psi_stats, &key.cgroup_id, &zero_stats, BPF_NOEXIST);
+		stats = bpf_map_lookup_elem(&psi_stats, &key.cgroup_id);
+		if (!stats)
+			return 0;
 	}
 
-	return 0;
-}
+	/*
+	 * times[] was brought up to date for the states that were active, the
+	 * ones active now accumulate from here until their next change.
+	 */
+	state_mask = BPF_CORE_READ(groupc, state_mask);
+	prev->ts = bpf_ktime_get_boot_ns();
+	prev->active = 0;
 
-SEC("raw_tp/sched_process_free")
-int BPF_PROG(handle_sched_process_free, struct task_struct *p)
-{
-	struct task_pelt_event *e;
-	char comm[TASK_COMM_LEN];
-	pid_t pid;
-	int cpu;
+	for (stat = 0; stat < NR_PSI_STATS; stat++) {
+		state = psi_kernel_state(stat);
+		if (state < 0)
+			continue;
 
-	if (bpf_core_field_exists(p->wake_cpu)) {
-		cpu = BPF_CORE_READ(p, wake_cpu);
-	} else {
-		struct task_struct__old *p_old = (void *)p;
-		cpu = BPF_CORE_READ(p_old, cpu);
-	}
-	pid = BPF_CORE_READ(p, pid);
-	BPF_CORE_READ_STR_INTO(&comm, p, comm);
+		if (bpf_probe_read_kernel(&time, sizeof(time), &groupc->times[state]))
+			continue;
 
-	e = bpf_ringbuf_reserve(&task_pelt_rb, sizeof(*e), 0);
-	if (e) {
-		e->ts = bpf_ktime_get_boot_ns();
-		e->cpu = cpu;
-		e->pid = pid;
-		BPF_CORE_READ_STR_INTO(&e->comm, p, comm);
-		e->load_avg = 0;
-		e->runnable_avg = 0;
-		e->util_avg = -0;
-		e->util_est_enqueued = 0;
-		e->util_est_ewma = 0;
-		e->uclamp_min = 0;
-		e->uclamp_max = 0;
-		e->running = 0;
-		bpf_ringbuf_submit(e, 0);
+		/* Don't account what happened before we started */
+		if (!first && time != prev->times[stat])
+			__sync_fetch_and_add(&stats->total[stat], (u32)(time - prev->times[stat]));
+
+		prev->times[stat] = time;
+
+		if (state_mask & (1 << state))
+			prev->active |= 1 << stat;
 	}
 
 	return 0;
 }
 
-SEC("raw_tp/cpu_frequency")
-int BPF_PROG(handle_cpu_frequency, unsigned int frequency, unsigned int cpu)
+static inline struct rt_dl_stats *rt_dl_stats_of(int cpu)
+{
+	return bpf_map_lookup_elem(&rt_dl_stats, &cpu);
+}
+
+static inline struct rt_dl_entry *get_rt_dl_entry(void)
+{
+	int zero = 0;
+
+	return bpf_map_lookup_elem(&rt_dl_entry, &zero);
+}
+
+SEC("fentry/push_rt_task")
+int BPF_PROG(handle_push_rt_task_entry, struct rq *rq)
+{
+	struct rt_dl_entry *entry = get_rt_dl_entry();
+
+	if (entry)
+		entry->push = bpf_ktime_get_boot_ns();
+
+	return 0;
+}
+
+SEC("fexit/push_rt_task")
+int BPF_PROG(handle_push_rt_task_exit, struct rq *rq, bool pull, int ret)
 {
-	struct freq_idle_event *e;
-	int idle_state = -1;
+	struct rt_dl_entry *entry = get_rt_dl_entry();
+	struct rt_dl_stats *stats;
 
-	bpf_printk("[CPU%d] freq = %u idle_state = %u",
-		   cpu, frequency, idle_state);
+	if (!entry || !entry->push)
+		return 0;
 
-	e = bpf_ringbuf_reserve(&freq_idle_rb, sizeof(*e), 0);
-	if (e) {
-		e->ts = bpf_ktime_get_boot_ns();
-		e->cpu = cpu;
-		e->frequency = frequency;
-		e->idle_state = idle_state;
-		e->idle_miss = 0;
-		bpf_ringbuf_submit(e, 0);
+	stats = rt_dl_stats_of(bpf_get_smp_processor_id());
+	if (stats) {
+		stats->rt_push++;
+		stats->rt_pushed += !!ret;
+		stats->rt_push_time += bpf_ktime_get_boot_ns() - entry->push;
 	}
 
+	entry->push = 0;
+
 	return 0;
 }
 
-SEC("raw_tp/cpu_idle")
-int BPF_PROG(handle_cpu_idle, unsigned int state, unsigned int cpu)
+SEC("fentry/pull_rt_task")
+int BPF_PROG(handle_pull_rt_task_entry, struct rq *this_rq)
 {
-	int idle_state = (int)state;
-	unsigned int frequency = 0;
-	struct freq_idle_event *e;
+	struct rt_dl_entry *entry = get_rt_dl_entry();
 
-	bpf_printk("[CPU%d] freq = %u idle_state = %u",
-		   cpu, frequency, idle_state);
+	if (entry)
+		entry->pull = bpf_ktime_get_boot_ns();
 
-	e = bpf_ringbuf_reserve(&freq_idle_rb, sizeof(*e), 0);
-	if (e) {
-		e->ts = bpf_ktime_get_boot_ns();
-		e->cpu = cpu;
-		e->frequency = frequency;
-		e->idle_state = idle_state;
-		e->idle_miss = 0;
-		bpf_ringbuf_submit(e, 0);
+	return 0;
+}
+
+SEC("fexit/pull_rt_task")
+int BPF_PROG(handle_pull_rt_task_exit, struct rq *this_rq)
+{
+	struct rt_dl_entry *entry = get_rt_dl_entry();
+	struct rt_dl_stats *stats;
+
+	if (!entry || !entry->pull)
+		return 0;
+
+	stats = rt_dl_stats_of(bpf_get_smp_processor_id());
+	if (stats) {
+		stats->rt_pull++;
+		stats->rt_pull_time += bpf_ktime_get_boot_ns() - entry->pull;
 	}
 
+	entry->pull = 0;
+
 	return 0;
 }
 
-SEC("raw_tp/cpu_idle_miss")
-int BPF_PROG(handle_cpu_idle_miss, unsigned int cpu,
-	     unsigned int state, bool below)
+SEC("fentry/push_dl_task")
+int BPF_PROG(handle_push_dl_task_entry, struct rq *rq)
 {
-	int idle_state = (int)state;
-	unsigned int frequency = 0;
-	struct freq_idle_event *e;
+	struct rt_dl_stats *stats = rt_dl_stats_of(bpf_get_smp_processor_id());
 
-	bpf_printk("[CPU%d] freq = %u idle_state = %u",
-		   cpu, frequency, idle_state);
+	if (stats)
+		stats->dl_push++;
 
-	e = bpf_ringbuf_reserve(&freq_idle_rb, sizeof(*e), 0);
-	if (e) {
-		e->ts = bpf_ktime_get_boot_ns();
-		e->cpu = cpu;
-		e->frequency = frequency;
-		e->idle_state = idle_state;
-		e->idle_miss = below ? -1 : 1;
-		bpf_ringbuf_submit(e, 0);
-	}
+	return 0;
+}
+
+SEC("fentry/pull_dl_task")
+int BPF_PROG(handle_pull_dl_task_entry, struct rq *this_rq)
+{
+	struct rt_dl_stats *stats = rt_dl_stats_of(bpf_get_smp_processor_id());
+
+	if (stats)
+		stats->dl_pull++;
 
 	return 0;
 }
 
-SEC("raw_tp/softirq_entry")
-int BPF_PROG(handle_softirq_entry, unsigned int vec_nr)
+/*
+ * Return the rq of rt_rq if it's the root one, only its throttling is tracked
+ * as it's what starves RT tasks of a CPU. Group rt_rqs are throttled against
+ * their own bandwidth. Without CONFIG_RT_GROUP_SCHED rt_rq has no back
+ * pointer, but the runtime is only ever checked for the local rq.
+ */
+static inline struct rq *rt_rq_root_rq(struct rt_rq *rt_rq)
+{
+	struct rt_rq___group *rt_rq_group = (void *)rt_rq;
+	struct rq *rq;
+	int cpu;
+
+	if (!bpf_ksym_exists(&runqueues))
+		return NULL;
+
+	if (bpf_core_field_exists(rt_rq_group->rq))
+		cpu = BPF_CORE_READ(rt_rq_group, rq, cpu);
+	else
+		cpu = bpf_get_smp_processor_id();
+
+	rq = bpf_per_cpu_ptr(&runqueues, cpu);
+	if (!rq || (void *)rt_rq != (void *)&rq->rt)
+		return NULL;
+
+	return rq;
+}
+
+SEC("fexit/sched_rt_runtime_exceeded")
+int BPF_PROG(handle_sched_rt_runtime_exceeded_exit, struct rt_rq *rt_rq, int ret)
 {
-	int cpu = bpf_get_smp_processor_id();
 	u64 ts = bpf_ktime_get_boot_ns();
-	bpf_map_update_elem(&softirq_entry, &cpu, &ts, BPF_ANY);
+	struct rt_dl_stats *stats;
+	struct rq *rq;
+	u64 *start;
+	int cpu;
+
+	if (!ret)
+		return 0;
+
+	rq = rt_rq_root_rq(rt_rq);
+	if (!rq)
+		return 0;
+
+	cpu = BPF_CORE_READ(rq, cpu);
+	start = bpf_map_lookup_elem(&rt_throttle_start, &cpu);
+	if (!start || *start)
+		return 0;
+
+	*start = ts;
+
+	stats = rt_dl_stats_of(cpu);
+	if (stats)
+		__sync_fetch_and_add(&stats->rt_throttled, 1);
 
 	return 0;
 }
 
-SEC("raw_tp/softirq_exit")
-int BPF_PROG(handle_softirq_exit, unsigned int vec_nr)
+/*
+ * RT throttling is lifted from the rt period timer, check which throttled
+ * CPUs got unthrottled.
+ */
+SEC("fexit/do_sched_rt_period_timer")
+int BPF_PROG(handle_do_sched_rt_period_timer_exit)
 {
-	int cpu = bpf_get_smp_processor_id();
-	u64 exit_ts = bpf_ktime_get_boot_ns();
-	struct softirq_event *e;
-	u64 entry_ts, *ts;
+	u64 ts = bpf_ktime_get_boot_ns();
+	struct rt_throttle_event *e;
+	struct rt_dl_stats *stats;
+	u64 *start, duration;
+	struct rq *rq;
+	int cpu;
 
-	ts = bpf_map_lookup_elem(&softirq_entry, &cpu);
-	if (!ts)
+	if (!bpf_ksym_exists(&runqueues))
 		return 0;
-	bpf_map_delete_elem(&softirq_entry, &cpu);
 
-	entry_ts = *ts;
+	for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+		if (cpu >= nr_cpu_ids)
+			break;
 
-	e = bpf_ringbuf_reserve(&softirq_rb, sizeof(*e), 0);
-	if (e) {
-		e->ts = entry_ts;
-		e->cpu = cpu;
-		copy_softirq(e->softirq, vec_nr);
-		e->duration = exit_ts - entry_ts;
-		bpf_ringbuf_submit(e, 0);
+		start = bpf_map_lookup_elem(&rt_throttle_start, &cpu);
+		if (!start || !*start)
+			continue;
+
+		rq = bpf_per_cpu_ptr(&runqueues, cpu);
+		if (!rq || BPF_CORE_READ(rq, rt.rt_throttled))
+			continue;
+
+		duration = ts - *start;
+		*start = 0;
+
+		stats = rt_dl_stats_of(cpu);
+		if (stats)
+			__sync_fetch_and_add(&stats->rt_throttled_time, duration);
+
+		e = bpf_ringbuf_reserve(&rt_throttle_rb, sizeof(*e), 0);
+		if (e) {
+			e->ts = ts;
+			e->cpu = cpu;
+			e->duration = duration;
+			bpf_ringbuf_submit(e, 0);
+		}
 	}
 
 	return 0;
 }
 
-SEC("kprobe/_nohz_idle_balance.isra.0")
-int BPF_PROG(handle_nohz_idle_balance_entry, struct rq *rq)
+SEC("fentry/dl_server_start")
+int BPF_PROG(handle_dl_server_start_entry, struct sched_dl_entity *dl_se)
 {
-	int this_cpu = bpf_get_smp_processor_id();
-	int lb_cpu = BPF_CORE_READ(rq, cpu);
-	u64 ts = bpf_ktime_get_boot_ns();
-	struct lb_event *e;
+	struct sched_dl_entity___server *server = (void *)dl_se;
+	struct rt_dl_stats *stats;
+	int cpu;
+	u64 *start;
 
-	int key = LB_NOHZ_IDLE_BALANCE << 16 | this_cpu;
-	bpf_map_update_elem(&lb_map, &key, &lb_cpu, BPF_ANY);
+	cpu = BPF_CORE_READ(server, rq, cpu);
+	start = bpf_map_lookup_elem(&dl_server_start_ts, &cpu);
+	if (!start || *start)
+		return 0;
 
-	e = bpf_ringbuf_reserve(&lb_rb, sizeof(*e), 0);
-	if (e) {
-		e->ts = ts;
-		e->this_cpu = this_cpu;
-		e->lb_cpu = lb_cpu;
-		e->phase = LB_NOHZ_IDLE_BALANCE;
-		e->entry = true;
-		e->overloaded = BPF_CORE_READ(rq, rd, overload);
-		e->overutilized = BPF_CORE_READ(rq, rd, overutilized);
-		e->misfit_task_load = -1;
-		bpf_ringbuf_submit(e, 0);
-	}
+	*start = bpf_ktime_get_boot_ns();
+
+	stats = rt_dl_stats_of(cpu);
+	if (stats)
+		__sync_fetch_and_add(&stats->dl_server_starts, 1);
 
 	return 0;
 }
 
-SEC("kretprobe/_nohz_idle_balance.isra.0")
-int BPF_PROG(handle_nohz_idle_balance_exit)
+SEC("fentry/dl_server_stop")
+int BPF_PROG(handle_dl_server_stop_entry, struct sched_dl_entity *dl_se)
 {
-	int this_cpu = bpf_get_smp_processor_id();
-	u64 ts = bpf_ktime_get_boot_ns();
-	struct lb_event *e;
+	struct sched_dl_entity___server *server = (void *)dl_se;
+	struct rt_dl_stats *stats;
+	u64 *start;
+	int cpu;
 
-	int key = LB_NOHZ_IDLE_BALANCE << 16 | this_cpu;
-	int *lb_cpu = bpf_map_lookup_elem(&lb_map, &key);
-	if (!lb_cpu)
+	cpu = BPF_CORE_READ(server, rq, cpu);
+	start = bpf_map_lookup_elem(&dl_server_start_ts, &cpu);
+	if (!start || !*start)
 		return 0;
-	bpf_map_delete_elem(&lb_map, &key);
 
-	e = bpf_ringbuf_reserve(&lb_rb, sizeof(*e), 0);
-	if (e) {
-		e->ts = ts;
-		e->this_cpu = this_cpu;
-		e->lb_cpu = *lb_cpu;
-		e->phase = LB_NOHZ_IDLE_BALANCE;
-		e->entry = false;
-		e->overloaded = -1;
-		e->overutilized = -1;
-		e->misfit_task_load = -1;
-		bpf_ringbuf_submit(e, 0);
-	}
+	stats = rt_dl_stats_of(cpu);
+	if (stats)
+		__sync_fetch_and_add(&stats->dl_server_time, bpf_ktime_get_boot_ns() - *start);
+
+	*start = 0;
 
 	return 0;
 }
 
-SEC("kprobe/run_rebalance_domains")
-int BPF_PROG(handle_run_rebalance_domains_entry)
+static const struct eevdf_stats zero_eevdf_stats;
+
+static inline bool task_is_fair(struct task_struct *p)
 {
-	int this_cpu = bpf_get_smp_processor_id();
-	u64 ts = bpf_ktime_get_boot_ns();
-	struct lb_event *e;
+	unsigned int policy = BPF_CORE_READ(p, policy);
 
-	e = bpf_ringbuf_reserve(&lb_rb, sizeof(*e), 0);
+	/* SCHED_NORMAL, SCHED_BATCH and SCHED_IDLE */
+	return policy == 0 || policy == 3 || policy == 5;
+}
+
+static inline void eevdf_emit(struct task_struct *p, int cpu, u64 ts, int running)
+{
+	struct eevdf_event *e;
+
+	e = bpf_ringbuf_reserve(&eevdf_rb, sizeof(*e), 0);
 	if (e) {
 		e->ts = ts;
-		e->this_cpu = this_cpu;
-		e->lb_cpu = this_cpu;
-		e->phase = LB_RUN_REBALANCE_DOMAINS;
-		e->entry = true;
-		e->overloaded = -1;
-		e->overutilized = -1;
-		e->misfit_task_load = -1;
+		e->cpu = cpu;
+		e->pid = BPF_CORE_READ(p, pid);
+		BPF_CORE_READ_STR_INTO(&e->comm, p, comm);
+		e->vlag = BPF_CORE_READ(p, se.vlag);
+		e->vruntime = BPF_CORE_READ(p, se.vruntime);
+		e->deadline = BPF_CORE_READ(p, se.deadline);
+		e->slice = BPF_CORE_READ(p, se.slice);
+		e->running = running;
 		bpf_ringbuf_submit(e, 0);
 	}
+}
 
-	return 0;
+/*
+ * se->vlag is only updated when the entity is dequeued, so the lag histogram
+ * only accounts tasks that are switched out to sleep. With DELAY_DEQUEUE
+ * (6.12+) a task that isn't eligible, ie: with negative lag, stays queued as
+ * sched_delayed when it blocks. Its vlag is only updated once the delayed
+ * dequeue completes, which handle_eevdf_dequeue_entities_exit() accounts.
+ */
+static inline bool eevdf_dequeue_delayed(struct task_struct *p)
+{
+	struct sched_entity___delayed *se = (void *)&p->se;
+
+	if (!bpf_core_field_exists(se->sched_delayed))
+		return false;
+
+	return BPF_CORE_READ(se, sched_delayed);
 }
 
-SEC("kretprobe/run_rebalance_domains")
-int BPF_PROG(handle_run_rebalance_domains_exit)
+/*
+ * Without a hook on the delayed dequeue only tasks with positive lag would be
+ * accounted, don't pretend to have a lag distribution then.
+ */
+static inline bool eevdf_lag_accountable(void)
 {
-	int this_cpu = bpf_get_smp_processor_id();
+	struct sched_entity___delayed *se = NULL;
+
+	return !bpf_core_field_exists(se->sched_delayed) || eevdf_dequeue_hooked;
+}
+
+static inline void eevdf_account_lag(struct task_struct *p)
+{
+	struct eevdf_stats *stats;
+	pid_t pid = BPF_CORE_READ(p, pid);
+	s64 vlag;
+
+	stats = bpf_map_lookup_elem(&eevdf_stats, &pid);
+	if (!stats) {
+		bpf_map_update_elem(&eevdf_stats, &pid, &zero_eevdf_stats, BPF_NOEXIST);
+		stats = bpf_map_lookup_elem(&eevdf_stats, &pid);
+		if (!stats)
+			return;
+		BPF_CORE_READ_STR_INTO(&stats->comm, p, comm);
+	}
+
+	vlag = BPF_CORE_READ(p, se.vlag);
+	if (vlag >= 0)
+		hist_add(&stats->pos_lag, vlag);
+	else
+		hist_add(&stats->neg_lag, -vlag);
+
+	stats->slice = BPF_CORE_READ(p, se.slice);
+}
+
+SEC("raw_tp/sched_switch")
+int BPF_PROG(handle_eevdf_switch, bool preempt,
+	     struct task_struct *prev, struct task_struct *next)
+{
+	int cpu = bpf_get_smp_processor_id();
 	u64 ts = bpf_ktime_get_boot_ns();
-	struct lb_event *e;
+	bool filtered = sa_opts.num_pids || sa_opts.num_comms || sa_opts.num_cgroups;
 
-	e = bpf_ringbuf_reserve(&lb_rb, sizeof(*e), 0);
-	if (e) {
-		e->ts = ts;
-		e->this_cpu = this_cpu;
-		e->lb_cpu = this_cpu;
-		e->phase = LB_RUN_REBALANCE_DOMAINS;
-		e->entry = false;
-		e->overloaded = -1;
-		e->overutilized = -1;
-		e->misfit_task_load = -1;
-		bpf_ringbuf_submit(e, 0);
+	/* EEVDF, 6.6+ */
+	if (!bpf_core_field_exists(prev->se.vlag))
+		return 0;
+
+	if (BPF_CORE_READ(prev, pid) && !ignore_task(prev)) {
+		/* Only a fair task going to sleep got its vlag updated on dequeue */
+		if (!preempt && get_task_state(prev) && task_is_fair(prev) &&
+		    eevdf_lag_accountable() && !eevdf_dequeue_delayed(prev))
+			eevdf_account_lag(prev);
+		/* Records would flood the ring buffer for every task in the system */
+		if (filtered)
+			eevdf_emit(prev, cpu, ts, 0);
 	}
 
+	if (filtered && BPF_CORE_READ(next, pid) && !ignore_task(next))
+		eevdf_emit(next, cpu, ts, 1);
+
 	return 0;
 }
 
-static void gen_sched_domain_stats(struct rq *rq, enum cpu_idle_type idle,
-				   struct lb_sd_stats *sd_stats)
+#define DEQUEUE_DELAYED		0x200
+
+/* The delayed dequeue of a sleeping task completed, vlag is now up to date */
+SEC("fexit/dequeue_entities")
+int BPF_PROG(handle_eevdf_dequeue_entities_exit, struct rq *rq,
+	     struct sched_entity *se, int flags, int ret)
 {
-	struct sched_domain *sd = BPF_CORE_READ(rq, sd);
-	int cpu = BPF_CORE_READ(rq, cpu);
-	int i = 0;
+	struct task_struct *p;
 
-	bool sched_idle = BPF_CORE_READ(rq, nr_running) == BPF_CORE_READ(rq, cfs.idle_h_nr_running);
-	sched_idle = sched_idle && BPF_CORE_READ(rq, nr_running);
-	bool busy = idle != CPU_IDLE && !sched_idle;
+	if (!(flags & DEQUEUE_DELAYED) || !entity_is_task(se))
+		return 0;
 
-	sd_stats->cpu = cpu;
+	p = container_of(se, struct task_struct, se);
+	if (BPF_CORE_READ(p, pid) && !ignore_task(p))
+		eevdf_account_lag(p);
 
-	while (sd && i < MAX_SD_LEVELS) {
-		unsigned int interval = BPF_CORE_READ(sd, balance_interval);
-		if (busy)
-			interval *= BPF_CORE_READ(sd, busy_factor);
+	return 0;
+}
 
-		sd_stats->level[i] = BPF_CORE_READ(sd, level);
-		sd_stats->balance_interval[i] = interval;
+SEC("fentry/find_energy_efficient_cpu")
+int BPF_PROG(handle_feec_entry)
+{
+	struct eas_state *state;
+	int zero = 0;
 
-		sd = BPF_CORE_READ(sd, parent);
-		i++;
+	state = bpf_map_lookup_elem(&eas_state, &zero);
+	if (state) {
+		state->pd = 0;
+		state->nr_candidates = 0;
 	}
 
-	sd_stats->level[i] = -1;
-	sd_stats->balance_interval[i] = 0;
+	return 0;
 }
 
-SEC("kprobe/rebalance_domains")
-int BPF_PROG(handle_rebalance_domains_entry, struct rq *rq, enum cpu_idle_type idle)
+/*
+ * From 6.0 find_energy_efficient_cpu() first computes the energy of every
+ * performance domain without the task (dst_cpu == -1), then with the task on
+ * prev_cpu and on the CPU with the most spare capacity.
+ */
+SEC("fexit/compute_energy")
+int BPF_PROG(handle_compute_energy_exit, struct energy_env *eenv,
+	     struct perf_domain *pd, struct cpumask *pd_cpus,
+	     struct task_struct *p, int dst_cpu, unsigned long energy)
 {
-	int this_cpu = bpf_get_smp_processor_id();
-	int lb_cpu = BPF_CORE_READ(rq, cpu);
-	u64 ts = bpf_ktime_get_boot_ns();
-	struct lb_event *e;
+	struct eas_candidate *cand;
+	struct eas_state *state;
+	unsigned long mask;
+	unsigned int nr;
+	int zero = 0;
+	int i;
+
+	/* Older kernels had compute_energy(p, dst_cpu, pd) */
+	if (!bpf_core_type_exists(struct energy_env))
+		return 0;
+
+	state = bpf_map_lookup_elem(&eas_state, &zero);
+	if (!state)
+		return 0;
+
+	if (dst_cpu < 0) {
+		state->pd = (u64)pd;
+		state->base_energy = energy;
+		state->pd_cpu = -1;
+
+		mask = BPF_CORE_READ(pd, em_pd, cpus[0]);
+		for (i = 0; i < 64; i++) {
+			if (mask & (1UL << i)) {
+				state->pd_cpu = i;
+				break;
+			}
+		}
+		return 0;
+	}
+
+	if (state->pd != (u64)pd)
+		return 0;
 
-	int key = LB_REBALANCE_DOMAINS << 16 | this_cpu;
-	bpf_map_update_elem(&lb_map, &key, &lb_cpu, BPF_ANY);
+	nr = state->nr_candidates;
+	if (nr >= EAS_MAX_CANDIDATES)
+		return 0;
 
-	e = bpf_ringbuf_reserve(&lb_rb, sizeof(*e), 0);
-	if (e) {
-		e->ts = ts;
-		e->this_cpu = this_cpu;
-		e->lb_cpu = lb_cpu;
-		e->phase = LB_REBALANCE_DOMAINS;
-		e->entry = true;
-		e->overloaded = BPF_CORE_READ(rq, rd, overload);
-		e->overutilized = BPF_CORE_READ(rq, rd, overutilized);
-		e->misfit_task_load = BPF_CORE_READ(rq, misfit_task_load);
-		gen_sched_domain_stats(rq, idle, &e->sd_stats);
-		bpf_ringbuf_submit(e, 0);
-	}
+	cand = &state->candidates[nr];
+	cand->pd_cpu = state->pd_cpu;
+	cand->dst_cpu = dst_cpu;
+	cand->delta = (s64)energy - (s64)state->base_energy;
+	state->nr_candidates = nr + 1;
 
 	return 0;
 }
 
-SEC("kretprobe/rebalance_domains")
-int BPF_PROG(handle_rebalance_domains_exit)
+SEC("fexit/find_energy_efficient_cpu")
+int BPF_PROG(handle_feec_exit, struct task_struct *p, int prev_cpu, int target)
 {
-	int this_cpu = bpf_get_smp_processor_id();
-	u64 ts = bpf_ktime_get_boot_ns();
-	struct lb_event *e;
+	s64 prev_delta = 0, target_delta = 0;
+	bool prev_found = false, target_found = false;
+	struct eas_stats *stats;
+	struct eas_state *state;
+	struct task_ctx *tctx;
+	struct eas_event *e;
+	unsigned int nr;
+	int zero = 0;
+	int i;
+
+	state = bpf_map_lookup_elem(&eas_state, &zero);
+	if (!state)
+		return 0;
 
-	int key = LB_REBALANCE_DOMAINS << 16 | this_cpu;
-	int *lb_cpu = bpf_map_lookup_elem(&lb_map, &key);
-	if (!lb_cpu)
+	nr = state->nr_candidates;
+	if (nr > EAS_MAX_CANDIDATES)
+		nr = EAS_MAX_CANDIDATES;
+
+	for (i = 0; i < EAS_MAX_CANDIDATES; i++) {
+		if (i >= nr)
+			break;
+		if (state->candidates[i].dst_cpu == prev_cpu) {
+			prev_delta = state->candidates[i].delta;
+			prev_found = true;
+		}
+		if (state->candidates[i].dst_cpu == target) {
+			target_delta = state->candidates[i].delta;
+			target_found = true;
+		}
+	}
+
+	stats = bpf_map_lookup_elem(&eas_stats, &zero);
+	if (stats) {
+		stats->decisions++;
+		stats->candidates += nr;
+		if (target == prev_cpu)
+			stats->prev_cpu++;
+		else if (prev_found && target_found && prev_delta > target_delta)
+			stats->saved += prev_delta - target_delta;
+	}
+
+	if (ignore_task(p))
 		return 0;
-	bpf_map_delete_elem(&lb_map, &key);
 
-	e = bpf_ringbuf_reserve(&lb_rb, sizeof(*e), 0);
+	/* Only emit 1 in energy_sample decisions of every task */
+	tctx = bpf_task_storage_get(&task_ctx_map, p, 0,
+				    BPF_LOCAL_STORAGE_GET_F_CREATE);
+	if (!tctx)
+		return 0;
+
+	if (tctx->eas_count++ % sa_opts.energy_sample)
+		return 0;
+
+	e = bpf_ringbuf_reserve(&eas_rb, sizeof(*e), 0);
 	if (e) {
-		e->ts = ts;
-		e->this_cpu = this_cpu;
-		e->lb_cpu = *lb_cpu;
-		e->phase = LB_REBALANCE_DOMAINS;
-		e->entry = false;
-		e->overloaded = -1;
-		e->overutilized = -1;
-		e->misfit_task_load = -1;
+		e->ts = bpf_ktime_get_boot_ns();
+		e->cpu = bpf_get_smp_processor_id();
+		e->pid = BPF_CORE_READ(p, pid);
+		BPF_CORE_READ_STR_INTO(&e->comm, p, comm);
+		e->prev_cpu = prev_cpu;
+		e->target_cpu = target;
+		e->nr_candidates = nr;
+		__builtin_memcpy(e->candidates, state->candidates, sizeof(e->candidates));
 		bpf_ringbuf_submit(e, 0);
 	}
 
 	return 0;
 }
 
-SEC("kprobe/balance_fair")
-int BPF_PROG(handle_balance_fair_entry, struct rq *rq)
+/* Account time a CPU was busy at its current frequency, up to ts */
+static inline void energy_account_busy(struct energy_cpu *ecpu, int cpu, u64 ts)
 {
-	int this_cpu = bpf_get_smp_processor_id();
-	int lb_cpu = BPF_CORE_READ(rq, cpu);
-	u64 ts = bpf_ktime_get_boot_ns();
-	struct lb_event *e;
+	struct energy_busy_key key = {};
+	u64 *busy, zero = 0;
 
-	int key = LB_BALANCE_FAIR << 16 | this_cpu;
-	bpf_map_update_elem(&lb_map, &key, &lb_cpu, BPF_ANY);
+	if (!ecpu->ts || ecpu->idle || !ecpu->freq || ts <= ecpu->ts)
+		return;
 
-	e = bpf_ringbuf_reserve(&lb_rb, sizeof(*e), 0);
-	if (e) {
-		e->ts = ts;
-		e->this_cpu = this_cpu;
-		e->lb_cpu = lb_cpu;
-		e->phase = LB_BALANCE_FAIR;
-		e->entry = true;
-		e->overloaded = BPF_CORE_READ(rq, rd, overload);
-		e->overutilized = BPF_CORE_READ(rq, rd, overutilized);
-		e->misfit_task_load = BPF_CORE_READ(rq, misfit_task_load);
-		bpf_ringbuf_submit(e, 0);
+	key.cpu = cpu;
+	key.freq = ecpu->freq;
+
+	busy = bpf_map_lookup_elem(&energy_busy, &key);
+	if (!busy) {
+		bpf_map_update_elem(&energy_busy, &key, &zero, BPF_NOEXIST);
+		busy = bpf_map_lookup_elem(&energy_busy, &key);
 	}
+	if (busy)
+		__sync_fetch_and_add(busy, ts - ecpu->ts);
+}
 
-	return 0;
+/*
+ * Only ever called on the CPU itself. A frequency change posted from another
+ * CPU of the policy is applied first, at the time it happened.
+ */
+static inline void energy_account(int cpu, u64 ts, int idle)
+{
+	struct energy_cpu *ecpu;
+	u64 next_ts;
+	u32 freq;
+
+	if (cpu < 0 || cpu >= MAX_CPUS)
+		return;
+
+	ecpu = bpf_map_lookup_elem(&energy_cpu, &cpu);
+	if (!ecpu)
+		return;
+
+	if (!ecpu->freq)
+		ecpu->freq = cpu_init_freq[cpu];
+
+	freq = __sync_lock_test_and_set(&ecpu->next_freq, 0);
+	if (freq) {
+		next_ts = ecpu->next_ts;
+		if (next_ts > ts)
+			next_ts = ts;
+		if (next_ts > ecpu->ts) {
+			energy_account_busy(ecpu, cpu, next_ts);
+			ecpu->ts = next_ts;
+		}
+		ecpu->freq = freq;
+	}
+
+	energy_account_busy(ecpu, cpu, ts);
+
+	ecpu->ts = ts;
+	if (idle >= 0)
+		ecpu->idle = idle;
 }
 
-SEC("kretprobe/balance_fair")
-int BPF_PROG(handle_balance_fair_exit)
+SEC("raw_tp/cpu_frequency")
+int BPF_PROG(handle_energy_cpu_frequency, unsigned int frequency, unsigned int cpu)
 {
-	int this_cpu = bpf_get_smp_processor_id();
 	u64 ts = bpf_ktime_get_boot_ns();
-	struct lb_event *e;
+	struct energy_cpu *ecpu;
+	int idx = cpu;
 
-	int key = LB_BALANCE_FAIR << 16 | this_cpu;
-	int *lb_cpu = bpf_map_lookup_elem(&lb_map, &key);
-	if (!lb_cpu)
+	if (cpu >= MAX_CPUS || !frequency)
 		return 0;
-	bpf_map_delete_elem(&lb_map, &key);
 
-	e = bpf_ringbuf_reserve(&lb_rb, sizeof(*e), 0);
-	if (e) {
-		e->ts = ts;
-		e->this_cpu = this_cpu;
-		e->lb_cpu = *lb_cpu;
-		e->phase = LB_BALANCE_FAIR;
-		e->entry = false;
-		e->overloaded = -1;
-		e->overutilized = -1;
-		e->misfit_task_load = -1;
-		bpf_ringbuf_submit(e, 0);
-	}
+	ecpu = bpf_map_lookup_elem(&energy_cpu, &idx);
+	if (!ecpu)
+		return 0;
+
+	ecpu->next_ts = ts;
+	__sync_lock_test_and_set(&ecpu->next_freq, frequency);
+
+	if (cpu == bpf_get_smp_processor_id())
+		energy_account(cpu, ts, -1);
 
 	return 0;
 }
 
-SEC("kprobe/pick_next_task_fair")
-int BPF_PROG(handle_pick_next_task_fair_entry, struct rq *rq)
+/* Always emitted by the CPU entering or leaving idle */
+SEC("raw_tp/cpu_idle")
+int BPF_PROG(handle_energy_cpu_idle, unsigned int state, unsigned int cpu)
 {
-	int this_cpu = bpf_get_smp_processor_id();
-	int lb_cpu = BPF_CORE_READ(rq, cpu);
-	u64 ts = bpf_ktime_get_boot_ns();
-	struct lb_event *e;
+	/* PWR_EVENT_EXIT */
+	energy_account(cpu, bpf_ktime_get_boot_ns(), state != (unsigned int)-1);
 
-	int key = LB_PICK_NEXT_TASK_FAIR << 16 | this_cpu;
-	bpf_map_update_elem(&lb_map, &key, &lb_cpu, BPF_ANY);
+	return 0;
+}
 
-	e = bpf_ringbuf_reserve(&lb_rb, sizeof(*e), 0);
-	if (e) {
-		e->ts = ts;
-		e->this_cpu = this_cpu;
-		e->lb_cpu = lb_cpu;
-		e->phase = LB_PICK_NEXT_TASK_FAIR;
-		e->entry = true;
-		e->overloaded = BPF_CORE_READ(rq, rd, overload);
-		e->overutilized = BPF_CORE_READ(rq, rd, overutilized);
-		e->misfit_task_load = BPF_CORE_READ(rq, misfit_task_load);
-		bpf_ringbuf_submit(e, 0);
+/*
+ * Account the time the task running on a CPU spent at its current frequency.
+ * The same task and frequency can be accounted from several CPUs, hence the
+ * atomic.
+ */
+static inline void freq_residency_account(struct freq_residency_cpu *fcpu, u64 ts)
+{
+	struct freq_residency_key key = {};
+	struct freq_residency *res;
+
+	if (!fcpu->tracked || !fcpu->freq || ts <= fcpu->ts)
+		return;
+
+	key.pid = fcpu->pid;
+	key.freq = fcpu->freq;
+
+	res = bpf_map_lookup_elem(&freq_residency, &key);
+	if (!res) {
+		struct freq_residency zero = {};
+
+		__builtin_memcpy(zero.comm, fcpu->comm, sizeof(zero.comm));
+		if (!bpf_map_update_elem(&freq_residency, &key, &zero, BPF_NOEXIST))
+			__sync_fetch_and_add(&freq_residency_inserts, 1);
+		res = bpf_map_lookup_elem(&freq_residency, &key);
+		if (!res) {
+			__sync_fetch_and_add(&freq_residency_drops, 1);
+			return;
+		}
 	}
 
-	return 0;
+	__sync_fetch_and_add(&res->time, ts - fcpu->ts);
 }
 
-SEC("kretprobe/pick_next_task_fair")
-int BPF_PROG(handle_pick_next_task_fair_exit)
+/*
+ * Switch to the frequency cpu_frequency posted, closing the time spent at the
+ * old one when the change happened.
+ */
+static inline void freq_residency_sync(struct freq_residency_cpu *fcpu, u64 ts)
 {
-	int this_cpu = bpf_get_smp_processor_id();
-	u64 ts = bpf_ktime_get_boot_ns();
-	struct lb_event *e;
+	u32 freq = __sync_lock_test_and_set(&fcpu->next_freq, 0);
+	u64 next_ts = fcpu->next_ts;
 
-	int key = LB_PICK_NEXT_TASK_FAIR << 16 | this_cpu;
-	int *lb_cpu = bpf_map_lookup_elem(&lb_map, &key);
-	if (!lb_cpu)
-		return 0;
-	bpf_map_delete_elem(&lb_map, &key);
+	if (!freq)
+		return;
 
-	e = bpf_ringbuf_reserve(&lb_rb, sizeof(*e), 0);
-	if (e) {
-		e->ts = ts;
-		e->this_cpu = this_cpu;
-		e->lb_cpu = *lb_cpu;
-		e->phase = LB_PICK_NEXT_TASK_FAIR;
-		e->entry = false;
-		e->overloaded = -1;
-		e->overutilized = -1;
-		e->misfit_task_load = -1;
-		bpf_ringbuf_submit(e, 0);
+	if (next_ts > ts)
+		next_ts = ts;
+	if (next_ts > fcpu->ts) {
+		freq_residency_account(fcpu, next_ts);
+		fcpu->ts = next_ts;
 	}
-
-	return 0;
+	fcpu->freq = freq;
 }
 
-SEC("kprobe/newidle_balance")
-int BPF_PROG(handle_newidle_balance_entry, struct rq *rq)
+SEC("raw_tp/sched_switch")
+int BPF_PROG(handle_freq_residency_switch, bool preempt,
+	     struct task_struct *prev, struct task_struct *next)
 {
-	int this_cpu = bpf_get_smp_processor_id();
-	int lb_cpu = BPF_CORE_READ(rq, cpu);
+	int cpu = bpf_get_smp_processor_id();
 	u64 ts = bpf_ktime_get_boot_ns();
-	struct lb_event *e;
+	struct freq_residency_cpu *fcpu;
 
-	int key = LB_NEWIDLE_BALANCE << 16 | this_cpu;
-	bpf_map_update_elem(&lb_map, &key, &lb_cpu, BPF_ANY);
+	if (cpu >= MAX_CPUS)
+		return 0;
 
-	e = bpf_ringbuf_reserve(&lb_rb, sizeof(*e), 0);
-	if (e) {
-		e->ts = ts;
-		e->this_cpu = this_cpu;
-		e->lb_cpu = lb_cpu;
-		e->phase = LB_NEWIDLE_BALANCE;
-		e->entry = true;
-		e->overloaded = BPF_CORE_READ(rq, rd, overload);
-		e->overutilized = BPF_CORE_READ(rq, rd, overutilized);
-		e->misfit_task_load = BPF_CORE_READ(rq, misfit_task_load);
-		bpf_ringbuf_submit(e, 0);
-	}
+	fcpu = bpf_map_lookup_elem(&freq_residency_cpu, &cpu);
+	if (!fcpu)
+		return 0;
+
+	if (!fcpu->freq)
+		fcpu->freq = cpu_init_freq[cpu];
+
+	freq_residency_sync(fcpu, ts);
+	freq_residency_account(fcpu, ts);
+
+	fcpu->ts = ts;
+	fcpu->pid = BPF_CORE_READ(next, pid);
+	fcpu->tracked = fcpu->pid && !ignore_task(next);
+	if (fcpu->tracked)
+		BPF_CORE_READ_STR_INTO(&fcpu->comm, next, comm);
 
 	return 0;
 }
 
-SEC("kretprobe/newidle_balance")
-int BPF_PROG(handle_newidle_balance_exit)
+/*
+ * Can be emitted from another CPU of the policy, only post the new frequency
+ * and let the CPU switch to it itself.
+ */
+SEC("raw_tp/cpu_frequency")
+int BPF_PROG(handle_freq_residency_cpu_frequency, unsigned int frequency, unsigned int cpu)
 {
-	int this_cpu = bpf_get_smp_processor_id();
 	u64 ts = bpf_ktime_get_boot_ns();
-	struct lb_event *e;
+	struct freq_residency_cpu *fcpu;
+	int idx = cpu;
 
-	int key = LB_NEWIDLE_BALANCE << 16 | this_cpu;
-	int *lb_cpu = bpf_map_lookup_elem(&lb_map, &key);
-	if (!lb_cpu)
+	if (cpu >= MAX_CPUS || !frequency)
 		return 0;
-	bpf_map_delete_elem(&lb_map, &key);
 
-	e = bpf_ringbuf_reserve(&lb_rb, sizeof(*e), 0);
-	if (e) {
-		e->ts = ts;
-		e->this_cpu = this_cpu;
-		e->lb_cpu = *lb_cpu;
-		e->phase = LB_NEWIDLE_BALANCE;
-		e->entry = false;
-		e->overloaded = -1;
-		e->overutilized = -1;
-		e->misfit_task_load = -1;
-		bpf_ringbuf_submit(e, 0);
-	}
+	fcpu = bpf_map_lookup_elem(&freq_residency_cpu, &idx);
+	if (!fcpu)
+		return 0;
+
+	fcpu->next_ts = ts;
+	__sync_lock_test_and_set(&fcpu->next_freq, frequency);
+
+	if (cpu == bpf_get_smp_processor_id())
+		freq_residency_sync(fcpu, ts);
 
 	return 0;
 }
 
-SEC("kprobe/load_balance")
-int BPF_PROG(handle_load_balance_entry, int lb_cpu, struct rq *lb_rq,
-	     struct sched_domain *sd, enum cpu_idle_type idle)
+static inline void emit_task_pelt_running(struct task_struct *p, int cpu, int running)
 {
-	int this_cpu = bpf_get_smp_processor_id();
-	u64 ts = bpf_ktime_get_boot_ns();
-	struct lb_event *e;
+	unsigned long util_est_enqueued, util_est_ewma;
+	struct task_pelt_event *e;
 
-	int key = LB_LOAD_BALANCE << 16 | this_cpu;
-	bpf_map_update_elem(&lb_map, &key, &lb_cpu, BPF_ANY);
+	read_util_est(&p->se, &util_est_enqueued, &util_est_ewma);
 
-	e = bpf_ringbuf_reserve(&lb_rb, sizeof(*e), 0);
+	e = bpf_ringbuf_reserve(&task_pelt_rb, sizeof(*e), 0);
 	if (e) {
-		e->ts = ts;
-		e->this_cpu = this_cpu;
-		e->lb_cpu = lb_cpu;
-		e->phase = LB_LOAD_BALANCE;
-		e->entry = true;
-		e->overloaded = BPF_CORE_READ(lb_rq, rd, overload);
-		e->overutilized = BPF_CORE_READ(lb_rq, rd, overutilized);
-		e->misfit_task_load = BPF_CORE_READ(lb_rq, misfit_task_load);
+		e->ts = bpf_ktime_get_boot_ns();
+		e->cpu = cpu;
+		e->pid = BPF_CORE_READ(p, pid);
+		BPF_CORE_READ_STR_INTO(&e->comm, p, comm);
+		e->load_avg = BPF_CORE_READ(p, se.avg.load_avg);
+		e->runnable_avg = BPF_CORE_READ(p, se.avg.runnable_avg);
+		e->util_avg = BPF_CORE_READ(p, se.avg.util_avg);
+		e->util_est_enqueued = util_est_enqueued & ~UTIL_AVG_UNCHANGED;
+		e->util_est_ewma = util_est_ewma;
+		e->uclamp_min = -1;
+		e->uclamp_max = -1;
+		e->running = running;
 		bpf_ringbuf_submit(e, 0);
 	}
+}
+
+/*
+ * PELT signals of a task are only updated when it's enqueued, dequeued or
+ * ticked. Emit them at context switch too so running gated signals start and
+ * drop exactly when the task does.
+ */
+SEC("raw_tp/sched_switch")
+int BPF_PROG(handle_pelt_running_switch, bool preempt,
+	     struct task_struct *prev, struct task_struct *next)
+{
+	int cpu = bpf_get_smp_processor_id();
+
+	if (BPF_CORE_READ(prev, pid) && !ignore_task(prev) && task_pelt_gate(prev, -1, -1))
+		emit_task_pelt_running(prev, cpu, 0);
+
+	if (BPF_CORE_READ(next, pid) && !ignore_task(next) && task_pelt_gate(next, -1, -1))
+		emit_task_pelt_running(next, cpu, 1);
 
 	return 0;
 }
 
-SEC("kretprobe/load_balance")
-int BPF_PROG(handle_load_balance_exit)
+/*
+ * Remove what an exiting task contributed to its process. PF_EXITING is set
+ * by now so nothing is accounted for it anymore.
+ */
+SEC("raw_tp/sched_process_exit")
+int BPF_PROG(handle_pelt_tgid_exit, struct task_struct *p)
 {
-	int this_cpu = bpf_get_smp_processor_id();
-	u64 ts = bpf_ktime_get_boot_ns();
-	struct lb_event *e;
+	struct tgid_pelt *pelt;
+	struct task_ctx *tctx;
 
-	int key = LB_LOAD_BALANCE << 16 | this_cpu;
-	int *lb_cpu = bpf_map_lookup_elem(&lb_map, &key);
-	if (!lb_cpu)
+	tctx = bpf_task_storage_get(&task_ctx_map, p, 0, 0);
+	if (!tctx)
 		return 0;
-	bpf_map_delete_elem(&lb_map, &key);
 
-	e = bpf_ringbuf_reserve(&lb_rb, sizeof(*e), 0);
-	if (e) {
-		e->ts = ts;
-		e->this_cpu = this_cpu;
-		e->lb_cpu = *lb_cpu;
-		e->phase = LB_LOAD_BALANCE;
-		e->entry = false;
-		e->overloaded = -1;
-		e->overutilized = -1;
-		e->misfit_task_load = -1;
-		bpf_ringbuf_submit(e, 0);
-	}
+	pelt = lookup_tgid_pelt(p);
+	if (!pelt)
+		return 0;
+
+	pelt->util_avg -= tctx->tgid_util_avg;
+	pelt->runnable_avg -= tctx->tgid_runnable_avg;
+	pelt->util_est -= tctx->tgid_util_est;
+
+	tctx->tgid_util_avg = 0;
+	tctx->tgid_runnable_avg = 0;
+	tctx->tgid_util_est = 0;
 
 	return 0;
 }
 
-SEC("raw_tp/ipi_send_cpu")
-int BPF_PROG(handle_ipi_send_cpu, int cpu, void *callsite, void *callback)
+/*
+ * Most task events are filtered by --pid and --comm in userspace only. Keep
+ * track of the tasks in a --cgroup as they run so userspace can match them
+ * too; a task that moved out is forgotten the next time it runs.
+ */
+SEC("raw_tp/sched_switch")
+int BPF_PROG(handle_cgroup_filter_switch, bool preempt,
+	     struct task_struct *prev, struct task_struct *next)
 {
-	u64 ts = bpf_ktime_get_boot_ns();
-	struct ipi_event *e;
+	pid_t pid = BPF_CORE_READ(next, pid);
+	bool filtered, known, value = true;
 
-	e = bpf_ringbuf_reserve(&ipi_rb, sizeof(*e), 0);
-	if (e) {
-		e->ts = ts;
-		e->from_cpu = bpf_get_smp_processor_id();
-		e->target_cpu = cpu;
-		e->callsite = callsite;
-		e->callback = callback;
-		bpf_ringbuf_submit(e, 0);
-	}
+	if (!pid)
+		return 0;
+
+	filtered = cgroup_is_filtered(task_cgroup_id(next));
+	known = bpf_map_lookup_elem(&cgroup_tasks, &pid) != NULL;
+
+	if (filtered && !known)
+		bpf_map_update_elem(&cgroup_tasks, &pid, &value, BPF_ANY);
+	else if (!filtered && known)
+		bpf_map_delete_elem(&cgroup_tasks, &pid);
 
 	return 0;
 }
@@ -1,13 +1,22 @@
 /* SPDX-License-Identifier: GPL-2.0 */
 /* Copyright (C) 2022 Qais Yousef */
+#include <bpf/bpf.h>
+#include <bpf/btf.h>
 #include <bpf/libbpf.h>
+#include <dirent.h>
 #include <errno.h>
+#include <linux/perf_event.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "parse_argp.h"
+#include "parse_cgroups.h"
 #include "parse_kallsyms.h"
 #include "perfetto_wrapper.h"
 
@@ -23,17 +32,80 @@
 #define clamp(val, lo, hi)    ((val) >= (hi) ? (hi) : ((val) <= (lo) ? (lo) : (val)))
 
 static volatile bool exiting = false;
+static int nr_cpus;
+
+/* Set when the hw counters are not available and we fell back to cpu-clock */
+static bool pmu_fallback;
+static bool asym_capacity;
+static int *pmu_fds;
+
+static const char *softirq_names[MAX_SOFTIRQS] = {
+	"hi", "timer", "net_tx", "net_rx", "block",
+	"irq_poll", "tasklet", "sched", "hrtimer", "rcu",
+};
+
+static const char *placement_path_names[NR_PLACEMENT_PATHS] = {
+	"other", "eas", "fast", "slow",
+};
+
+static const char *placement_outcome_names[NR_PLACEMENT_OUTCOMES] = {
+	"prev_cpu", "waker_cpu", "other_cpu",
+};
+
+static const char *idle_gov_outcome_names[NR_IDLE_GOV_OUTCOMES] = {
+	"hits", "too_deep", "too_shallow",
+};
+
+static char *stack_source_names[NR_STACK_SOURCES] = {
+	"wakeup_latency", "load_balance", "softirq", "rq_lock",
+};
+
+/* Symbolized stacks, indexed by stack id */
+static char *stack_strs[STACK_MAP_SIZE];
+
+static const char *migrate_class_names[NR_MIGRATE_CLASSES] = {
+	"same_llc", "cross_llc", "cross_node", "numa_move", "numa_swap",
+};
+
+static const char *psi_stat_names[NR_PSI_STATS] = {
+	"cpu_some", "cpu_full", "mem_some", "mem_full", "io_some", "io_full",
+};
+
+static char *lb_phase_names[NR_LB_PHASES] = {
+	[LB_NOHZ_IDLE_BALANCE]		= "_nohz_idle_balance()",
+	[LB_RUN_REBALANCE_DOMAINS]	= "run_rebalance_domains()",
+	[LB_REBALANCE_DOMAINS]		= "rebalance_domains()",
+	[LB_BALANCE_FAIR]		= "balance_fair()",
+	[LB_PICK_NEXT_TASK_FAIR]	= "pick_next_task_fair()",
+	[LB_NEWIDLE_BALANCE]		= "newidle_balance()",
+	[LB_LOAD_BALANCE]		= "load_balance()",
+};
+
+static const char *migration_type_names[NR_LB_MIGRATION_TYPES] = {
+	"load", "util", "task", "misfit",
+};
+
+/*
+ * All events require to access this variable to get access to the ringbuffer.
+ * Make it available for all event##_thread_fn.
+ */
+struct sched_analyzer_bpf *skel;
 
 static void sig_handler(int sig)
 {
 	exiting = true;
 }
 
+/*
+ * A task matching any of --pid, --comm or --cgroup is collected, the same way
+ * ignore_task() does in kernel.
+ */
 static bool ignore_pid_comm(pid_t pid, char *comm)
 {
 	unsigned int i;
+	bool value;
 
-	if (!sa_opts.num_pids && !sa_opts.num_comms)
+	if (!sa_opts.num_pids && !sa_opts.num_comms && !sa_opts.num_cgroups)
 		return false;
 
 	for (i = 0; i < sa_opts.num_pids; i++)
@@ -44,6 +116,11 @@ static bool ignore_pid_comm(pid_t pid, char *comm)
 		if (strstr(comm, sa_opts.comm[i]))
 			return false;
 
+	/* Learnt in kernel as tasks run */
+	if (sa_opts.num_cgroups &&
+	    !bpf_map_lookup_elem(bpf_map__fd(skel->maps.cgroup_tasks), &pid, &value))
+		return false;
+
 	return true;
 }
 
@@ -51,6 +128,18 @@ static int handle_rq_pelt_event(void *ctx, void *data, size_t data_sz)
 {
 	struct rq_pelt_event *e = data;
 
+	if (e->cgroup_id) {
+		char *path = find_cgroup_path(e->cgroup_id);
+
+		if (!path)
+			return 0;
+
+		trace_cgroup_load_avg(e->ts, path, e->cpu, e->load_avg);
+		trace_cgroup_runnable_avg(e->ts, path, e->cpu, e->runnable_avg);
+		trace_cgroup_util_avg(e->ts, path, e->cpu, e->util_avg);
+		return 0;
+	}
+
 	if (sa_opts.load_avg_cpu && e->load_avg != -1)
 		trace_cpu_load_avg(e->ts, e->cpu, e->load_avg);
 
@@ -127,6 +216,22 @@ static int handle_task_pelt_event(void *ctx, void *data, size_t data_sz)
 		trace_task_util_est_ewma(e->ts, e->comm, e->pid, e->util_est_ewma);
 	}
 
+	if (!sa_opts.pelt_running)
+		return 0;
+
+	/* Same signals, but 0 whenever the task isn't running */
+	if (sa_opts.load_avg_task && e->load_avg != -1)
+		trace_task_pelt_running(e->ts, e->comm, e->pid, "load_avg",
+					e->running ? e->load_avg : 0);
+
+	if (sa_opts.util_avg_task && e->util_avg != -1)
+		trace_task_pelt_running(e->ts, e->comm, e->pid, "util_avg",
+					e->running ? e->util_avg : 0);
+
+	if (sa_opts.util_est_task && e->util_est_enqueued != -1)
+		trace_task_pelt_running(e->ts, e->comm, e->pid, "util_est.enqueued",
+					e->running ? e->util_est_enqueued : 0);
+
 	return 0;
 }
 
@@ -166,6 +271,79 @@ static int handle_sched_switch_event(void *ctx, void *data, size_t data_sz)
 	return 0;
 }
 
+static int handle_pmu_event(void *ctx, void *data, size_t data_sz)
+{
+	struct pmu_event *e = data;
+
+	if (ignore_pid_comm(e->pid, e->comm))
+		return 0;
+
+	trace_task_pmu(e->ts, e->comm, e->pid, asym_capacity ? (int)e->capacity : -1,
+		       pmu_fallback ? "cpu_clock" : "cycles",
+		       e->cycles, e->instructions);
+
+	return 0;
+}
+
+static int handle_cfs_throttle_event(void *ctx, void *data, size_t data_sz)
+{
+	struct cfs_throttle_event *e = data;
+	char *path = find_cgroup_path(e->cgroup_id);
+
+	if (!path)
+		return 0;
+
+	trace_cgroup_throttled(e->ts, path, e->cgroup_id, e->cpu, e->duration);
+
+	return 0;
+}
+
+static int handle_rt_throttle_event(void *ctx, void *data, size_t data_sz)
+{
+	struct rt_throttle_event *e = data;
+
+	trace_rt_throttled(e->ts, e->cpu, e->duration);
+
+	return 0;
+}
+
+static int handle_eevdf_event(void *ctx, void *data, size_t data_sz)
+{
+	struct eevdf_event *e = data;
+
+	if (ignore_pid_comm(e->pid, e->comm))
+		return 0;
+
+	trace_task_eevdf(e->ts, e->comm, e->pid, e->vlag,
+			 (long long)(e->deadline - e->vruntime), e->slice);
+
+	return 0;
+}
+
+static int handle_eas_event(void *ctx, void *data, size_t data_sz)
+{
+	struct eas_event *e = data;
+	char candidates[EAS_MAX_CANDIDATES * 32] = "";
+	unsigned int i, len = 0;
+
+	if (ignore_pid_comm(e->pid, e->comm))
+		return 0;
+
+	for (i = 0; i < e->nr_candidates && i < EAS_MAX_CANDIDATES; i++) {
+		len += snprintf(candidates + len, sizeof(candidates) - len,
+				"%sCPU%d(PD%d):%+lld", i ? " " : "",
+				e->candidates[i].dst_cpu, e->candidates[i].pd_cpu,
+				e->candidates[i].delta);
+		if (len >= sizeof(candidates))
+			break;
+	}
+
+	trace_eas_decision(e->ts, e->cpu, e->comm, e->pid,
+			   e->prev_cpu, e->target_cpu, candidates);
+
+	return 0;
+}
+
 static int handle_freq_idle_event(void *ctx, void *data, size_t data_sz)
 {
 	struct freq_idle_event *e = data;
@@ -179,49 +357,19 @@ static int handle_freq_idle_event(void *ctx, void *data, size_t data_sz)
 	return 0;
 }
 
-static int handle_softirq_event(void *ctx, void *data, size_t data_sz)
-{
-	struct softirq_event *e = data;
-	(void)e;
-	return 0;
-}
-
 static int handle_lb_event(void *ctx, void *data, size_t data_sz)
 {
 	struct lb_event *e = data;
 	char *phase = "unknown";
 
-	switch (e->phase) {
-	case LB_NOHZ_IDLE_BALANCE:
-		phase = "_nohz_idle_balance()";
-		break;
-	case LB_RUN_REBALANCE_DOMAINS:
-		phase = "run_rebalance_domains()";
-		break;
-	case LB_REBALANCE_DOMAINS:
-		phase = "rebalance_domains()";
-		if (e->entry)
-			trace_lb_sd_stats(e->ts, &e->sd_stats);
-		break;
-	case LB_BALANCE_FAIR:
-		phase = "balance_fair()";
-		break;
-	case LB_PICK_NEXT_TASK_FAIR:
-		phase = "pick_next_task_fair()";
-		break;
-	case LB_NEWIDLE_BALANCE:
-		phase = "newidle_balance()";
-		break;
-	case LB_LOAD_BALANCE:
-		phase = "load_balance()";
-		break;
-	}
+	if (e->phase < NR_LB_PHASES)
+		phase = lb_phase_names[e->phase];
 
 	if (e->overloaded != -1)
-		trace_lb_overloaded(e->ts, e->overloaded);
+		trace_lb_overloaded(e->ts, e->lb_cpu, e->overloaded);
 
 	if (e->overutilized != -1)
-		trace_lb_overutilized(e->ts, e->overutilized);
+		trace_lb_overutilized(e->ts, e->lb_cpu, e->overutilized);
 
 	if (e->misfit_task_load != -1)
 		trace_lb_misfit(e->ts, e->lb_cpu, e->misfit_task_load);
@@ -233,6 +381,18 @@ static int handle_lb_event(void *ctx, void *data, size_t data_sz)
 	return 0;
 }
 
+static int handle_lb_sd_event(void *ctx, void *data, size_t data_sz)
+{
+	struct lb_sd_event *e = data;
+
+	if (e->sd_stats.topology)
+		trace_lb_sd_topology(e->ts, &e->sd_stats);
+
+	trace_lb_sd_stats(e->ts, &e->sd_stats);
+
+	return 0;
+}
+
 static int handle_ipi_event(void *ctx, void *data, size_t data_sz)
 {
 	struct ipi_event *e = data;
@@ -244,6 +404,78 @@ static int handle_ipi_event(void *ctx, void *data, size_t data_sz)
 	return 0;
 }
 
+static int handle_ipi_lat_event(void *ctx, void *data, size_t data_sz)
+{
+	struct ipi_lat_event *e = data;
+
+	trace_ipi_latency(e->ts, e->cpu, e->from_cpu,
+			  e->callback ? find_kallsyms(e->callback) : "reschedule",
+			  e->callback,
+			  e->latency, e->duration);
+
+	return 0;
+}
+
+static int handle_wakeup_lat_event(void *ctx, void *data, size_t data_sz)
+{
+	struct wakeup_lat_event *e = data;
+
+	if (ignore_pid_comm(e->pid, e->comm))
+		return 0;
+
+	trace_wakeup_latency(e->ts, e->cpu, e->comm, e->pid, e->tgid, e->latency);
+
+	return 0;
+}
+
+static int handle_placement_event(void *ctx, void *data, size_t data_sz)
+{
+	struct placement_event *e = data;
+	const char *name;
+	char path[32];
+
+	if (ignore_pid_comm(e->pid, e->comm))
+		return 0;
+
+	if (e->path_flags & PLACEMENT_F_EAS)
+		name = placement_path_names[PLACEMENT_PATH_EAS];
+	else if (e->path_flags & PLACEMENT_F_SLOW)
+		name = placement_path_names[PLACEMENT_PATH_SLOW];
+	else if (e->path_flags & PLACEMENT_F_SIS)
+		name = placement_path_names[PLACEMENT_PATH_FAST];
+	else
+		name = placement_path_names[PLACEMENT_PATH_OTHER];
+
+	snprintf(path, sizeof(path), "%s%s", name,
+		 e->path_flags & PLACEMENT_F_WAKE_AFFINE ? "+wake_affine" : "");
+
+	trace_placement(e->ts, e->this_cpu, e->comm, e->pid,
+			e->prev_cpu, e->new_cpu, e->wake_flags, path);
+
+	return 0;
+}
+
+static int handle_sugov_event(void *ctx, void *data, size_t data_sz)
+{
+	struct sugov_event *e = data;
+
+	trace_sugov_util(e->ts, e->cpu, e->util);
+	trace_sugov_next_freq(e->ts, e->policy_cpu, e->next_freq);
+
+	return 0;
+}
+
+static int handle_idle_gov_event(void *ctx, void *data, size_t data_sz)
+{
+	struct idle_gov_event *e = data;
+
+	trace_idle_gov_miss(e->ts, e->cpu, e->state,
+			    idle_gov_outcome_names[e->outcome],
+			    e->sleep_length, e->residency);
+
+	return 0;
+}
+
 #define INIT_EVENT_RB(event)	struct ring_buffer *event##_rb = NULL
 
 #define CREATE_EVENT_RB(event) do {							\
@@ -306,10 +538,72 @@ static int handle_ipi_event(void *ctx, void *data, size_t data_sz)
 
 
 /*
- * All events require to access this variable to get access to the ringbuffer.
- * Make it available for all event##_thread_fn.
+ * Symbolize a stack once and reuse it for every event that hits the same
+ * stack id.
  */
-struct sched_analyzer_bpf *skel;
+static const char *lookup_stack(int stack_id)
+{
+	unsigned long long ips[MAX_STACK_DEPTH] = { 0 };
+	size_t len = 0, size = 0;
+	char *str = NULL;
+	unsigned int i;
+
+	if (stack_id < 0 || stack_id >= STACK_MAP_SIZE)
+		return NULL;
+
+	if (stack_strs[stack_id])
+		return stack_strs[stack_id];
+
+	if (bpf_map_lookup_elem(bpf_map__fd(skel->maps.stack_traces), &stack_id, ips))
+		return NULL;
+
+	for (i = 0; i < MAX_STACK_DEPTH && ips[i]; i++) {
+		char *sym = find_kallsyms((void *)ips[i]);
+		char line[160];
+		int n;
+
+		n = snprintf(line, sizeof(line), "%s\n", sym ? sym : "[unknown]");
+		if (n < 0)
+			break;
+
+		if (len + n + 1 > size) {
+			char *tmp;
+
+			size = (len + n + 1) * 2;
+			tmp = realloc(str, size);
+			if (!tmp)
+				break;
+			str = tmp;
+		}
+
+		memcpy(str + len, line, n + 1);
+		len += n;
+	}
+
+	stack_strs[stack_id] = str;
+	return str;
+}
+
+static int handle_stack_event(void *ctx, void *data, size_t data_sz)
+{
+	struct stack_event *e = data;
+	const char *stack;
+
+	if (e->source < 0 || e->source >= NR_STACK_SOURCES)
+		return 0;
+
+	if (e->source != STACK_SOURCE_WAKEUP_LATENCY &&
+	    ignore_pid_comm(e->pid, e->comm))
+		return 0;
+
+	stack = lookup_stack(e->stack_id);
+
+	trace_stack_outlier(e->ts, e->cpu, stack_source_names[e->source], e->arg,
+			    e->comm, e->pid, e->duration,
+			    stack ? stack : "[no stack]");
+
+	return 0;
+}
 
 /*
  * Define a pthread function handler for each event
@@ -319,127 +613,2675 @@ EVENT_THREAD_FN(task_pelt)
 EVENT_THREAD_FN(rq_nr_running)
 EVENT_THREAD_FN(sched_switch)
 EVENT_THREAD_FN(freq_idle)
-EVENT_THREAD_FN(softirq)
 EVENT_THREAD_FN(lb)
+EVENT_THREAD_FN(lb_sd)
 EVENT_THREAD_FN(ipi)
-
-int main(int argc, char **argv)
+EVENT_THREAD_FN(ipi_lat)
+EVENT_THREAD_FN(wakeup_lat)
+EVENT_THREAD_FN(placement)
+EVENT_THREAD_FN(sugov)
+EVENT_THREAD_FN(idle_gov)
+EVENT_THREAD_FN(stack)
+EVENT_THREAD_FN(pmu)
+EVENT_THREAD_FN(cfs_throttle)
+EVENT_THREAD_FN(rt_throttle)
+EVENT_THREAD_FN(eevdf)
+EVENT_THREAD_FN(eas)
+
+static int init_cgroup_filter(void)
 {
-	INIT_EVENT_THREAD(rq_pelt);
-	INIT_EVENT_THREAD(task_pelt);
-	INIT_EVENT_THREAD(rq_nr_running);
-	INIT_EVENT_THREAD(sched_switch);
-	INIT_EVENT_THREAD(freq_idle);
-	INIT_EVENT_THREAD(softirq);
-	INIT_EVENT_THREAD(lb);
-	INIT_EVENT_THREAD(ipi);
-	int err;
+	int fd = bpf_map__fd(skel->maps.cgroup_filter);
+	unsigned long long id;
+	bool value = true;
+	unsigned int i;
 
-	err = argp_parse(&argp, argc, argv, 0, NULL, NULL);
-	if (err)
-		return err;
+	if (sa_opts.cgroup_pelt && !sa_opts.num_cgroups) {
+		fprintf(stderr, "--cgroup_pelt requires at least one --cgroup\n");
+		return -EINVAL;
+	}
 
-	if (sa_opts.ipi)
-		parse_kallsyms();
+	for (i = 0; i < sa_opts.num_cgroups; i++) {
+		id = get_cgroup_id(sa_opts.cgroup[i]);
+		if (!id)
+			return -ENOENT;
 
-	init_perfetto();
+		if (bpf_map_update_elem(fd, &id, &value, BPF_ANY)) {
+			fprintf(stderr, "Failed to add cgroup %s to filter\n", sa_opts.cgroup[i]);
+			return -errno;
+		}
+	}
 
-	signal(SIGINT, sig_handler);
-	signal(SIGTERM, sig_handler);
+	return 0;
+}
 
-	skel = sched_analyzer_bpf__open();
-	if (!skel) {
-		fprintf(stderr, "Failed to open and load BPF skeleton\n");
-		return 1;
-	}
+/*
+ * CPUs of different capacity are different micro-architectures, IPC is
+ * reported separately for each.
+ */
+static void init_cpu_capacity(void)
+{
+	unsigned int capacity;
+	char path[64];
+	FILE *fp;
+	int cpu;
+
+	for (cpu = 0; cpu < nr_cpus && cpu < MAX_CPUS; cpu++) {
+		snprintf(path, sizeof(path),
+			 "/sys/devices/system/cpu/cpu%d/cpu_capacity", cpu);
+
+		capacity = 1024;
+		fp = fopen(path, "r");
+		if (fp) {
+			if (fscanf(fp, "%u", &capacity) != 1)
+				capacity = 1024;
+			fclose(fp);
+		}
 
-	/* Initialize BPF global variables */
-	skel->bss->sa_opts = sa_opts;
+		if (cpu && capacity != skel->bss->cpu_capacity[0])
+			asym_capacity = true;
 
-	if (!sa_opts.load_avg_cpu && !sa_opts.runnable_avg_cpu && !sa_opts.util_avg_cpu)
-		bpf_program__set_autoload(skel->progs.handle_pelt_cfs, false);
-	if (!sa_opts.load_avg_task && !sa_opts.runnable_avg_task && !sa_opts.util_avg_task)
-		bpf_program__set_autoload(skel->progs.handle_pelt_se, false);
-	if (!sa_opts.util_avg_rt)
-		bpf_program__set_autoload(skel->progs.handle_pelt_rt, false);
-	if (!sa_opts.util_avg_dl)
-		bpf_program__set_autoload(skel->progs.handle_pelt_dl, false);
-	if (!sa_opts.util_avg_irq)
-		bpf_program__set_autoload(skel->progs.handle_pelt_irq, false);
-	if (!sa_opts.load_avg_thermal)
-		bpf_program__set_autoload(skel->progs.handle_pelt_thermal, false);
-	if (!sa_opts.util_est_cpu)
-		bpf_program__set_autoload(skel->progs.handle_util_est_cfs, false);
-	if (!sa_opts.util_est_task)
-		bpf_program__set_autoload(skel->progs.handle_util_est_se, false);
-	if (!sa_opts.cpu_nr_running)
-		bpf_program__set_autoload(skel->progs.handle_sched_update_nr_running, false);
-	if (!sa_opts.cpu_idle) {
-		bpf_program__set_autoload(skel->progs.handle_cpu_idle, false);
-		bpf_program__set_autoload(skel->progs.handle_cpu_idle_miss, false);
-	}
-	if (!sa_opts.load_balance) {
-		bpf_program__set_autoload(skel->progs.handle_run_rebalance_domains_exit, false);
-		bpf_program__set_autoload(skel->progs.handle_run_rebalance_domains_entry, false);
-		bpf_program__set_autoload(skel->progs.handle_run_rebalance_domains_exit, false);
-		bpf_program__set_autoload(skel->progs.handle_rebalance_domains_entry, false);
-		bpf_program__set_autoload(skel->progs.handle_rebalance_domains_exit, false);
-		bpf_program__set_autoload(skel->progs.handle_balance_fair_entry, false);
-		bpf_program__set_autoload(skel->progs.handle_balance_fair_exit, false);
-		bpf_program__set_autoload(skel->progs.handle_pick_next_task_fair_entry, false);
-		bpf_program__set_autoload(skel->progs.handle_pick_next_task_fair_exit, false);
-		bpf_program__set_autoload(skel->progs.handle_newidle_balance_entry, false);
-		bpf_program__set_autoload(skel->progs.handle_newidle_balance_exit, false);
-		bpf_program__set_autoload(skel->progs.handle_load_balance_entry, false);
-		bpf_program__set_autoload(skel->progs.handle_load_balance_exit, false);
+		skel->bss->cpu_capacity[cpu] = capacity;
 	}
-	if (!sa_opts.ipi)
-		bpf_program__set_autoload(skel->progs.handle_ipi_send_cpu, false);
+}
 
-	/* Make sure we zero out PELT signals for tasks when they exit */
-	if (!sa_opts.load_avg_task && !sa_opts.runnable_avg_task && !sa_opts.util_avg_task && !sa_opts.util_est_task)
-		bpf_program__set_autoload(skel->progs.handle_sched_process_free, false);
+static int read_sysfs_int(const char *path, int *value)
+{
+	FILE *fp;
+	int ret;
 
-	/* We can't reliably attach to those yet, so always disable them */
-	bpf_program__set_autoload(skel->progs.handle_nohz_idle_balance_entry, false);
-	bpf_program__set_autoload(skel->progs.handle_nohz_idle_balance_exit, false);
+	fp = fopen(path, "r");
+	if (!fp)
+		return -errno;
 
-	/*
-	 * Were used for old csv mode, no longer used but keep the traces lying
-	 * around but disabled for now.
-	 */
-	bpf_program__set_autoload(skel->progs.handle_cpu_frequency, false);
-	bpf_program__set_autoload(skel->progs.handle_softirq_entry, false);
-	bpf_program__set_autoload(skel->progs.handle_softirq_exit, false);
+	ret = fscanf(fp, "%d", value) == 1 ? 0 : -EINVAL;
+	fclose(fp);
 
-	/*
-	 * Was used to zero out pelt signals when task is not running.
-	 */
-	bpf_program__set_autoload(skel->progs.handle_sched_switch, false);
+	return ret;
+}
 
+/*
+ * Identify the LLC of a CPU by the first CPU sharing its last level cache.
+ */
+static int get_cpu_llc_id(int cpu)
+{
+	int index, level, max_level = -1, llc = 0;
+	char path[96];
 
-	err = sched_analyzer_bpf__load(skel);
-	if (err) {
-		fprintf(stderr, "Failed to load and verify BPF skeleton\n");
-		goto cleanup;
-	}
+	for (index = 0; index < 10; index++) {
+		snprintf(path, sizeof(path),
+			 "/sys/devices/system/cpu/cpu%d/cache/index%d/level", cpu, index);
+		if (read_sysfs_int(path, &level))
+			break;
+		if (level <= max_level)
+			continue;
 
-	err = sched_analyzer_bpf__attach(skel);
-	if (err) {
-		fprintf(stderr, "Failed to attach BPF skeleton\n");
-		goto cleanup;
+		snprintf(path, sizeof(path),
+			 "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list", cpu, index);
+		if (read_sysfs_int(path, &llc))
+			continue;
+
+		max_level = level;
 	}
 
-	CREATE_EVENT_THREAD(rq_pelt);
-	CREATE_EVENT_THREAD(task_pelt);
-	CREATE_EVENT_THREAD(rq_nr_running);
-	CREATE_EVENT_THREAD(sched_switch);
-	CREATE_EVENT_THREAD(freq_idle);
-	CREATE_EVENT_THREAD(softirq);
-	CREATE_EVENT_THREAD(lb);
-	CREATE_EVENT_THREAD(ipi);
+	return llc;
+}
 
-	printf("Collecting data, CTRL+c to stop\n");
+static int get_cpu_node_id(int cpu)
+{
+	struct dirent *entry;
+	char path[64];
+	int node = 0;
+	DIR *dir;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+	dir = opendir(path);
+	if (!dir)
+		return 0;
+
+	while ((entry = readdir(dir))) {
+		if (sscanf(entry->d_name, "node%d", &node) == 1)
+			break;
+	}
+
+	closedir(dir);
+
+	return node;
+}
+
+/*
+ * Migrations are classified in kernel based on which LLC and NUMA node the
+ * source and destination CPUs belong to.
+ */
+static void init_cpu_topology(void)
+{
+	int cpu;
+
+	for (cpu = 0; cpu < nr_cpus && cpu < MAX_CPUS; cpu++) {
+		skel->bss->cpu_llc_id[cpu] = get_cpu_llc_id(cpu);
+		skel->bss->cpu_node_id[cpu] = get_cpu_node_id(cpu);
+	}
+}
+
+static unsigned long long get_boot_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_BOOTTIME, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Frequency CPUs run at until the first cpu_frequency event */
+static void init_cpu_freq(void)
+{
+	char path[96];
+	int cpu, freq;
+
+	for (cpu = 0; cpu < nr_cpus && cpu < MAX_CPUS; cpu++) {
+		snprintf(path, sizeof(path),
+			 "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq", cpu);
+		if (!read_sysfs_int(path, &freq))
+			skel->bss->cpu_init_freq[cpu] = freq;
+	}
+}
+
+#define EM_DEBUGFS		"/sys/kernel/debug/energy_model"
+#define EM_MAX_PERF_STATES	64
+#define EM_MAX_PDS		16
+
+struct energy_pd {
+	int first_cpu;
+	int nr_states;
+	unsigned long freq[EM_MAX_PERF_STATES];		/* kHz */
+	unsigned long power[EM_MAX_PERF_STATES];	/* uW */
+	/* Accumulated since start */
+	unsigned long long busy_time;			/* ns */
+	unsigned long long energy;			/* nJ */
+};
+
+static struct energy_pd energy_pds[EM_MAX_PDS];
+static unsigned long long energy_start_ts;
+static int nr_energy_pds;
+static int cpu_energy_pd[MAX_CPUS];
+
+/* Mark the CPUs of a cpulist, ie: 0-3,6 as belonging to pd */
+static int parse_em_cpus(const char *path, int pd)
+{
+	int first = -1, start, end, cpu;
+	char buf[256], *str;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return -errno;
+
+	if (!fgets(buf, sizeof(buf), fp)) {
+		fclose(fp);
+		return -EINVAL;
+	}
+	fclose(fp);
+
+	for (str = strtok(buf, ",\n"); str; str = strtok(NULL, ",\n")) {
+		if (sscanf(str, "%d-%d", &start, &end) != 2) {
+			if (sscanf(str, "%d", &start) != 1)
+				continue;
+			end = start;
+		}
+
+		for (cpu = start; cpu <= end && cpu < MAX_CPUS; cpu++) {
+			cpu_energy_pd[cpu] = pd;
+			if (first < 0)
+				first = cpu;
+		}
+	}
+
+	return first;
+}
+
+static int cmp_energy_state(const void *a, const void *b)
+{
+	const unsigned long *i = a, *j = b;
+
+	return *i < *j ? -1 : *i > *j;
+}
+
+static void parse_em_states(const char *pd_path, struct energy_pd *pd)
+{
+	unsigned long states[EM_MAX_PERF_STATES][2];
+	int freq, power, i;
+	struct dirent *entry;
+	char path[512];
+	DIR *dir;
+
+	dir = opendir(pd_path);
+	if (!dir)
+		return;
+
+	while ((entry = readdir(dir)) && pd->nr_states < EM_MAX_PERF_STATES) {
+		if (strncmp(entry->d_name, "ps:", 3))
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s/frequency", pd_path, entry->d_name);
+		if (read_sysfs_int(path, &freq))
+			continue;
+		snprintf(path, sizeof(path), "%s/%s/power", pd_path, entry->d_name);
+		if (read_sysfs_int(path, &power))
+			continue;
+
+		states[pd->nr_states][0] = freq;
+		states[pd->nr_states][1] = power;
+		pd->nr_states++;
+	}
+
+	closedir(dir);
+
+	qsort(states, pd->nr_states, sizeof(states[0]), cmp_energy_state);
+	for (i = 0; i < pd->nr_states; i++) {
+		pd->freq[i] = states[i][0];
+		pd->power[i] = states[i][1];
+	}
+}
+
+/*
+ * Energy of a performance domain is estimated from the time its CPUs spent
+ * busy at each frequency, times the power of that performance state. Idle
+ * power isn't part of the energy model and isn't accounted.
+ */
+static void init_energy_model(void)
+{
+	struct energy_pd *pd;
+	struct dirent *entry;
+	char path[512];
+	DIR *dir;
+	int cpu;
+
+	energy_start_ts = get_boot_ns();
+
+	for (cpu = 0; cpu < MAX_CPUS; cpu++)
+		cpu_energy_pd[cpu] = -1;
+
+	dir = opendir(EM_DEBUGFS);
+	if (!dir) {
+		fprintf(stderr, "Can't open %s, energy won't be estimated\n", EM_DEBUGFS);
+	} else {
+		while ((entry = readdir(dir)) && nr_energy_pds < EM_MAX_PDS) {
+			if (entry->d_name[0] == '.')
+				continue;
+
+			pd = &energy_pds[nr_energy_pds];
+
+			snprintf(path, sizeof(path), "%s/%s/cpus", EM_DEBUGFS, entry->d_name);
+			pd->first_cpu = parse_em_cpus(path, nr_energy_pds);
+			if (pd->first_cpu < 0)
+				continue;
+
+			snprintf(path, sizeof(path), "%s/%s", EM_DEBUGFS, entry->d_name);
+			parse_em_states(path, pd);
+			nr_energy_pds++;
+		}
+
+		closedir(dir);
+	}
+}
+
+/* Power of the lowest performance state able to provide freq */
+static unsigned long energy_pd_power(struct energy_pd *pd, unsigned long freq)
+{
+	int i;
+
+	if (!pd->nr_states)
+		return 0;
+
+	for (i = 0; i < pd->nr_states; i++) {
+		if (pd->freq[i] >= freq)
+			return pd->power[i];
+	}
+
+	return pd->power[pd->nr_states - 1];
+}
+
+static int perf_event_open_cpu(__u32 type, __u64 config, int cpu, int group_fd)
+{
+	struct perf_event_attr attr = {
+		.type = type,
+		.size = sizeof(attr),
+		.config = config,
+	};
+
+	return syscall(__NR_perf_event_open, &attr, -1, cpu, group_fd, 0);
+}
+
+/*
+ * Open cycles and instructions counters on every CPU for BPF to read at
+ * context switch. When there's no PMU (ie: VMs), fall back to cpu-clock.
+ * Instructions is opened in the cycles group so that both are always
+ * scheduled together if the PMU gets multiplexed, keeping IPC consistent.
+ */
+static int open_pmu_events(void)
+{
+	int cycles_fd = bpf_map__fd(skel->maps.pmu_cycles);
+	int instructions_fd = bpf_map__fd(skel->maps.pmu_instructions);
+	int cpu, fd;
+
+	pmu_fds = malloc(2 * nr_cpus * sizeof(*pmu_fds));
+	if (!pmu_fds)
+		return -ENOMEM;
+
+	for (cpu = 0; cpu < 2 * nr_cpus; cpu++)
+		pmu_fds[cpu] = -1;
+
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		fd = -1;
+		if (!pmu_fallback)
+			fd = perf_event_open_cpu(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, cpu, -1);
+		if (fd < 0 && !pmu_fallback && (errno == ENOENT || errno == EOPNOTSUPP)) {
+			fprintf(stderr, "No hw cycles counter, falling back to cpu-clock\n");
+			pmu_fallback = true;
+		}
+		if (fd < 0 && pmu_fallback)
+			fd = perf_event_open_cpu(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_CLOCK, cpu, -1);
+		if (fd < 0) {
+			/* Offline CPU */
+			if (errno == ENODEV)
+				continue;
+			fprintf(stderr, "Failed to open perf event on CPU%d: %s\n",
+				cpu, strerror(errno));
+			return -errno;
+		}
+
+		pmu_fds[cpu] = fd;
+		if (bpf_map_update_elem(cycles_fd, &cpu, &fd, BPF_ANY)) {
+			fprintf(stderr, "Failed to set cycles perf event of CPU%d\n", cpu);
+			return -errno;
+		}
+
+		if (pmu_fallback)
+			continue;
+
+		fd = perf_event_open_cpu(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,
+					 cpu, pmu_fds[cpu]);
+		if (fd < 0)
+			continue;
+
+		pmu_fds[nr_cpus + cpu] = fd;
+		if (bpf_map_update_elem(instructions_fd, &cpu, &fd, BPF_ANY)) {
+			fprintf(stderr, "Failed to set instructions perf event of CPU%d\n", cpu);
+			return -errno;
+		}
+	}
+
+	return 0;
+}
+
+static void close_pmu_events(void)
+{
+	int i;
+
+	if (!pmu_fds)
+		return;
+
+	for (i = 0; i < 2 * nr_cpus; i++) {
+		if (pmu_fds[i] >= 0)
+			close(pmu_fds[i]);
+	}
+
+	free(pmu_fds);
+	pmu_fds = NULL;
+}
+
+static void get_comm(pid_t pid, char *comm)
+{
+	char path[64];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "/proc/%d/comm", pid);
+	strcpy(comm, "<exited>");
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return;
+
+	if (fgets(comm, TASK_COMM_LEN, fp))
+		comm[strcspn(comm, "\n")] = 0;
+
+	fclose(fp);
+}
+
+/*
+ * Sum up the per-cpu copies of a histogram stored in a per-cpu map.
+ */
+static int lookup_percpu_hist(int fd, const void *key, struct log2_hist *hist)
+{
+	struct log2_hist values[nr_cpus];
+	int cpu, i, err;
+
+	err = bpf_map_lookup_elem(fd, key, values);
+	if (err)
+		return err;
+
+	memset(hist, 0, sizeof(*hist));
+
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		for (i = 0; i < HIST_SLOTS; i++)
+			hist->slots[i] += values[cpu].slots[i];
+		hist->count += values[cpu].count;
+		hist->total += values[cpu].total;
+		if (values[cpu].max > hist->max)
+			hist->max = values[cpu].max;
+	}
+
+	return 0;
+}
+
+static void print_log2_hist(struct log2_hist *hist, const char *unit)
+{
+	static const char stars[] = "****************************************";
+	unsigned long long max_count = 0;
+	int i, last = -1;
+
+	for (i = 0; i < HIST_SLOTS; i++) {
+		if (hist->slots[i])
+			last = i;
+		if (hist->slots[i] > max_count)
+			max_count = hist->slots[i];
+	}
+
+	if (last < 0)
+		return;
+
+	printf("%23s : %-10s distribution\n", unit, "count");
+	for (i = 0; i <= last; i++) {
+		unsigned long long low = i ? 1ULL << i : 0;
+		unsigned long long high = (1ULL << (i + 1)) - 1;
+		int width = hist->slots[i] * 40 / max_count;
+
+		printf("%10llu -> %-10llu : %-10llu |%-40.*s|\n",
+		       low, high, hist->slots[i], width, stars);
+	}
+}
+
+static void print_cpu_hist_summary(struct bpf_map *map, const char *title,
+				   const char *unit)
+{
+	struct log2_hist values[nr_cpus];
+	int fd, cpu, zero = 0;
+
+	fd = bpf_map__fd(map);
+	if (bpf_map_lookup_elem(fd, &zero, values)) {
+		fprintf(stderr, "Failed to read %s histograms\n", title);
+		return;
+	}
+
+	printf("\n%s per CPU:\n", title);
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		if (!values[cpu].count)
+			continue;
+
+		printf("\nCPU%d: count = %llu avg = %llu %s max = %llu %s\n",
+		       cpu, values[cpu].count,
+		       values[cpu].total / values[cpu].count, unit,
+		       values[cpu].max, unit);
+		print_log2_hist(&values[cpu], unit);
+	}
+}
+
+static void print_wakeup_latency_summary(void)
+{
+	pid_t *prev_key = NULL, key;
+	char comm[TASK_COMM_LEN];
+	struct log2_hist hist;
+	int fd;
+
+	print_cpu_hist_summary(skel->maps.wakeup_lat_cpu_hist, "Wakeup latency", "usecs");
+
+	printf("\nWakeup latency per process:\n");
+	printf("%8s %-16s %10s %10s %10s\n", "TGID", "COMM", "COUNT", "AVG(us)", "MAX(us)");
+
+	fd = bpf_map__fd(skel->maps.wakeup_lat_tgid_hist);
+	while (!bpf_map_get_next_key(fd, prev_key, &key)) {
+		prev_key = &key;
+
+		if (lookup_percpu_hist(fd, &key, &hist) || !hist.count)
+			continue;
+
+		get_comm(key, comm);
+		if (ignore_pid_comm(key, comm))
+			continue;
+
+		printf("%8d %-16s %10llu %10llu %10llu\n", key, comm,
+		       hist.count, hist.total / hist.count, hist.max);
+	}
+}
+
+static void print_runq_wait_summary(void)
+{
+	pid_t *prev_key = NULL, key;
+	struct runq_wait_stats stats;
+	int fd;
+
+	print_cpu_hist_summary(skel->maps.runq_wait_cpu_hist, "Runqueue wait", "usecs");
+
+	printf("\nRunqueue wait per task:\n");
+	printf("%8s %-16s %10s %10s %10s %10s\n",
+	       "PID", "COMM", "COUNT", "TOTAL(ms)", "AVG(us)", "MAX(us)");
+
+	fd = bpf_map__fd(skel->maps.runq_wait_task);
+	while (!bpf_map_get_next_key(fd, prev_key, &key)) {
+		prev_key = &key;
+
+		if (bpf_map_lookup_elem(fd, &key, &stats) || !stats.hist.count)
+			continue;
+
+		if (ignore_pid_comm(key, stats.comm))
+			continue;
+
+		printf("%8d %-16s %10llu %10llu %10llu %10llu\n", key, stats.comm,
+		       stats.hist.count, stats.hist.total / 1000,
+		       stats.hist.total / stats.hist.count, stats.hist.max);
+	}
+}
+
+static void print_irq_summary(void)
+{
+	unsigned long long totals[MAX_SOFTIRQS][nr_cpus];
+	struct log2_hist values[nr_cpus], hist;
+	int *prev_key = NULL, key;
+	struct irq_name name;
+	int fd, cpu, vec;
+
+	if (sa_opts.softirq) {
+		printf("\nsoftirq duration:\n");
+
+		memset(totals, 0, sizeof(totals));
+
+		fd = bpf_map__fd(skel->maps.softirq_hist);
+		for (vec = 0; vec < MAX_SOFTIRQS; vec++) {
+			if (bpf_map_lookup_elem(fd, &vec, values))
+				continue;
+
+			for (cpu = 0; cpu < nr_cpus; cpu++)
+				totals[vec][cpu] = values[cpu].total;
+
+			if (lookup_percpu_hist(fd, &vec, &hist) || !hist.count)
+				continue;
+
+			printf("\n%s: count = %llu total = %llu usecs avg = %llu nsecs max = %llu nsecs\n",
+			       softirq_names[vec], hist.count, hist.total / 1000,
+			       hist.total / hist.count, hist.max);
+			print_log2_hist(&hist, "nsecs");
+		}
+
+		printf("\nsoftirq time per CPU (usecs):\n");
+		printf("%6s", "CPU");
+		for (vec = 0; vec < MAX_SOFTIRQS; vec++)
+			printf(" %10s", softirq_names[vec]);
+		printf("\n");
+
+		for (cpu = 0; cpu < nr_cpus; cpu++) {
+			printf("%6d", cpu);
+			for (vec = 0; vec < MAX_SOFTIRQS; vec++)
+				printf(" %10llu", totals[vec][cpu] / 1000);
+			printf("\n");
+		}
+	}
+
+	if (sa_opts.irq) {
+		printf("\nhardirq duration:\n");
+		printf("%6s %-32s %10s %10s %10s %10s\n",
+		       "IRQ", "NAME", "COUNT", "TOTAL(us)", "AVG(ns)", "MAX(ns)");
+
+		fd = bpf_map__fd(skel->maps.hardirq_hist);
+		while (!bpf_map_get_next_key(fd, prev_key, &key)) {
+			prev_key = &key;
+
+			if (lookup_percpu_hist(fd, &key, &hist) || !hist.count)
+				continue;
+
+			if (bpf_map_lookup_elem(bpf_map__fd(skel->maps.hardirq_name), &key, &name))
+				strcpy(name.name, "unknown");
+
+			printf("%6d %-32s %10llu %10llu %10llu %10llu\n",
+			       key, name.name, hist.count, hist.total / 1000,
+			       hist.total / hist.count, hist.max);
+		}
+	}
+}
+
+static int lookup_placement_stats(struct placement_stats *stats)
+{
+	struct placement_stats values[nr_cpus];
+	int cpu, path, outcome, err, zero = 0;
+
+	err = bpf_map_lookup_elem(bpf_map__fd(skel->maps.placement_stats), &zero, values);
+	if (err)
+		return err;
+
+	memset(stats, 0, sizeof(*stats));
+
+	for (cpu = 0; cpu < nr_cpus; cpu++)
+		for (path = 0; path < NR_PLACEMENT_PATHS; path++)
+			for (outcome = 0; outcome < NR_PLACEMENT_OUTCOMES; outcome++)
+				stats->count[path][outcome] += values[cpu].count[path][outcome];
+
+	return 0;
+}
+
+static void print_placement_summary(void)
+{
+	unsigned long long path_total, total = 0;
+	struct placement_stats stats;
+	int path, outcome;
+
+	if (lookup_placement_stats(&stats))
+		return;
+
+	for (path = 0; path < NR_PLACEMENT_PATHS; path++)
+		for (outcome = 0; outcome < NR_PLACEMENT_OUTCOMES; outcome++)
+			total += stats.count[path][outcome];
+
+	if (!total)
+		return;
+
+	printf("\nselect_task_rq_fair() placement decisions:\n");
+	printf("%-8s", "path");
+	for (outcome = 0; outcome < NR_PLACEMENT_OUTCOMES; outcome++)
+		printf(" %12s", placement_outcome_names[outcome]);
+	printf(" %12s %7s\n", "total", "%");
+
+	for (path = 0; path < NR_PLACEMENT_PATHS; path++) {
+		path_total = 0;
+
+		printf("%-8s", placement_path_names[path]);
+		for (outcome = 0; outcome < NR_PLACEMENT_OUTCOMES; outcome++) {
+			printf(" %12llu", stats.count[path][outcome]);
+			path_total += stats.count[path][outcome];
+		}
+		printf(" %12llu %6.2f%%\n", path_total, path_total * 100.0 / total);
+	}
+}
+
+static int lookup_eas_stats(struct eas_stats *stats)
+{
+	struct eas_stats values[nr_cpus];
+	int cpu, err, zero = 0;
+
+	err = bpf_map_lookup_elem(bpf_map__fd(skel->maps.eas_stats), &zero, values);
+	if (err)
+		return err;
+
+	memset(stats, 0, sizeof(*stats));
+
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		stats->decisions += values[cpu].decisions;
+		stats->prev_cpu += values[cpu].prev_cpu;
+		stats->candidates += values[cpu].candidates;
+		stats->saved += values[cpu].saved;
+	}
+
+	return 0;
+}
+
+/* Refresh busy time and energy of every performance domain since start */
+static void update_energy_pds(void)
+{
+	int fd = bpf_map__fd(skel->maps.energy_busy);
+	struct energy_busy_key *prev_key = NULL, key;
+	struct energy_pd *pd;
+	unsigned long long busy;
+	int i;
+
+	for (i = 0; i < nr_energy_pds; i++) {
+		energy_pds[i].busy_time = 0;
+		energy_pds[i].energy = 0;
+	}
+
+	while (!bpf_map_get_next_key(fd, prev_key, &key)) {
+		prev_key = &key;
+
+		if (key.cpu < 0 || key.cpu >= MAX_CPUS || cpu_energy_pd[key.cpu] < 0)
+			continue;
+
+		if (bpf_map_lookup_elem(fd, &key, &busy))
+			continue;
+
+		pd = &energy_pds[cpu_energy_pd[key.cpu]];
+		pd->busy_time += busy;
+		/* ns * uW */
+		pd->energy += busy / 1000 * energy_pd_power(pd, key.freq) / 1000;
+	}
+}
+
+static void print_energy_summary(void)
+{
+	unsigned long long duration;
+	struct eas_stats stats;
+	int i;
+
+	if (!lookup_eas_stats(&stats) && stats.decisions) {
+		printf("\nfind_energy_efficient_cpu() decisions:\n");
+		printf("%12s %12s %12s %14s %14s\n",
+		       "decisions", "prev_cpu", "moved", "avg_candidates", "est_saved");
+		printf("%12llu %12llu %12llu %14.2f %14llu\n",
+		       stats.decisions, stats.prev_cpu, stats.decisions - stats.prev_cpu,
+		       (double)stats.candidates / stats.decisions, stats.saved);
+	}
+
+	if (!nr_energy_pds)
+		return;
+
+	update_energy_pds();
+	duration = get_boot_ns() - energy_start_ts;
+
+	printf("\nEstimated energy per performance domain (busy time only):\n");
+	printf("%-6s %12s %12s %12s\n", "PD", "busy(ms)", "energy(mJ)", "power(mW)");
+	for (i = 0; i < nr_energy_pds; i++) {
+		printf("PD%-4d %12llu %12llu %12llu\n", energy_pds[i].first_cpu,
+		       energy_pds[i].busy_time / 1000000, energy_pds[i].energy / 1000000,
+		       duration ? energy_pds[i].energy * 1000 / duration : 0);
+	}
+}
+
+struct freq_residency_entry {
+	pid_t pid;
+	unsigned int freq;
+	unsigned long long time;
+};
+
+struct freq_residency_task {
+	pid_t pid;
+	char comm[TASK_COMM_LEN];
+	unsigned long long total;
+};
+
+static int cmp_freq_residency_entry(const void *a, const void *b)
+{
+	const struct freq_residency_entry *i = a, *j = b;
+
+	if (i->pid != j->pid)
+		return i->pid < j->pid ? -1 : 1;
+
+	return i->freq < j->freq ? -1 : i->freq > j->freq;
+}
+
+static int cmp_freq_residency_task(const void *a, const void *b)
+{
+	const struct freq_residency_task *i = a, *j = b;
+
+	if (i->total == j->total)
+		return 0;
+
+	return i->total < j->total ? 1 : -1;
+}
+
+#define FREQ_RESIDENCY_TOP_N	20
+
+static void print_freq_residency_summary(void)
+{
+	int fd = bpf_map__fd(skel->maps.freq_residency);
+	struct freq_residency_key *prev_key = NULL, key;
+	struct freq_residency_entry *entries = NULL;
+	struct freq_residency_task *tasks = NULL;
+	int nr_entries = 0, nr_tasks = 0, top_n, i, j;
+	unsigned long long nr_live = 0, lost;
+	struct freq_residency res;
+
+	while (!bpf_map_get_next_key(fd, prev_key, &key)) {
+		struct freq_residency_entry *tmp;
+
+		prev_key = &key;
+		nr_live++;
+
+		if (bpf_map_lookup_elem(fd, &key, &res) || !res.time)
+			continue;
+
+		if (ignore_pid_comm(key.pid, res.comm))
+			continue;
+
+		tmp = realloc(entries, (nr_entries + 1) * sizeof(*entries));
+		if (!tmp)
+			break;
+		entries = tmp;
+
+		entries[nr_entries].pid = key.pid;
+		entries[nr_entries].freq = key.freq;
+		entries[nr_entries].time = res.time;
+		nr_entries++;
+
+		for (i = 0; i < nr_tasks; i++) {
+			if (tasks[i].pid == key.pid)
+				break;
+		}
+
+		if (i == nr_tasks) {
+			struct freq_residency_task *tmp_task;
+
+			tmp_task = realloc(tasks, (nr_tasks + 1) * sizeof(*tasks));
+			if (!tmp_task)
+				break;
+			tasks = tmp_task;
+
+			tasks[i].pid = key.pid;
+			memcpy(tasks[i].comm, res.comm, sizeof(tasks[i].comm));
+			tasks[i].total = 0;
+			nr_tasks++;
+		}
+
+		tasks[i].total += res.time;
+	}
+
+	qsort(entries, nr_entries, sizeof(*entries), cmp_freq_residency_entry);
+	qsort(tasks, nr_tasks, sizeof(*tasks), cmp_freq_residency_task);
+
+	/* Only the busiest tasks, unless they were explicitly selected */
+	top_n = sa_opts.num_pids || sa_opts.num_comms || sa_opts.num_cgroups ?
+		nr_tasks : FREQ_RESIDENCY_TOP_N;
+
+	printf("\nFrequency residency of tasks:\n");
+	lost = skel->bss->freq_residency_drops;
+	if (skel->bss->freq_residency_inserts > nr_live)
+		lost += skel->bss->freq_residency_inserts - nr_live;
+	if (lost)
+		printf("Incomplete, %llu (pid, freq) entries were evicted or didn't fit\n", lost);
+	printf("%8s %-16s %10s %12s %7s\n", "PID", "COMM", "FREQ(MHz)", "TIME(ms)", "%");
+	for (i = 0; i < nr_tasks && i < top_n; i++) {
+		for (j = 0; j < nr_entries; j++) {
+			if (entries[j].pid != tasks[i].pid)
+				continue;
+
+			printf("%8d %-16s %10u %12llu %6.2f%%\n",
+			       tasks[i].pid, tasks[i].comm, entries[j].freq / 1000,
+			       entries[j].time / 1000000,
+			       entries[j].time * 100.0 / tasks[i].total);
+		}
+	}
+
+	free(entries);
+	free(tasks);
+}
+
+static int lookup_sugov_stats(int fd, int policy_cpu, struct sugov_stats *stats)
+{
+	struct sugov_stats values[nr_cpus];
+	int cpu, err;
+
+	err = bpf_map_lookup_elem(fd, &policy_cpu, values);
+	if (err)
+		return err;
+
+	memset(stats, 0, sizeof(*stats));
+
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		stats->updates += values[cpu].updates;
+		stats->rate_limited += values[cpu].rate_limited;
+		stats->freq_changes += values[cpu].freq_changes;
+	}
+
+	return 0;
+}
+
+static void print_sugov_summary(void)
+{
+	int fd = bpf_map__fd(skel->maps.sugov_stats);
+	int *prev_key = NULL, key;
+	struct sugov_stats stats;
+
+	printf("\nschedutil requests:\n");
+	printf("%-8s %12s %12s %7s %12s\n",
+	       "policy", "updates", "rate_limited", "%", "freq_changes");
+
+	while (!bpf_map_get_next_key(fd, prev_key, &key)) {
+		prev_key = &key;
+
+		if (lookup_sugov_stats(fd, key, &stats) || !stats.updates)
+			continue;
+
+		printf("%-8d %12llu %12llu %6.2f%% %12llu\n",
+		       key, stats.updates, stats.rate_limited,
+		       stats.rate_limited * 100.0 / stats.updates,
+		       stats.freq_changes);
+	}
+}
+
+/*
+ * Read idle governor stats of a state for every CPU.
+ */
+static int lookup_idle_gov_stats(int state, struct idle_gov_stats *values)
+{
+	return bpf_map_lookup_elem(bpf_map__fd(skel->maps.idle_gov_stats), &state, values);
+}
+
+static void print_idle_gov_summary(void)
+{
+	struct idle_gov_stats values[nr_cpus];
+	unsigned long long total;
+	int cpu, state, outcome;
+
+	printf("\nIdle governor decisions:\n");
+	printf("%-6s %-6s %12s %12s %12s %9s\n",
+	       "cpu", "state", "hits", "too_deep", "too_shallow", "accuracy");
+
+	for (state = 0; state < MAX_IDLE_STATES; state++) {
+		if (lookup_idle_gov_stats(state, values))
+			continue;
+
+		for (cpu = 0; cpu < nr_cpus; cpu++) {
+			total = 0;
+			for (outcome = 0; outcome < NR_IDLE_GOV_OUTCOMES; outcome++)
+				total += values[cpu].count[outcome];
+
+			if (!total)
+				continue;
+
+			printf("%-6d %-6d %12llu %12llu %12llu %8.2f%%\n",
+			       cpu, state,
+			       values[cpu].count[IDLE_GOV_HIT],
+			       values[cpu].count[IDLE_GOV_TOO_DEEP],
+			       values[cpu].count[IDLE_GOV_TOO_SHALLOW],
+			       values[cpu].count[IDLE_GOV_HIT] * 100.0 / total);
+		}
+	}
+}
+
+struct ipi_total {
+	void *callback;
+	unsigned long long count;
+};
+
+static int cmp_ipi_total(const void *a, const void *b)
+{
+	const struct ipi_total *i = a;
+	const struct ipi_total *j = b;
+
+	return i->count < j->count ? 1 : i->count > j->count ? -1 : 0;
+}
+
+/*
+ * Sum up the ipi counts per (from_cpu, target_cpu) pair into matrix.
+ */
+static void lookup_ipi_matrix(unsigned long long *matrix)
+{
+	int fd = bpf_map__fd(skel->maps.ipi_count);
+	struct ipi_key *prev_key = NULL, key;
+	unsigned long long count;
+
+	memset(matrix, 0, nr_cpus * nr_cpus * sizeof(*matrix));
+
+	while (!bpf_map_get_next_key(fd, prev_key, &key)) {
+		prev_key = &key;
+
+		if (key.from_cpu >= nr_cpus || key.target_cpu >= nr_cpus)
+			continue;
+
+		if (bpf_map_lookup_elem(fd, &key, &count))
+			continue;
+
+		matrix[key.from_cpu * nr_cpus + key.target_cpu] += count;
+	}
+}
+
+static void print_ipi_summary(void)
+{
+	int fd = bpf_map__fd(skel->maps.ipi_count);
+	struct ipi_key *prev_key = NULL, key;
+	unsigned long long *matrix, count;
+	struct ipi_total *totals = NULL;
+	int nr_totals = 0, i, from, to;
+	char *name;
+
+	matrix = calloc(nr_cpus * nr_cpus, sizeof(*matrix));
+	if (!matrix)
+		return;
+
+	lookup_ipi_matrix(matrix);
+
+	printf("\nIPIs sent:\n");
+	if (skel->bss->ipi_count_drops)
+		printf("Incomplete, %llu (from, to, callback) entries didn't fit\n",
+		       (unsigned long long)skel->bss->ipi_count_drops);
+	printf("%-8s %-8s %12s\n", "from", "to", "count");
+	for (from = 0; from < nr_cpus; from++) {
+		for (to = 0; to < nr_cpus; to++) {
+			count = matrix[from * nr_cpus + to];
+			if (count)
+				printf("%-8d %-8d %12llu\n", from, to, count);
+		}
+	}
+	free(matrix);
+
+	/* Collapse per callback */
+	while (!bpf_map_get_next_key(fd, prev_key, &key)) {
+		prev_key = &key;
+
+		if (bpf_map_lookup_elem(fd, &key, &count))
+			continue;
+
+		for (i = 0; i < nr_totals; i++)
+			if (totals[i].callback == key.callback)
+				break;
+
+		if (i == nr_totals) {
+			struct ipi_total *tmp = realloc(totals, (nr_totals + 1) * sizeof(*totals));
+
+			if (!tmp)
+				break;
+
+			totals = tmp;
+			totals[nr_totals].callback = key.callback;
+			totals[nr_totals].count = 0;
+			nr_totals++;
+		}
+
+		totals[i].count += count;
+	}
+
+	qsort(totals, nr_totals, sizeof(*totals), cmp_ipi_total);
+
+	printf("\nIPIs sent per callback:\n");
+	printf("%-48s %12s\n", "callback", "count");
+	for (i = 0; i < nr_totals; i++) {
+		name = find_kallsyms(totals[i].callback);
+		if (name)
+			printf("%-48s %12llu\n", name, totals[i].count);
+		else
+			printf("%-48p %12llu\n", totals[i].callback, totals[i].count);
+	}
+
+	free(totals);
+}
+
+static void print_ipi_lat_table(struct bpf_map *map, const char *title)
+{
+	int fd = bpf_map__fd(map);
+	struct ipi_lat_key *prev_key = NULL, key;
+	struct log2_hist hist;
+	char *name;
+
+	printf("\n%s:\n", title);
+	printf("%-48s %6s %10s %10s %10s\n",
+	       "CALLBACK", "CPU", "COUNT", "AVG(ns)", "MAX(ns)");
+
+	while (!bpf_map_get_next_key(fd, prev_key, &key)) {
+		prev_key = &key;
+
+		if (bpf_map_lookup_elem(fd, &key, &hist) || !hist.count)
+			continue;
+
+		name = key.callback ? find_kallsyms(key.callback) : "reschedule";
+		if (name)
+			printf("%-48s", name);
+		else
+			printf("%-48p", key.callback);
+
+		printf(" %6d %10llu %10llu %10llu\n", key.cpu, hist.count,
+		       hist.total / hist.count, hist.max);
+	}
+}
+
+static void print_ipi_latency_summary(void)
+{
+	print_ipi_lat_table(skel->maps.ipi_lat_hist, "IPI delivery latency");
+	print_ipi_lat_table(skel->maps.ipi_func_hist, "IPI callback duration");
+}
+
+static void print_lb_phase_summary(void)
+{
+	int fd = bpf_map__fd(skel->maps.lb_phase_hist);
+	struct log2_hist hist;
+	int phase;
+
+	for (phase = 0; phase < NR_LB_PHASES; phase++) {
+		if (lookup_percpu_hist(fd, &phase, &hist) || !hist.count)
+			continue;
+
+		printf("\n%s duration: count = %llu avg = %llu nsecs max = %llu nsecs\n",
+		       lb_phase_names[phase], hist.count,
+		       hist.total / hist.count, hist.max);
+		print_log2_hist(&hist, "nsecs");
+	}
+}
+
+static int lookup_lb_stats(int level, struct lb_stats *stats)
+{
+	struct lb_stats values[nr_cpus];
+	int cpu, type, err;
+
+	err = bpf_map_lookup_elem(bpf_map__fd(skel->maps.lb_stats), &level, values);
+	if (err)
+		return err;
+
+	memset(stats, 0, sizeof(*stats));
+
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		stats->attempts += values[cpu].attempts;
+		stats->success += values[cpu].success;
+		stats->tasks_moved += values[cpu].tasks_moved;
+		stats->time += values[cpu].time;
+		for (type = 0; type < NR_LB_MIGRATION_TYPES; type++) {
+			stats->detach[type] += values[cpu].detach[type];
+			stats->imbalance_pulled[type] += values[cpu].imbalance_pulled[type];
+		}
+	}
+
+	return 0;
+}
+
+static void print_lb_stats_summary(void)
+{
+	int fd = bpf_map__fd(skel->maps.lb_busiest);
+	struct lb_busiest_key *prev_key = NULL, key;
+	unsigned long long count;
+	struct lb_stats stats;
+	int level, type;
+
+	printf("\nload_balance() per sched domain level:\n");
+	printf("%-6s %12s %12s %7s %12s %12s %10s\n",
+	       "level", "attempts", "success", "%", "tasks_moved", "time(us)", "avg(ns)");
+
+	for (level = 0; level < MAX_SD_LEVELS; level++) {
+		if (lookup_lb_stats(level, &stats) || !stats.attempts)
+			continue;
+
+		printf("%-6d %12llu %12llu %6.2f%% %12llu %12llu %10llu\n",
+		       level, stats.attempts, stats.success,
+		       stats.success * 100.0 / stats.attempts,
+		       stats.tasks_moved, stats.time / 1000,
+		       stats.time / stats.attempts);
+	}
+
+	printf("\ndetach_tasks() per imbalance type:\n");
+	printf("%-6s %-8s %12s %16s\n", "level", "type", "count", "imbalance_pulled");
+
+	for (level = 0; level < MAX_SD_LEVELS; level++) {
+		if (lookup_lb_stats(level, &stats))
+			continue;
+
+		for (type = 0; type < NR_LB_MIGRATION_TYPES; type++) {
+			if (!stats.detach[type])
+				continue;
+
+			printf("%-6d %-8s %12llu %16llu\n", level,
+			       migration_type_names[type], stats.detach[type],
+			       stats.imbalance_pulled[type]);
+		}
+	}
+
+	printf("\nTasks pulled from busiest CPU:\n");
+	printf("%-6s %-6s %12s\n", "level", "cpu", "tasks");
+
+	while (!bpf_map_get_next_key(fd, prev_key, &key)) {
+		prev_key = &key;
+
+		if (bpf_map_lookup_elem(fd, &key, &count))
+			continue;
+
+		printf("%-6d %-6d %12llu\n", key.level, key.cpu, count);
+	}
+}
+
+static void lookup_migrate_matrix(unsigned long long *matrix)
+{
+	int fd = bpf_map__fd(skel->maps.migrate_count);
+	struct migrate_key *prev_key = NULL, key;
+	unsigned long long count;
+
+	memset(matrix, 0, nr_cpus * nr_cpus * sizeof(*matrix));
+
+	while (!bpf_map_get_next_key(fd, prev_key, &key)) {
+		prev_key = &key;
+
+		if (key.from_cpu >= nr_cpus || key.to_cpu >= nr_cpus)
+			continue;
+
+		if (bpf_map_lookup_elem(fd, &key, &count))
+			continue;
+
+		matrix[key.from_cpu * nr_cpus + key.to_cpu] = count;
+	}
+}
+
+static int lookup_migrate_stats(struct migrate_stats *stats)
+{
+	struct migrate_stats values[nr_cpus];
+	int cpu, class, zero = 0, err;
+
+	err = bpf_map_lookup_elem(bpf_map__fd(skel->maps.migrate_stats), &zero, values);
+	if (err)
+		return err;
+
+	memset(stats, 0, sizeof(*stats));
+
+	for (cpu = 0; cpu < nr_cpus; cpu++)
+		for (class = 0; class < NR_MIGRATE_CLASSES; class++)
+			stats->count[class] += values[cpu].count[class];
+
+	return 0;
+}
+
+struct migrate_total {
+	int from_cpu;
+	int to_cpu;
+	unsigned long long count;
+};
+
+static int cmp_migrate_total(const void *a, const void *b)
+{
+	const struct migrate_total *i = a, *j = b;
+
+	if (i->count == j->count)
+		return 0;
+
+	return i->count < j->count ? 1 : -1;
+}
+
+struct migrate_task_total {
+	pid_t pid;
+	unsigned long long total;
+	struct migrate_task_stats stats;
+};
+
+static int cmp_migrate_task_total(const void *a, const void *b)
+{
+	const struct migrate_task_total *i = a, *j = b;
+
+	if (i->total == j->total)
+		return 0;
+
+	return i->total < j->total ? 1 : -1;
+}
+
+#define MIGRATE_TOP_N		20
+
+static void print_migrate_summary(void)
+{
+	int fd = bpf_map__fd(skel->maps.migrate_task_count);
+	struct migrate_task_total *tasks = NULL;
+	struct migrate_total *pairs = NULL;
+	int nr_pairs = 0, nr_tasks = 0, i, class;
+	struct migrate_task_stats task_stats;
+	pid_t *prev_key = NULL, key;
+	struct migrate_stats stats;
+	unsigned long long *matrix;
+
+	if (!lookup_migrate_stats(&stats)) {
+		printf("\nMigrations:\n");
+		for (class = 0; class < NR_MIGRATE_CLASSES; class++)
+			printf("%-12s %12llu\n", migrate_class_names[class], stats.count[class]);
+	}
+
+	matrix = calloc(nr_cpus * nr_cpus, sizeof(*matrix));
+	pairs = calloc(nr_cpus * nr_cpus, sizeof(*pairs));
+	if (!matrix || !pairs)
+		goto out;
+
+	lookup_migrate_matrix(matrix);
+
+	for (i = 0; i < nr_cpus * nr_cpus; i++) {
+		if (!matrix[i])
+			continue;
+
+		pairs[nr_pairs].from_cpu = i / nr_cpus;
+		pairs[nr_pairs].to_cpu = i % nr_cpus;
+		pairs[nr_pairs].count = matrix[i];
+		nr_pairs++;
+	}
+
+	qsort(pairs, nr_pairs, sizeof(*pairs), cmp_migrate_total);
+
+	printf("\nTop migrations between CPUs:\n");
+	printf("%-8s %-8s %12s\n", "from", "to", "count");
+	for (i = 0; i < nr_pairs && i < MIGRATE_TOP_N; i++)
+		printf("%-8d %-8d %12llu\n", pairs[i].from_cpu, pairs[i].to_cpu, pairs[i].count);
+
+	while (!bpf_map_get_next_key(fd, prev_key, &key)) {
+		struct migrate_task_total *tmp;
+
+		prev_key = &key;
+
+		if (bpf_map_lookup_elem(fd, &key, &task_stats))
+			continue;
+
+		if (ignore_pid_comm(key, task_stats.comm))
+			continue;
+
+		tmp = realloc(tasks, (nr_tasks + 1) * sizeof(*tasks));
+		if (!tmp)
+			break;
+		tasks = tmp;
+
+		tasks[nr_tasks].pid = key;
+		tasks[nr_tasks].stats = task_stats;
+		tasks[nr_tasks].total = 0;
+		/* NUMA moves and swaps are already accounted as migrations */
+		for (class = 0; class < MIGRATE_NUMA_MOVE; class++)
+			tasks[nr_tasks].total += task_stats.count[class];
+		nr_tasks++;
+	}
+
+	qsort(tasks, nr_tasks, sizeof(*tasks), cmp_migrate_task_total);
+
+	printf("\nTop migrating tasks:\n");
+	printf("%8s %-16s %12s", "PID", "COMM", "total");
+	for (class = 0; class < NR_MIGRATE_CLASSES; class++)
+		printf(" %12s", migrate_class_names[class]);
+	printf("\n");
+
+	for (i = 0; i < nr_tasks && i < MIGRATE_TOP_N; i++) {
+		printf("%8d %-16s %12llu", tasks[i].pid, tasks[i].stats.comm, tasks[i].total);
+		for (class = 0; class < NR_MIGRATE_CLASSES; class++)
+			printf(" %12llu", tasks[i].stats.count[class]);
+		printf("\n");
+	}
+out:
+	free(matrix);
+	free(pairs);
+	free(tasks);
+}
+
+static void print_cfs_throttle_summary(void)
+{
+	int fd = bpf_map__fd(skel->maps.cfs_throttle_hist);
+	struct cfs_throttle_key *prev_key = NULL, key;
+	struct log2_hist hist;
+	char *path;
+
+	printf("\nCFS bandwidth throttling per cgroup:\n");
+	if (skel->bss->cfs_throttle_drops)
+		printf("Incomplete, %llu throttling periods didn't fit in the maps\n",
+		       (unsigned long long)skel->bss->cfs_throttle_drops);
+	printf("%-48s %6s %10s %10s %10s %10s\n",
+	       "CGROUP", "CPU", "COUNT", "TOTAL(ms)", "AVG(us)", "MAX(us)");
+
+	while (!bpf_map_get_next_key(fd, prev_key, &key)) {
+		prev_key = &key;
+
+		if (bpf_map_lookup_elem(fd, &key, &hist) || !hist.count)
+			continue;
+
+		path = find_cgroup_path(key.cgroup_id);
+		printf("%-48s %6d %10llu %10llu %10llu %10llu\n",
+		       path ? path : "?", key.cpu, hist.count, hist.total / 1000,
+		       hist.total / hist.count, hist.max);
+	}
+}
+
+/*
+ * Add the stalls still in progress on every CPU, the kernel only folds them
+ * into times[] when the group changes state again. Like get_recent_times().
+ */
+static void psi_add_in_progress(unsigned long long cgroup_id,
+				struct psi_stats *stats, unsigned long long now)
+{
+	int fd = bpf_map__fd(skel->maps.psi_prev);
+	struct psi_cpu_key *prev_key = NULL, key;
+	struct psi_prev prev;
+	int stat;
+
+	while (!bpf_map_get_next_key(fd, prev_key, &key)) {
+		prev_key = &key;
+
+		if (key.cgroup_id != cgroup_id)
+			continue;
+
+		if (bpf_map_lookup_elem(fd, &key, &prev) || !prev.active || now < prev.ts)
+			continue;
+
+		for (stat = 0; stat < NR_PSI_STATS; stat++)
+			if (prev.active & (1 << stat))
+				stats->total[stat] += now - prev.ts;
+	}
+}
+
+static void print_psi_summary(void)
+{
+	int fd = bpf_map__fd(skel->maps.psi_stats);
+	unsigned long long *prev_key = NULL, key;
+	unsigned long long now = get_boot_ns();
+	struct psi_stats stats;
+	int stat;
+	char *path;
+
+	printf("\nPressure stall time per cgroup (ms):\n");
+	printf("%-48s", "CGROUP");
+	for (stat = 0; stat < NR_PSI_STATS; stat++)
+		printf(" %10s", psi_stat_names[stat]);
+	printf("\n");
+
+	while (!bpf_map_get_next_key(fd, prev_key, &key)) {
+		prev_key = &key;
+
+		if (bpf_map_lookup_elem(fd, &key, &stats))
+			continue;
+
+		psi_add_in_progress(key, &stats, now);
+
+		path = find_cgroup_path(key);
+		printf("%-48s", path ? path : "?");
+		for (stat = 0; stat < NR_PSI_STATS; stat++)
+			printf(" %10llu", stats.total[stat] / 1000000);
+		printf("\n");
+	}
+}
+
+static void print_rt_dl_summary(void)
+{
+	int fd = bpf_map__fd(skel->maps.rt_dl_stats);
+	struct rt_dl_stats stats;
+	int cpu;
+
+	printf("\nRT and DL activity per CPU:\n");
+	printf("%-6s %10s %10s %12s %10s %12s %10s %10s %10s %14s %10s %14s\n",
+	       "CPU", "rt_push", "rt_pushed", "push_time(us)", "rt_pull", "pull_time(us)",
+	       "dl_push", "dl_pull", "throttled", "throttled(ms)", "dl_server", "dl_server(ms)");
+
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		if (bpf_map_lookup_elem(fd, &cpu, &stats))
+			continue;
+
+		printf("%-6d %10llu %10llu %12llu %10llu %12llu %10llu %10llu %10llu %14llu %10llu %14llu\n",
+		       cpu, stats.rt_push, stats.rt_pushed, stats.rt_push_time / 1000,
+		       stats.rt_pull, stats.rt_pull_time / 1000,
+		       stats.dl_push, stats.dl_pull,
+		       stats.rt_throttled, stats.rt_throttled_time / 1000000,
+		       stats.dl_server_starts, stats.dl_server_time / 1000000);
+	}
+}
+
+struct eevdf_task_total {
+	pid_t pid;
+	unsigned long long total;
+	struct eevdf_stats stats;
+};
+
+static int cmp_eevdf_task_total(const void *a, const void *b)
+{
+	const struct eevdf_task_total *i = a, *j = b;
+
+	if (i->total == j->total)
+		return 0;
+
+	return i->total < j->total ? 1 : -1;
+}
+
+#define EEVDF_TOP_N		20
+
+static void print_eevdf_summary(void)
+{
+	int fd = bpf_map__fd(skel->maps.eevdf_stats);
+	struct eevdf_task_total *tasks = NULL;
+	pid_t *prev_key = NULL, key;
+	struct eevdf_stats stats;
+	int nr_tasks = 0, i;
+
+	while (!bpf_map_get_next_key(fd, prev_key, &key)) {
+		struct eevdf_task_total *tmp;
+
+		prev_key = &key;
+
+		if (bpf_map_lookup_elem(fd, &key, &stats))
+			continue;
+
+		if (ignore_pid_comm(key, stats.comm))
+			continue;
+
+		tmp = realloc(tasks, (nr_tasks + 1) * sizeof(*tasks));
+		if (!tmp)
+			break;
+		tasks = tmp;
+
+		tasks[nr_tasks].pid = key;
+		tasks[nr_tasks].stats = stats;
+		tasks[nr_tasks].total = stats.pos_lag.count + stats.neg_lag.count;
+		nr_tasks++;
+	}
+
+	qsort(tasks, nr_tasks, sizeof(*tasks), cmp_eevdf_task_total);
+
+	/* Positive lag: owed service, negative lag: received more than its share */
+	printf("\nEEVDF lag of tasks going to sleep (virtual us):\n");
+	printf("%8s %-16s %10s %8s %10s %10s %10s %10s %10s\n",
+	       "PID", "COMM", "sleeps", "neg(%)", "avg+lag", "max+lag",
+	       "avg-lag", "max-lag", "slice(us)");
+	for (i = 0; i < nr_tasks && i < EEVDF_TOP_N; i++) {
+		struct log2_hist *pos = &tasks[i].stats.pos_lag;
+		struct log2_hist *neg = &tasks[i].stats.neg_lag;
+
+		printf("%8d %-16s %10llu %8llu %10llu %10llu %10llu %10llu %10llu\n",
+		       tasks[i].pid, tasks[i].stats.comm, tasks[i].total,
+		       neg->count * 100 / tasks[i].total,
+		       pos->count ? pos->total / pos->count / 1000 : 0, pos->max / 1000,
+		       neg->count ? neg->total / neg->count / 1000 : 0, neg->max / 1000,
+		       tasks[i].stats.slice / 1000);
+	}
+
+	if (!sa_opts.num_pids && !sa_opts.num_comms && !sa_opts.num_cgroups)
+		goto out;
+
+	for (i = 0; i < nr_tasks; i++) {
+		printf("\n%s-%d positive lag:\n", tasks[i].stats.comm, tasks[i].pid);
+		print_log2_hist(&tasks[i].stats.pos_lag, "nsecs");
+		printf("\n%s-%d negative lag:\n", tasks[i].stats.comm, tasks[i].pid);
+		print_log2_hist(&tasks[i].stats.neg_lag, "nsecs");
+	}
+out:
+	free(tasks);
+}
+
+static void print_rq_lock_summary(void)
+{
+	int fd = bpf_map__fd(skel->maps.rq_lock_hist);
+	struct log2_hist hist;
+	int cpu;
+
+	printf("\nrq lock wait time per CPU:\n");
+
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		if (lookup_percpu_hist(fd, &cpu, &hist) || !hist.count)
+			continue;
+
+		printf("\nCPU%d: contentions = %llu total = %llu usecs avg = %llu nsecs max = %llu nsecs\n",
+		       cpu, hist.count, hist.total / 1000,
+		       hist.total / hist.count, hist.max);
+		print_log2_hist(&hist, "nsecs");
+	}
+}
+
+static void sample_runq_wait(unsigned long long ts)
+{
+	static unsigned long long *prev_total;
+	struct log2_hist values[nr_cpus];
+	pid_t *prev_key = NULL, key;
+	struct runq_wait_stats stats;
+	int fd, cpu, zero = 0;
+
+	if (!prev_total) {
+		prev_total = calloc(nr_cpus, sizeof(*prev_total));
+		if (!prev_total)
+			return;
+	}
+
+	/* Time spent waiting during the last period */
+	fd = bpf_map__fd(skel->maps.runq_wait_cpu_hist);
+	if (!bpf_map_lookup_elem(fd, &zero, values)) {
+		for (cpu = 0; cpu < nr_cpus; cpu++) {
+			trace_cpu_runq_wait(ts, cpu, values[cpu].total - prev_total[cpu]);
+			prev_total[cpu] = values[cpu].total;
+		}
+	}
+
+	/*
+	 * Only emit per task counters for filtered tasks, otherwise we'd end up
+	 * with a track for every task in the system.
+	 */
+	if (!sa_opts.num_pids && !sa_opts.num_comms)
+		return;
+
+	fd = bpf_map__fd(skel->maps.runq_wait_task);
+	while (!bpf_map_get_next_key(fd, prev_key, &key)) {
+		prev_key = &key;
+
+		if (bpf_map_lookup_elem(fd, &key, &stats))
+			continue;
+
+		if (ignore_pid_comm(key, stats.comm))
+			continue;
+
+		trace_task_runq_wait_total(ts, stats.comm, key, stats.hist.total);
+	}
+}
+
+static void sample_irq(unsigned long long ts)
+{
+	static unsigned long long *prev_softirq, *prev_hardirq;
+	static unsigned long long prev_vec[MAX_SOFTIRQS];
+	unsigned long long cpu_total[nr_cpus];
+	struct log2_hist values[nr_cpus];
+	int *prev_key = NULL, key;
+	int fd, cpu, vec;
+
+	if (!prev_softirq || !prev_hardirq) {
+		prev_softirq = calloc(nr_cpus, sizeof(*prev_softirq));
+		prev_hardirq = calloc(nr_cpus, sizeof(*prev_hardirq));
+		if (!prev_softirq || !prev_hardirq)
+			return;
+	}
+
+	/* Time spent in softirq per CPU and per vector during the last period */
+	if (sa_opts.softirq) {
+		memset(cpu_total, 0, sizeof(cpu_total));
+
+		fd = bpf_map__fd(skel->maps.softirq_hist);
+		for (vec = 0; vec < MAX_SOFTIRQS; vec++) {
+			unsigned long long vec_total = 0;
+
+			if (bpf_map_lookup_elem(fd, &vec, values))
+				continue;
+
+			for (cpu = 0; cpu < nr_cpus; cpu++) {
+				cpu_total[cpu] += values[cpu].total;
+				vec_total += values[cpu].total;
+			}
+
+			trace_softirq_time(ts, softirq_names[vec], vec_total - prev_vec[vec]);
+			prev_vec[vec] = vec_total;
+		}
+
+		for (cpu = 0; cpu < nr_cpus; cpu++) {
+			trace_cpu_softirq_time(ts, cpu, cpu_total[cpu] - prev_softirq[cpu]);
+			prev_softirq[cpu] = cpu_total[cpu];
+		}
+	}
+
+	/* Time spent in hardirq per CPU during the last period */
+	if (sa_opts.irq) {
+		memset(cpu_total, 0, sizeof(cpu_total));
+
+		fd = bpf_map__fd(skel->maps.hardirq_hist);
+		while (!bpf_map_get_next_key(fd, prev_key, &key)) {
+			prev_key = &key;
+
+			if (bpf_map_lookup_elem(fd, &key, values))
+				continue;
+
+			for (cpu = 0; cpu < nr_cpus; cpu++)
+				cpu_total[cpu] += values[cpu].total;
+		}
+
+		for (cpu = 0; cpu < nr_cpus; cpu++) {
+			trace_cpu_hardirq_time(ts, cpu, cpu_total[cpu] - prev_hardirq[cpu]);
+			prev_hardirq[cpu] = cpu_total[cpu];
+		}
+	}
+}
+
+static void sample_placement(unsigned long long ts)
+{
+	static struct placement_stats prev;
+	struct placement_stats stats;
+	int path, outcome;
+
+	if (lookup_placement_stats(&stats))
+		return;
+
+	/* Decisions taken during the last period */
+	for (path = 0; path < NR_PLACEMENT_PATHS; path++) {
+		for (outcome = 0; outcome < NR_PLACEMENT_OUTCOMES; outcome++) {
+			trace_placement_count(ts, placement_path_names[path],
+					      placement_outcome_names[outcome],
+					      stats.count[path][outcome] - prev.count[path][outcome]);
+		}
+	}
+
+	prev = stats;
+}
+
+static void sample_sugov(unsigned long long ts)
+{
+	static unsigned long long *prev_rate_limited;
+	int fd = bpf_map__fd(skel->maps.sugov_stats);
+	int *prev_key = NULL, key;
+	struct sugov_stats stats;
+
+	if (!prev_rate_limited) {
+		prev_rate_limited = calloc(nr_cpus, sizeof(*prev_rate_limited));
+		if (!prev_rate_limited)
+			return;
+	}
+
+	/* Requests dropped due to rate limit during the last period */
+	while (!bpf_map_get_next_key(fd, prev_key, &key)) {
+		prev_key = &key;
+
+		if (key < 0 || key >= nr_cpus)
+			continue;
+
+		if (lookup_sugov_stats(fd, key, &stats))
+			continue;
+
+		trace_sugov_rate_limited(ts, key, stats.rate_limited - prev_rate_limited[key]);
+		prev_rate_limited[key] = stats.rate_limited;
+	}
+}
+
+static void sample_idle_gov(unsigned long long ts)
+{
+	static struct idle_gov_stats *prev;
+	struct idle_gov_stats values[nr_cpus];
+	struct idle_gov_stats cpu_total[nr_cpus];
+	int cpu, state, outcome;
+
+	if (!prev) {
+		prev = calloc(nr_cpus, sizeof(*prev));
+		if (!prev)
+			return;
+	}
+
+	memset(cpu_total, 0, sizeof(cpu_total));
+
+	for (state = 0; state < MAX_IDLE_STATES; state++) {
+		if (lookup_idle_gov_stats(state, values))
+			continue;
+
+		for (cpu = 0; cpu < nr_cpus; cpu++)
+			for (outcome = 0; outcome < NR_IDLE_GOV_OUTCOMES; outcome++)
+				cpu_total[cpu].count[outcome] += values[cpu].count[outcome];
+	}
+
+	/* Decisions taken during the last period, for all states */
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		for (outcome = 0; outcome < NR_IDLE_GOV_OUTCOMES; outcome++) {
+			trace_idle_gov_count(ts, cpu, idle_gov_outcome_names[outcome],
+					     cpu_total[cpu].count[outcome] - prev[cpu].count[outcome]);
+		}
+		prev[cpu] = cpu_total[cpu];
+	}
+}
+
+static void sample_ipi(unsigned long long ts)
+{
+	static unsigned long long *prev;
+	unsigned long long *matrix;
+	int i;
+
+	if (!prev) {
+		prev = calloc(nr_cpus * nr_cpus, sizeof(*prev));
+		if (!prev)
+			return;
+	}
+
+	matrix = calloc(nr_cpus * nr_cpus, sizeof(*matrix));
+	if (!matrix)
+		return;
+
+	lookup_ipi_matrix(matrix);
+
+	/* IPIs sent during the last period, for pairs that ever talked */
+	for (i = 0; i < nr_cpus * nr_cpus; i++) {
+		if (!matrix[i])
+			continue;
+
+		trace_ipi_count(ts, i / nr_cpus, i % nr_cpus, matrix[i] - prev[i]);
+	}
+
+	free(prev);
+	prev = matrix;
+}
+
+static void sample_lb_stats(unsigned long long ts)
+{
+	static struct lb_stats prev[MAX_SD_LEVELS];
+	struct lb_stats stats;
+	int level;
+
+	/* Load balance activity during the last period */
+	for (level = 0; level < MAX_SD_LEVELS; level++) {
+		if (lookup_lb_stats(level, &stats) || !stats.attempts)
+			continue;
+
+		trace_lb_level_stat(ts, level, "attempts", stats.attempts - prev[level].attempts);
+		trace_lb_level_stat(ts, level, "success", stats.success - prev[level].success);
+		trace_lb_level_stat(ts, level, "tasks_moved", stats.tasks_moved - prev[level].tasks_moved);
+		trace_lb_level_stat(ts, level, "time", stats.time - prev[level].time);
+
+		prev[level] = stats;
+	}
+}
+
+static void sample_rq_lock(unsigned long long ts)
+{
+	static struct rq_lock_stats *prev_stats;
+	static unsigned long long *prev_wait;
+	int hist_fd = bpf_map__fd(skel->maps.rq_lock_hist);
+	int stats_fd = bpf_map__fd(skel->maps.rq_lock_stats);
+	int max_fd = bpf_map__fd(skel->maps.rq_lock_max_contenders);
+	unsigned long long max, zero = 0;
+	struct rq_lock_stats stats;
+	struct log2_hist hist;
+	int cpu;
+
+	if (!prev_stats) {
+		prev_stats = calloc(nr_cpus, sizeof(*prev_stats));
+		prev_wait = calloc(nr_cpus, sizeof(*prev_wait));
+		if (!prev_stats || !prev_wait) {
+			free(prev_stats);
+			free(prev_wait);
+			prev_stats = NULL;
+			prev_wait = NULL;
+			return;
+		}
+	}
+
+	/* Contention on the rq lock of every CPU during the last period */
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		if (bpf_map_lookup_elem(stats_fd, &cpu, &stats))
+			continue;
+
+		trace_rq_lock_count(ts, cpu, "contentions",
+				    stats.contentions - prev_stats[cpu].contentions);
+		prev_stats[cpu] = stats;
+
+		if (!lookup_percpu_hist(hist_fd, &cpu, &hist)) {
+			trace_rq_lock_count(ts, cpu, "wait", hist.total - prev_wait[cpu]);
+			prev_wait[cpu] = hist.total;
+		}
+
+		if (!bpf_map_lookup_elem(max_fd, &cpu, &max)) {
+			trace_rq_lock_count(ts, cpu, "max_contenders", max);
+			bpf_map_update_elem(max_fd, &cpu, &zero, BPF_ANY);
+		}
+	}
+}
+
+static void sample_migrate(unsigned long long ts)
+{
+	static struct migrate_stats prev_stats;
+	static unsigned long long *prev;
+	unsigned long long out[nr_cpus], in[nr_cpus];
+	int fd = bpf_map__fd(skel->maps.migrate_task_count);
+	struct migrate_task_stats task_stats;
+	pid_t *prev_key = NULL, key;
+	struct migrate_stats stats;
+	unsigned long long *matrix;
+	int i, cpu, class;
+
+	if (!lookup_migrate_stats(&stats)) {
+		for (class = 0; class < NR_MIGRATE_CLASSES; class++)
+			trace_migrate_count(ts, migrate_class_names[class],
+					    stats.count[class] - prev_stats.count[class]);
+		prev_stats = stats;
+	}
+
+	if (!prev) {
+		prev = calloc(nr_cpus * nr_cpus, sizeof(*prev));
+		if (!prev)
+			return;
+	}
+
+	matrix = calloc(nr_cpus * nr_cpus, sizeof(*matrix));
+	if (!matrix)
+		return;
+
+	lookup_migrate_matrix(matrix);
+
+	/*
+	 * Collapse the matrix into per CPU counters, a track per pair won't
+	 * scale on big machines.
+	 */
+	memset(out, 0, sizeof(out));
+	memset(in, 0, sizeof(in));
+	for (i = 0; i < nr_cpus * nr_cpus; i++) {
+		out[i / nr_cpus] += matrix[i] - prev[i];
+		in[i % nr_cpus] += matrix[i] - prev[i];
+	}
+
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		trace_cpu_migrate_count(ts, cpu, "out", out[cpu]);
+		trace_cpu_migrate_count(ts, cpu, "in", in[cpu]);
+	}
+
+	free(prev);
+	prev = matrix;
+
+	/*
+	 * Only emit per task counters for filtered tasks, otherwise we'd end up
+	 * with a track for every task in the system.
+	 */
+	if (!sa_opts.num_pids && !sa_opts.num_comms)
+		return;
+
+	while (!bpf_map_get_next_key(fd, prev_key, &key)) {
+		unsigned long long total = 0;
+
+		prev_key = &key;
+
+		if (bpf_map_lookup_elem(fd, &key, &task_stats))
+			continue;
+
+		if (ignore_pid_comm(key, task_stats.comm))
+			continue;
+
+		for (class = 0; class < MIGRATE_NUMA_MOVE; class++)
+			total += task_stats.count[class];
+
+		trace_task_migrate_count(ts, task_stats.comm, key, total);
+	}
+}
+
+static void sample_rt_dl(unsigned long long ts)
+{
+	static struct rt_dl_stats *prev;
+	int fd = bpf_map__fd(skel->maps.rt_dl_stats);
+	struct rt_dl_stats stats;
+	int cpu;
+
+	if (!prev) {
+		prev = calloc(nr_cpus, sizeof(*prev));
+		if (!prev)
+			return;
+	}
+
+	/* RT and DL activity during the last period */
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		if (bpf_map_lookup_elem(fd, &cpu, &stats))
+			continue;
+
+		trace_rt_dl_count(ts, cpu, "rt_push", stats.rt_push - prev[cpu].rt_push);
+		trace_rt_dl_count(ts, cpu, "rt_pull", stats.rt_pull - prev[cpu].rt_pull);
+		trace_rt_dl_count(ts, cpu, "dl_push", stats.dl_push - prev[cpu].dl_push);
+		trace_rt_dl_count(ts, cpu, "dl_pull", stats.dl_pull - prev[cpu].dl_pull);
+		trace_rt_dl_count(ts, cpu, "dl_server_time",
+				  stats.dl_server_time - prev[cpu].dl_server_time);
+
+		prev[cpu] = stats;
+	}
+}
+
+/*
+ * Per process PELT signals are emitted at stats_period rate, whatever the
+ * number of threads and how often their signals get updated.
+ */
+static void sample_pelt_tgid(unsigned long long ts)
+{
+	int fd = bpf_map__fd(skel->maps.tgid_pelt);
+	pid_t *prev_key = NULL, key, next_key;
+	struct tgid_pelt values[nr_cpus];
+	long long util_avg, runnable_avg, util_est;
+	char *comm;
+	int cpu;
+
+	while (!bpf_map_get_next_key(fd, prev_key, &next_key)) {
+		key = next_key;
+
+		if (bpf_map_lookup_elem(fd, &key, values)) {
+			prev_key = &key;
+			continue;
+		}
+
+		util_avg = runnable_avg = util_est = 0;
+		comm = NULL;
+		for (cpu = 0; cpu < nr_cpus; cpu++) {
+			util_avg += values[cpu].util_avg;
+			runnable_avg += values[cpu].runnable_avg;
+			util_est += values[cpu].util_est;
+			if (!comm && values[cpu].comm[0])
+				comm = values[cpu].comm;
+		}
+
+		if (!comm || ignore_pid_comm(key, comm)) {
+			prev_key = &key;
+			continue;
+		}
+
+		trace_tgid_pelt(ts, comm, key, "util_avg", util_avg);
+		trace_tgid_pelt(ts, comm, key, "runnable_avg", runnable_avg);
+		trace_tgid_pelt(ts, comm, key, "util_est", util_est);
+
+		/* The process is gone, nothing will update it anymore */
+		if (kill(key, 0) && errno == ESRCH) {
+			bpf_map_delete_elem(fd, &key);
+			continue;
+		}
+
+		prev_key = &key;
+	}
+}
+
+struct top_task {
+	pid_t pid;
+	unsigned long util;
+};
+
+static int cmp_top_task(const void *a, const void *b)
+{
+	const struct top_task *i = a, *j = b;
+
+	if (i->util == j->util)
+		return 0;
+
+	return i->util < j->util ? 1 : -1;
+}
+
+/* Refresh the allowlist of --top_tasks from the latest util of every task */
+static void refresh_top_tasks(void)
+{
+	int util_fd = bpf_map__fd(skel->maps.task_util);
+	int top_fd = bpf_map__fd(skel->maps.top_tasks);
+	pid_t *prev_key = NULL, key, next_key;
+	struct top_task *tasks = NULL;
+	int nr_tasks = 0, nr_top, i;
+	struct task_util value;
+	bool allowed = true;
+
+	while (!bpf_map_get_next_key(util_fd, prev_key, &key)) {
+		struct top_task *tmp;
+
+		prev_key = &key;
+
+		if (bpf_map_lookup_elem(util_fd, &key, &value))
+			continue;
+
+		if (ignore_pid_comm(key, value.comm))
+			continue;
+
+		tmp = realloc(tasks, (nr_tasks + 1) * sizeof(*tasks));
+		if (!tmp)
+			break;
+		tasks = tmp;
+
+		tasks[nr_tasks].pid = key;
+		tasks[nr_tasks].util = value.util;
+		nr_tasks++;
+	}
+
+	qsort(tasks, nr_tasks, sizeof(*tasks), cmp_top_task);
+	nr_top = nr_tasks < sa_opts.top_tasks ? nr_tasks : sa_opts.top_tasks;
+
+	/* Drop tasks that fell out of the top */
+	prev_key = NULL;
+	while (!bpf_map_get_next_key(top_fd, prev_key, &next_key)) {
+		key = next_key;
+
+		for (i = 0; i < nr_top; i++) {
+			if (tasks[i].pid == key)
+				break;
+		}
+
+		if (i == nr_top && !bpf_map_delete_elem(top_fd, &key))
+			continue;
+
+		prev_key = &key;
+	}
+
+	for (i = 0; i < nr_top; i++)
+		bpf_map_update_elem(top_fd, &tasks[i].pid, &allowed, BPF_ANY);
+
+	free(tasks);
+}
+
+static void sample_energy(unsigned long long ts)
+{
+	static unsigned long long prev_energy[EM_MAX_PDS], prev_ts;
+	static struct eas_stats prev;
+	unsigned long long energy;
+	struct eas_stats stats;
+	int i;
+
+	if (!lookup_eas_stats(&stats)) {
+		trace_eas_count(ts, "decisions", stats.decisions - prev.decisions);
+		trace_eas_count(ts, "prev_cpu", stats.prev_cpu - prev.prev_cpu);
+		trace_eas_count(ts, "est_saved", stats.saved - prev.saved);
+		prev = stats;
+	}
+
+	update_energy_pds();
+
+	/* Energy in uJ and average power in mW over the last period */
+	for (i = 0; i < nr_energy_pds; i++) {
+		energy = energy_pds[i].energy - prev_energy[i];
+
+		trace_pd_energy(ts, energy_pds[i].first_cpu, "energy_uj", energy / 1000);
+		if (prev_ts && ts > prev_ts)
+			trace_pd_energy(ts, energy_pds[i].first_cpu, "power_mw",
+					energy * 1000 / (ts - prev_ts));
+
+		prev_energy[i] = energy_pds[i].energy;
+	}
+
+	prev_ts = ts;
+}
+
+struct psi_total {
+	unsigned long long cgroup_id;
+	struct psi_stats stats;
+};
+
+static void sample_psi(unsigned long long ts)
+{
+	static struct psi_total *prev;
+	static int nr_prev;
+	int fd = bpf_map__fd(skel->maps.psi_stats);
+	unsigned long long *prev_key = NULL, key;
+	struct psi_total *totals = NULL;
+	int nr_totals = 0, i, j, stat;
+	struct psi_stats stats;
+	char *path;
+
+	while (!bpf_map_get_next_key(fd, prev_key, &key)) {
+		struct psi_total *tmp;
+
+		prev_key = &key;
+
+		if (bpf_map_lookup_elem(fd, &key, &stats))
+			continue;
+
+		psi_add_in_progress(key, &stats, ts);
+
+		tmp = realloc(totals, (nr_totals + 1) * sizeof(*totals));
+		if (!tmp)
+			break;
+
+		totals = tmp;
+		totals[nr_totals].cgroup_id = key;
+		totals[nr_totals].stats = stats;
+		nr_totals++;
+	}
+
+	/* Stall time during the last period */
+	for (i = 0; i < nr_totals; i++) {
+		struct psi_stats *last = NULL;
+
+		for (j = 0; j < nr_prev; j++) {
+			if (prev[j].cgroup_id == totals[i].cgroup_id) {
+				last = &prev[j].stats;
+				break;
+			}
+		}
+
+		path = find_cgroup_path(totals[i].cgroup_id);
+		if (!path)
+			continue;
+
+		for (stat = 0; stat < NR_PSI_STATS; stat++) {
+			unsigned long long total = totals[i].stats.total[stat];
+			unsigned long long prev_total = last ? last->total[stat] : 0;
+
+			/* The in progress part of last can overshoot what got folded */
+			trace_cgroup_psi(ts, path, psi_stat_names[stat],
+					 total > prev_total ? total - prev_total : 0);
+		}
+	}
+
+	free(prev);
+	prev = totals;
+	nr_prev = nr_totals;
+}
+
+struct cfs_throttle_total {
+	unsigned long long cgroup_id;
+	unsigned long long count;
+	unsigned long long total;
+};
+
+static void sample_cfs_throttle(unsigned long long ts)
+{
+	static struct cfs_throttle_total *prev;
+	static int nr_prev;
+	int fd = bpf_map__fd(skel->maps.cfs_throttle_hist);
+	struct cfs_throttle_key *prev_key = NULL, key;
+	struct cfs_throttle_total *totals = NULL;
+	int nr_totals = 0, i, j;
+	struct log2_hist hist;
+	char *path;
+
+	/* Collapse all CPUs of a cgroup */
+	while (!bpf_map_get_next_key(fd, prev_key, &key)) {
+		prev_key = &key;
+
+		if (bpf_map_lookup_elem(fd, &key, &hist))
+			continue;
+
+		for (i = 0; i < nr_totals; i++)
+			if (totals[i].cgroup_id == key.cgroup_id)
+				break;
+
+		if (i == nr_totals) {
+			struct cfs_throttle_total *tmp = realloc(totals, (nr_totals + 1) * sizeof(*totals));
+
+			if (!tmp)
+				break;
+
+			totals = tmp;
+			totals[nr_totals].cgroup_id = key.cgroup_id;
+			totals[nr_totals].count = 0;
+			totals[nr_totals].total = 0;
+			nr_totals++;
+		}
+
+		totals[i].count += hist.count;
+		totals[i].total += hist.total;
+	}
+
+	/* Throttling during the last period */
+	for (i = 0; i < nr_totals; i++) {
+		unsigned long long prev_count = 0, prev_total = 0;
+
+		for (j = 0; j < nr_prev; j++) {
+			if (prev[j].cgroup_id == totals[i].cgroup_id) {
+				prev_count = prev[j].count;
+				prev_total = prev[j].total;
+				break;
+			}
+		}
+
+		path = find_cgroup_path(totals[i].cgroup_id);
+		if (!path)
+			continue;
+
+		trace_cgroup_throttle_count(ts, path, "nr_throttled", totals[i].count - prev_count);
+		trace_cgroup_throttle_count(ts, path, "throttled_time", totals[i].total - prev_total);
+	}
+
+	free(prev);
+	prev = totals;
+	nr_prev = nr_totals;
+}
+
+/*
+ * Periodically sample in-kernel aggregated stats into perfetto counters.
+ */
+void *stats_thread_fn(void *data)
+{
+	unsigned long long ts;
+
+	while (!exiting) {
+		usleep(sa_opts.stats_period * 1000);
+
+		ts = get_boot_ns();
+
+		if (sa_opts.runq_wait)
+			sample_runq_wait(ts);
+		if (sa_opts.irq || sa_opts.softirq)
+			sample_irq(ts);
+		if (sa_opts.placement)
+			sample_placement(ts);
+		if (sa_opts.schedutil)
+			sample_sugov(ts);
+		if (sa_opts.idle_governor)
+			sample_idle_gov(ts);
+		if (sa_opts.ipi)
+			sample_ipi(ts);
+		if (sa_opts.load_balance_stats)
+			sample_lb_stats(ts);
+		if (sa_opts.rq_lock)
+			sample_rq_lock(ts);
+		if (sa_opts.migrations)
+			sample_migrate(ts);
+		if (sa_opts.cfs_throttle)
+			sample_cfs_throttle(ts);
+		if (sa_opts.psi)
+			sample_psi(ts);
+		if (sa_opts.rt_dl)
+			sample_rt_dl(ts);
+		if (sa_opts.energy)
+			sample_energy(ts);
+		if (sa_opts.pelt_tgid)
+			sample_pelt_tgid(ts);
+		if (sa_opts.top_tasks)
+			refresh_top_tasks();
+	}
+
+	return NULL;
+}
+
+/* Bandwidth controlled cgroups the cfs throttle maps have room for per CPU */
+#define CFS_THROTTLE_CGROUPS	64
+
+/*
+ * Maps keyed by CPU or CPU pairs have to grow with the number of CPUs, or they
+ * fill up on exactly the machines that need them.
+ */
+static void size_maps(void)
+{
+	__u32 entries = 2 * nr_cpus * nr_cpus;
+
+	if (sa_opts.ipi && entries > bpf_map__max_entries(skel->maps.ipi_count))
+		bpf_map__set_max_entries(skel->maps.ipi_count, entries);
+
+	entries = CFS_THROTTLE_CGROUPS * nr_cpus;
+	if (sa_opts.cfs_throttle && entries > bpf_map__max_entries(skel->maps.cfs_throttle_start)) {
+		bpf_map__set_max_entries(skel->maps.cfs_throttle_start, entries);
+		bpf_map__set_max_entries(skel->maps.cfs_throttle_hist, entries);
+	}
+}
+
+static bool vmlinux_has_type(const char *name, __u32 kind)
+{
+	struct btf *btf = btf__load_vmlinux_btf();
+	bool found;
+
+	if (libbpf_get_error(btf))
+		return false;
+
+	found = btf__find_by_name_kind(btf, name, kind) >= 0;
+	btf__free(btf);
+
+	return found;
+}
+
+int main(int argc, char **argv)
+{
+	INIT_EVENT_THREAD(rq_pelt);
+	INIT_EVENT_THREAD(task_pelt);
+	INIT_EVENT_THREAD(rq_nr_running);
+	INIT_EVENT_THREAD(sched_switch);
+	INIT_EVENT_THREAD(freq_idle);
+	INIT_EVENT_THREAD(lb);
+	INIT_EVENT_THREAD(lb_sd);
+	INIT_EVENT_THREAD(ipi);
+	INIT_EVENT_THREAD(ipi_lat);
+	INIT_EVENT_THREAD(wakeup_lat);
+	INIT_EVENT_THREAD(placement);
+	INIT_EVENT_THREAD(sugov);
+	INIT_EVENT_THREAD(idle_gov);
+	INIT_EVENT_THREAD(stack);
+	INIT_EVENT_THREAD(pmu);
+	INIT_EVENT_THREAD(cfs_throttle);
+	INIT_EVENT_THREAD(rt_throttle);
+	INIT_EVENT_THREAD(eevdf);
+	INIT_EVENT_THREAD(eas);
+	INIT_EVENT_THREAD(stats);
+	int err;
+
+	err = argp_parse(&argp, argc, argv, 0, NULL, NULL);
+	if (err)
+		return err;
+
+	if (sa_opts.ipi || sa_opts.ipi_latency || sa_opts.stacks)
+		parse_kallsyms();
+
+	nr_cpus = libbpf_num_possible_cpus();
+	if (nr_cpus < 0) {
+		fprintf(stderr, "Failed to get number of possible CPUs\n");
+		return 1;
+	}
+
+	init_perfetto();
+
+	signal(SIGINT, sig_handler);
+	signal(SIGTERM, sig_handler);
+
+	skel = sched_analyzer_bpf__open();
+	if (!skel) {
+		fprintf(stderr, "Failed to open and load BPF skeleton\n");
+		return 1;
+	}
+
+	/* Initialize BPF global variables */
+	skel->bss->sa_opts = sa_opts;
+	skel->bss->nr_cpu_ids = nr_cpus;
+	skel->bss->cgroup_v1 = cgroup_is_v1();
+
+	size_maps();
+
+	if (sa_opts.pmu)
+		init_cpu_capacity();
+	if (sa_opts.migrations)
+		init_cpu_topology();
+	if (sa_opts.energy)
+		init_energy_model();
+	if (sa_opts.energy || sa_opts.freq_residency)
+		init_cpu_freq();
+
+	if (!sa_opts.num_cgroups)
+		bpf_program__set_autoload(skel->progs.handle_cgroup_filter_switch, false);
+	if (!sa_opts.load_avg_cpu && !sa_opts.runnable_avg_cpu && !sa_opts.util_avg_cpu && !sa_opts.cgroup_pelt)
+		bpf_program__set_autoload(skel->progs.handle_pelt_cfs, false);
+	if (!sa_opts.load_avg_task && !sa_opts.runnable_avg_task && !sa_opts.util_avg_task &&
+	    !sa_opts.pelt_tgid)
+		bpf_program__set_autoload(skel->progs.handle_pelt_se, false);
+	if (!sa_opts.util_avg_rt)
+		bpf_program__set_autoload(skel->progs.handle_pelt_rt, false);
+	if (!sa_opts.util_avg_dl)
+		bpf_program__set_autoload(skel->progs.handle_pelt_dl, false);
+	if (!sa_opts.util_avg_irq)
+		bpf_program__set_autoload(skel->progs.handle_pelt_irq, false);
+	if (!sa_opts.load_avg_thermal)
+		bpf_program__set_autoload(skel->progs.handle_pelt_thermal, false);
+	if (!sa_opts.util_est_cpu)
+		bpf_program__set_autoload(skel->progs.handle_util_est_cfs, false);
+	if (!sa_opts.util_est_task && !sa_opts.pelt_tgid)
+		bpf_program__set_autoload(skel->progs.handle_util_est_se, false);
+	if (!sa_opts.pelt_tgid)
+		bpf_program__set_autoload(skel->progs.handle_pelt_tgid_exit, false);
+	if (!sa_opts.cpu_nr_running)
+		bpf_program__set_autoload(skel->progs.handle_sched_update_nr_running, false);
+	if (!sa_opts.cpu_idle) {
+		bpf_program__set_autoload(skel->progs.handle_cpu_idle, false);
+		bpf_program__set_autoload(skel->progs.handle_cpu_idle_miss, false);
+	}
+	if (!sa_opts.load_balance) {
+		bpf_program__set_autoload(skel->progs.handle_run_rebalance_domains_exit, false);
+		bpf_program__set_autoload(skel->progs.handle_run_rebalance_domains_entry, false);
+		bpf_program__set_autoload(skel->progs.handle_run_rebalance_domains_exit, false);
+		bpf_program__set_autoload(skel->progs.handle_rebalance_domains_entry, false);
+		bpf_program__set_autoload(skel->progs.handle_rebalance_domains_exit, false);
+		bpf_program__set_autoload(skel->progs.handle_balance_fair_entry, false);
+		bpf_program__set_autoload(skel->progs.handle_balance_fair_exit, false);
+		bpf_program__set_autoload(skel->progs.handle_pick_next_task_fair_entry, false);
+		bpf_program__set_autoload(skel->progs.handle_pick_next_task_fair_exit, false);
+		bpf_program__set_autoload(skel->progs.handle_newidle_balance_entry, false);
+		bpf_program__set_autoload(skel->progs.handle_newidle_balance_exit, false);
+		bpf_program__set_autoload(skel->progs.handle_load_balance_entry, false);
+		bpf_program__set_autoload(skel->progs.handle_load_balance_exit, false);
+	}
+	if (!sa_opts.load_balance_stats) {
+		bpf_program__set_autoload(skel->progs.handle_lb_stats_entry, false);
+		bpf_program__set_autoload(skel->progs.handle_lb_stats_exit, false);
+	} else if (libbpf_find_vmlinux_btf_id("load_balance", BPF_TRACE_FENTRY) < 0) {
+		/* Renamed in 6.10 */
+		bpf_program__set_attach_target(skel->progs.handle_lb_stats_entry, 0, "sched_balance_rq");
+		bpf_program__set_attach_target(skel->progs.handle_lb_stats_exit, 0, "sched_balance_rq");
+	}
+	if (!sa_opts.load_balance_stats || libbpf_find_vmlinux_btf_id("detach_tasks", BPF_TRACE_FENTRY) < 0) {
+		bpf_program__set_autoload(skel->progs.handle_detach_tasks_entry, false);
+		bpf_program__set_autoload(skel->progs.handle_detach_tasks_exit, false);
+	}
+	if (!sa_opts.ipi && !sa_opts.ipi_latency) {
+		bpf_program__set_autoload(skel->progs.handle_ipi_send_cpu, false);
+		bpf_program__set_autoload(skel->progs.handle_ipi_send_cpumask, false);
+	}
+	if (!sa_opts.ipi_latency) {
+		bpf_program__set_autoload(skel->progs.handle_csd_function_entry, false);
+		bpf_program__set_autoload(skel->progs.handle_csd_function_exit, false);
+	}
+	if (!sa_opts.ipi_latency || libbpf_find_vmlinux_btf_id("reschedule_entry", BPF_TRACE_RAW_TP) < 0)
+		bpf_program__set_autoload(skel->progs.handle_reschedule_entry, false);
+	if (!sa_opts.ipi_latency)
+		bpf_program__set_autoload(skel->progs.handle_ipi_entry, false);
+	if (!sa_opts.softirq) {
+		bpf_program__set_autoload(skel->progs.handle_softirq_entry, false);
+		bpf_program__set_autoload(skel->progs.handle_softirq_exit, false);
+	}
+	if (!sa_opts.irq) {
+		bpf_program__set_autoload(skel->progs.handle_irq_handler_entry, false);
+		bpf_program__set_autoload(skel->progs.handle_irq_handler_exit, false);
+	}
+	if (!sa_opts.wakeup_latency) {
+		bpf_program__set_autoload(skel->progs.handle_wakeup_latency_waking, false);
+		bpf_program__set_autoload(skel->progs.handle_wakeup_latency_wakeup_new, false);
+		bpf_program__set_autoload(skel->progs.handle_wakeup_latency_switch, false);
+	}
+	if (!sa_opts.runq_wait) {
+		bpf_program__set_autoload(skel->progs.handle_runq_wait_wakeup, false);
+		bpf_program__set_autoload(skel->progs.handle_runq_wait_wakeup_new, false);
+		bpf_program__set_autoload(skel->progs.handle_runq_wait_migrate_task, false);
+		bpf_program__set_autoload(skel->progs.handle_runq_wait_switch, false);
+	}
+	if (!sa_opts.placement) {
+		bpf_program__set_autoload(skel->progs.handle_select_task_rq_fair_entry, false);
+		bpf_program__set_autoload(skel->progs.handle_select_task_rq_fair_exit, false);
+	}
+	/*
+	 * The helpers select_task_rq_fair() calls are static and can be
+	 * inlined, only trace the ones that still exist on this kernel.
+	 */
+	if (!sa_opts.placement || libbpf_find_vmlinux_btf_id("find_energy_efficient_cpu", BPF_TRACE_FENTRY) < 0)
+		bpf_program__set_autoload(skel->progs.handle_find_energy_efficient_cpu_entry, false);
+	if (!sa_opts.placement || libbpf_find_vmlinux_btf_id("wake_affine", BPF_TRACE_FENTRY) < 0)
+		bpf_program__set_autoload(skel->progs.handle_wake_affine_entry, false);
+	if (!sa_opts.placement || libbpf_find_vmlinux_btf_id("select_idle_sibling", BPF_TRACE_FENTRY) < 0)
+		bpf_program__set_autoload(skel->progs.handle_select_idle_sibling_entry, false);
+	if (!sa_opts.placement || libbpf_find_vmlinux_btf_id("find_idlest_cpu", BPF_TRACE_FENTRY) < 0)
+		bpf_program__set_autoload(skel->progs.handle_find_idlest_cpu_entry, false);
+	if (!sa_opts.schedutil) {
+		bpf_program__set_autoload(skel->progs.handle_sugov_update_single_freq_entry, false);
+		bpf_program__set_autoload(skel->progs.handle_sugov_update_single_freq_exit, false);
+		bpf_program__set_autoload(skel->progs.handle_sugov_update_single_perf_entry, false);
+		bpf_program__set_autoload(skel->progs.handle_sugov_update_single_perf_exit, false);
+		bpf_program__set_autoload(skel->progs.handle_sugov_update_shared_entry, false);
+		bpf_program__set_autoload(skel->progs.handle_sugov_update_shared_exit, false);
+	}
+	if (!sa_opts.idle_governor) {
+		bpf_program__set_autoload(skel->progs.handle_tick_nohz_get_sleep_length_exit, false);
+		bpf_program__set_autoload(skel->progs.handle_cpuidle_reflect, false);
+	}
+	/* Governors can be compiled out */
+	if (!sa_opts.idle_governor || libbpf_find_vmlinux_btf_id("teo_select", BPF_TRACE_FENTRY) < 0) {
+		bpf_program__set_autoload(skel->progs.handle_teo_select_entry, false);
+		bpf_program__set_autoload(skel->progs.handle_teo_select_exit, false);
+	}
+	if (!sa_opts.idle_governor || libbpf_find_vmlinux_btf_id("menu_select", BPF_TRACE_FENTRY) < 0) {
+		bpf_program__set_autoload(skel->progs.handle_menu_select_entry, false);
+		bpf_program__set_autoload(skel->progs.handle_menu_select_exit, false);
+	}
+	if (!sa_opts.pmu)
+		bpf_program__set_autoload(skel->progs.handle_pmu_switch, false);
+	if (!sa_opts.migrations)
+		bpf_program__set_autoload(skel->progs.handle_migrate_task, false);
+	if (!sa_opts.eevdf)
+		bpf_program__set_autoload(skel->progs.handle_eevdf_switch, false);
+	/* 6.12+ DELAY_DEQUEUE, static and can be inlined */
+	if (!sa_opts.eevdf || libbpf_find_vmlinux_btf_id("dequeue_entities", BPF_TRACE_FEXIT) < 0)
+		bpf_program__set_autoload(skel->progs.handle_eevdf_dequeue_entities_exit, false);
+	else
+		skel->bss->eevdf_dequeue_hooked = true;
+	if (!sa_opts.pelt_running ||
+	    (!sa_opts.load_avg_task && !sa_opts.util_avg_task && !sa_opts.util_est_task))
+		bpf_program__set_autoload(skel->progs.handle_pelt_running_switch, false);
+	if (!sa_opts.freq_residency) {
+		bpf_program__set_autoload(skel->progs.handle_freq_residency_switch, false);
+		bpf_program__set_autoload(skel->progs.handle_freq_residency_cpu_frequency, false);
+	}
+	if (!sa_opts.energy) {
+		bpf_program__set_autoload(skel->progs.handle_energy_cpu_frequency, false);
+		bpf_program__set_autoload(skel->progs.handle_energy_cpu_idle, false);
+	}
+	if (!sa_opts.energy || libbpf_find_vmlinux_btf_id("find_energy_efficient_cpu", BPF_TRACE_FENTRY) < 0) {
+		bpf_program__set_autoload(skel->progs.handle_feec_entry, false);
+		bpf_program__set_autoload(skel->progs.handle_feec_exit, false);
+	}
+	/*
+	 * static inline, only visible when the compiler didn't inline it. Before
+	 * 6.0 it took (p, dst_cpu, pd) and the verifier would reject the loads
+	 * of the later arguments.
+	 */
+	if (!sa_opts.energy || libbpf_find_vmlinux_btf_id("compute_energy", BPF_TRACE_FEXIT) < 0 ||
+	    !vmlinux_has_type("energy_env", BTF_KIND_STRUCT))
+		bpf_program__set_autoload(skel->progs.handle_compute_energy_exit, false);
+	/*
+	 * RT and DL push/pull helpers are static and can be inlined, dl_server
+	 * only exists from 6.8.
+	 */
+	if (!sa_opts.rt_dl || libbpf_find_vmlinux_btf_id("push_rt_task", BPF_TRACE_FENTRY) < 0) {
+		bpf_program__set_autoload(skel->progs.handle_push_rt_task_entry, false);
+		bpf_program__set_autoload(skel->progs.handle_push_rt_task_exit, false);
+	}
+	if (!sa_opts.rt_dl || libbpf_find_vmlinux_btf_id("pull_rt_task", BPF_TRACE_FENTRY) < 0) {
+		bpf_program__set_autoload(skel->progs.handle_pull_rt_task_entry, false);
+		bpf_program__set_autoload(skel->progs.handle_pull_rt_task_exit, false);
+	}
+	if (!sa_opts.rt_dl || libbpf_find_vmlinux_btf_id("push_dl_task", BPF_TRACE_FENTRY) < 0)
+		bpf_program__set_autoload(skel->progs.handle_push_dl_task_entry, false);
+	if (!sa_opts.rt_dl || libbpf_find_vmlinux_btf_id("pull_dl_task", BPF_TRACE_FENTRY) < 0)
+		bpf_program__set_autoload(skel->progs.handle_pull_dl_task_entry, false);
+	/* runqueues is only in BTF when per-cpu variables are */
+	if (!sa_opts.rt_dl || libbpf_find_vmlinux_btf_id("sched_rt_runtime_exceeded", BPF_TRACE_FEXIT) < 0 ||
+	    libbpf_find_vmlinux_btf_id("do_sched_rt_period_timer", BPF_TRACE_FEXIT) < 0 ||
+	    !vmlinux_has_type("runqueues", BTF_KIND_VAR)) {
+		bpf_program__set_autoload(skel->progs.handle_sched_rt_runtime_exceeded_exit, false);
+		bpf_program__set_autoload(skel->progs.handle_do_sched_rt_period_timer_exit, false);
+	}
+	if (!sa_opts.rt_dl || libbpf_find_vmlinux_btf_id("dl_server_start", BPF_TRACE_FENTRY) < 0 ||
+	    libbpf_find_vmlinux_btf_id("dl_server_stop", BPF_TRACE_FENTRY) < 0) {
+		bpf_program__set_autoload(skel->progs.handle_dl_server_start_entry, false);
+		bpf_program__set_autoload(skel->progs.handle_dl_server_stop_entry, false);
+	}
+	/* Requires CONFIG_PSI */
+	if (!sa_opts.psi || libbpf_find_vmlinux_btf_id("psi_task_change", BPF_TRACE_FENTRY) < 0 ||
+	    libbpf_find_vmlinux_btf_id("psi_group_change", BPF_TRACE_FEXIT) < 0) {
+		bpf_program__set_autoload(skel->progs.handle_psi_task_change_entry, false);
+		bpf_program__set_autoload(skel->progs.handle_psi_group_change_exit, false);
+		bpf_program__set_autoload(skel->progs.handle_psi_cgroup_rmdir, false);
+	}
+	/* Requires CONFIG_CFS_BANDWIDTH */
+	if (!sa_opts.cfs_throttle || libbpf_find_vmlinux_btf_id("throttle_cfs_rq", BPF_TRACE_FEXIT) < 0 ||
+	    libbpf_find_vmlinux_btf_id("unthrottle_cfs_rq", BPF_TRACE_FENTRY) < 0) {
+		bpf_program__set_autoload(skel->progs.handle_throttle_cfs_rq_exit, false);
+		bpf_program__set_autoload(skel->progs.handle_unthrottle_cfs_rq_entry, false);
+	}
+	/* Only present with CONFIG_NUMA_BALANCING */
+	if (!sa_opts.migrations || libbpf_find_vmlinux_btf_id("sched_move_numa", BPF_TRACE_RAW_TP) < 0)
+		bpf_program__set_autoload(skel->progs.handle_move_numa, false);
+	if (!sa_opts.migrations || libbpf_find_vmlinux_btf_id("sched_swap_numa", BPF_TRACE_RAW_TP) < 0)
+		bpf_program__set_autoload(skel->progs.handle_swap_numa, false);
+	if (!sa_opts.rq_lock || !vmlinux_has_type("runqueues", BTF_KIND_VAR)) {
+		bpf_program__set_autoload(skel->progs.handle_contention_begin, false);
+		bpf_program__set_autoload(skel->progs.handle_contention_end, false);
+	}
+
+	/* Make sure we zero out PELT signals for tasks when they exit */
+	if (!sa_opts.load_avg_task && !sa_opts.runnable_avg_task && !sa_opts.util_avg_task && !sa_opts.util_est_task)
+		bpf_program__set_autoload(skel->progs.handle_sched_process_free, false);
+
+	/* We can't reliably attach to those yet, so always disable them */
+	bpf_program__set_autoload(skel->progs.handle_nohz_idle_balance_entry, false);
+	bpf_program__set_autoload(skel->progs.handle_nohz_idle_balance_exit, false);
+
+	/*
+	 * Were used for old csv mode, no longer used but keep the traces lying
+	 * around but disabled for now.
+	 */
+	bpf_program__set_autoload(skel->progs.handle_cpu_frequency, false);
+
+	/*
+	 * Was used to zero out pelt signals when task is not running.
+	 */
+	bpf_program__set_autoload(skel->progs.handle_sched_switch, false);
+
+
+	err = sched_analyzer_bpf__load(skel);
+	if (err) {
+		fprintf(stderr, "Failed to load and verify BPF skeleton\n");
+		goto cleanup;
+	}
+
+	err = init_cgroup_filter();
+	if (err)
+		goto cleanup;
+
+	if (sa_opts.pmu) {
+		err = open_pmu_events();
+		if (err)
+			goto cleanup;
+	}
+
+	err = sched_analyzer_bpf__attach(skel);
+	if (err) {
+		fprintf(stderr, "Failed to attach BPF skeleton\n");
+		goto cleanup;
+	}
+
+	CREATE_EVENT_THREAD(rq_pelt);
+	CREATE_EVENT_THREAD(task_pelt);
+	CREATE_EVENT_THREAD(rq_nr_running);
+	CREATE_EVENT_THREAD(sched_switch);
+	CREATE_EVENT_THREAD(freq_idle);
+	CREATE_EVENT_THREAD(lb);
+	CREATE_EVENT_THREAD(lb_sd);
+	CREATE_EVENT_THREAD(ipi);
+	CREATE_EVENT_THREAD(ipi_lat);
+	CREATE_EVENT_THREAD(wakeup_lat);
+	CREATE_EVENT_THREAD(placement);
+	CREATE_EVENT_THREAD(sugov);
+	CREATE_EVENT_THREAD(idle_gov);
+	CREATE_EVENT_THREAD(stack);
+	CREATE_EVENT_THREAD(pmu);
+	CREATE_EVENT_THREAD(cfs_throttle);
+	CREATE_EVENT_THREAD(rt_throttle);
+	CREATE_EVENT_THREAD(eevdf);
+	CREATE_EVENT_THREAD(eas);
+	CREATE_EVENT_THREAD(stats);
+
+	printf("Collecting data, CTRL+c to stop\n");
 
 	start_perfetto_trace();
 
@@ -451,15 +3293,65 @@ int main(int argc, char **argv)
 
 	printf("\rCollected %s/%s\n", sa_opts.output_path, sa_opts.output);
 
+	if (sa_opts.wakeup_latency)
+		print_wakeup_latency_summary();
+	if (sa_opts.runq_wait)
+		print_runq_wait_summary();
+	if (sa_opts.irq || sa_opts.softirq)
+		print_irq_summary();
+	if (sa_opts.placement)
+		print_placement_summary();
+	if (sa_opts.schedutil)
+		print_sugov_summary();
+	if (sa_opts.idle_governor)
+		print_idle_gov_summary();
+	if (sa_opts.ipi)
+		print_ipi_summary();
+	if (sa_opts.ipi_latency)
+		print_ipi_latency_summary();
+	if (sa_opts.load_balance)
+		print_lb_phase_summary();
+	if (sa_opts.load_balance_stats)
+		print_lb_stats_summary();
+	if (sa_opts.rq_lock)
+		print_rq_lock_summary();
+	if (sa_opts.migrations)
+		print_migrate_summary();
+	if (sa_opts.cfs_throttle)
+		print_cfs_throttle_summary();
+	if (sa_opts.psi)
+		print_psi_summary();
+	if (sa_opts.rt_dl)
+		print_rt_dl_summary();
+	if (sa_opts.eevdf)
+		print_eevdf_summary();
+	if (sa_opts.energy)
+		print_energy_summary();
+	if (sa_opts.freq_residency)
+		print_freq_residency_summary();
+
 cleanup:
 	DESTROY_EVENT_THREAD(rq_pelt);
 	DESTROY_EVENT_THREAD(task_pelt);
 	DESTROY_EVENT_THREAD(rq_nr_running);
 	DESTROY_EVENT_THREAD(sched_switch);
 	DESTROY_EVENT_THREAD(freq_idle);
-	DESTROY_EVENT_THREAD(softirq);
 	DESTROY_EVENT_THREAD(lb);
+	DESTROY_EVENT_THREAD(lb_sd);
 	DESTROY_EVENT_THREAD(ipi);
+	DESTROY_EVENT_THREAD(ipi_lat);
+	DESTROY_EVENT_THREAD(wakeup_lat);
+	DESTROY_EVENT_THREAD(placement);
+	DESTROY_EVENT_THREAD(sugov);
+	DESTROY_EVENT_THREAD(idle_gov);
+	DESTROY_EVENT_THREAD(stack);
+	DESTROY_EVENT_THREAD(pmu);
+	DESTROY_EVENT_THREAD(cfs_throttle);
+	DESTROY_EVENT_THREAD(rt_throttle);
+	DESTROY_EVENT_THREAD(eevdf);
+	DESTROY_EVENT_THREAD(eas);
+	DESTROY_EVENT_THREAD(stats);
 	sched_analyzer_bpf__destroy(skel);
+	close_pmu_events();
 	return err < 0 ? -err : 0;
 }